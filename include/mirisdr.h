@@ -32,6 +32,7 @@ extern "C" {
 #endif
 
 #include <stdint.h>
+#include <stddef.h>
 #include <mirisdr_export.h>
 
 typedef enum
@@ -50,6 +51,20 @@ typedef enum
     MIRISDR_BAND_L,
 } mirisdr_band_t;
 
+typedef enum
+{
+    MIRISDR_SCHED_DEFAULT,
+    MIRISDR_SCHED_FIFO,
+    MIRISDR_SCHED_RR,
+} mirisdr_sched_t;
+
+typedef enum
+{
+    MIRISDR_MLOCK_OFF,
+    MIRISDR_MLOCK_BUFFERS,
+    MIRISDR_MLOCK_ALL,
+} mirisdr_mlock_t;
+
 typedef struct mirisdr_dev mirisdr_dev_t;
 
 /* devices */
@@ -76,6 +91,68 @@ MIRISDR_API int mirisdr_cancel_async (mirisdr_dev_t *p);
 MIRISDR_API int mirisdr_cancel_async_now (mirisdr_dev_t *p);            /* extra */
 MIRISDR_API int mirisdr_start_async (mirisdr_dev_t *p);                 /* extra */
 MIRISDR_API int mirisdr_stop_async (mirisdr_dev_t *p);                  /* extra */
+MIRISDR_API uint64_t mirisdr_get_sample_index (mirisdr_dev_t *p);       /* extra */
+typedef unsigned char *(*mirisdr_get_buffer_cb_t) (uint32_t len, void *ctx);
+MIRISDR_API int mirisdr_set_async_buffer (mirisdr_dev_t *p, mirisdr_get_buffer_cb_t cb, void *ctx); /* extra */
+
+/* async without a thread of its own, driven by an external event loop */
+typedef struct mirisdr_pollfd {
+    int fd;
+    short events;   /* POLLIN / POLLOUT */
+} mirisdr_pollfd_t;
+MIRISDR_API int mirisdr_poll_start (mirisdr_dev_t *p, mirisdr_read_async_cb_t cb, void *ctx, uint32_t num, uint32_t len); /* extra */
+MIRISDR_API int mirisdr_poll_get_fds (mirisdr_dev_t *p, mirisdr_pollfd_t *fds, int max);      /* extra */
+/* milliseconds to wait at most, -1 when nothing is pending (wait forever), -2 on error */
+MIRISDR_API int mirisdr_poll_timeout (mirisdr_dev_t *p);                                      /* extra */
+MIRISDR_API int mirisdr_poll_process (mirisdr_dev_t *p);                                      /* extra */
+MIRISDR_API int mirisdr_poll_stop (mirisdr_dev_t *p);                                         /* extra */
+
+/* streaming thread, applied to the thread calling mirisdr_read_async / mirisdr_read_sync,
+ * the channel workers keep the default policy and each takes one cpu of the list */
+MIRISDR_API int mirisdr_set_realtime (mirisdr_dev_t *p, mirisdr_sched_t policy, int priority);     /* extra */
+MIRISDR_API int mirisdr_set_cpu_affinity (mirisdr_dev_t *p, const int *cpus, int count);          /* extra */
+MIRISDR_API int mirisdr_set_mlock (mirisdr_dev_t *p, mirisdr_mlock_t mode);                       /* extra */
+
+/* latency tracing, only with a library built with -DTRACE=ON */
+MIRISDR_API int mirisdr_trace_start (mirisdr_dev_t *p, uint32_t entries);           /* extra */
+MIRISDR_API int mirisdr_trace_dump (mirisdr_dev_t *p, const char *path);            /* extra */
+
+/* narrowband front end fused with the unpacking: fs/4 rotation and CIC decimation by a power of two,
+ * the async output is then 16 bit I/Q at rate / decimation, only while not streaming */
+MIRISDR_API int mirisdr_set_frontend (mirisdr_dev_t *p, int rotate, uint32_t decimation);           /* extra */
+
+/* digital down converter channels, offset from the center in Hz, the output rate is in_rate / an integer,
+ * the callback gets len complex samples as interleaved float I/Q, attached channels run on worker threads */
+typedef struct mirisdr_channel mirisdr_channel_t;
+typedef void(*mirisdr_channel_cb_t) (const float *iq, uint32_t len, void *ctx);
+MIRISDR_API int mirisdr_channel_create (mirisdr_channel_t **c, uint32_t in_rate, int32_t offset, uint32_t bandwidth,
+                                        uint32_t rate, mirisdr_channel_cb_t cb, void *ctx);                     /* extra */
+MIRISDR_API uint32_t mirisdr_channel_get_rate (mirisdr_channel_t *c);                                           /* extra */
+MIRISDR_API int mirisdr_channel_process (mirisdr_channel_t *c, const int16_t *iq, uint32_t len);                /* extra */
+MIRISDR_API int mirisdr_channel_destroy (mirisdr_channel_t *c);                                                 /* extra */
+MIRISDR_API int mirisdr_add_channel (mirisdr_dev_t *p, mirisdr_channel_t *c);                                   /* extra */
+MIRISDR_API int mirisdr_remove_channel (mirisdr_dev_t *p, mirisdr_channel_t *c);                                /* extra */
+MIRISDR_API int mirisdr_set_channel_threads (mirisdr_dev_t *p, int threads);                                    /* extra */
+
+/* polyphase filterbank, a power of two channels spaced rate / channels apart, channel k centered at
+ * k * rate / channels (the upper half negative), output at rate / channels or twice that when oversampled */
+typedef struct mirisdr_channelizer mirisdr_channelizer_t;
+typedef void(*mirisdr_channelizer_cb_t) (int channel, const float *iq, uint32_t len, void *ctx);
+MIRISDR_API int mirisdr_channelizer_create (mirisdr_channelizer_t **z, uint32_t channels, int oversample,
+                                            mirisdr_channelizer_cb_t cb, void *ctx);                    /* extra */
+MIRISDR_API int mirisdr_channelizer_select (mirisdr_channelizer_t *z, int channel, int on);              /* extra */
+MIRISDR_API int mirisdr_channelizer_process (mirisdr_channelizer_t *z, const int16_t *iq, uint32_t len); /* extra */
+MIRISDR_API int mirisdr_channelizer_destroy (mirisdr_channelizer_t *z);                                 /* extra */
+MIRISDR_API int mirisdr_add_channelizer (mirisdr_dev_t *p, mirisdr_channelizer_t *z);                   /* extra */
+MIRISDR_API int mirisdr_remove_channelizer (mirisdr_dev_t *p, mirisdr_channelizer_t *z);                /* extra */
+
+/* memory mapped file output */
+typedef struct mirisdr_mmap_sink mirisdr_mmap_sink_t;
+MIRISDR_API int mirisdr_mmap_sink_open (mirisdr_mmap_sink_t **s, const char *path, size_t window);  /* extra */
+MIRISDR_API unsigned char *mirisdr_mmap_sink_reserve (mirisdr_mmap_sink_t *s, size_t len);         /* extra */
+MIRISDR_API int mirisdr_mmap_sink_commit (mirisdr_mmap_sink_t *s, size_t len);                     /* extra */
+MIRISDR_API int mirisdr_mmap_sink_write (mirisdr_mmap_sink_t *s, const void *buf, size_t len);     /* extra */
+MIRISDR_API int mirisdr_mmap_sink_close (mirisdr_mmap_sink_t *s);                                  /* extra */
 
 /* adc */
 MIRISDR_API int mirisdr_adc_init (mirisdr_dev_t *p);                    /* extra */
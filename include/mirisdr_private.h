@@ -31,6 +31,7 @@
 #define min(a, b) (((a) < (b)) ? (a) : (b))
 #endif
 
+#include <pthread.h>
 #include <libusb.h>
 
 #ifndef LIBUSB_CALL
@@ -59,6 +60,45 @@
 
 #define DEFAULT_BUF_NUMBER      32
 
+/*
+ * Parameters of the unpacking, published by mirisdr_set_hard() as one word and
+ * taken by the event thread at a transfer boundary.  The generation makes
+ * every publication visible even when the values repeat.
+ */
+#define MIRISDR_PARAMS(gen, format, addr)   (((uint32_t) (gen) << 16) | ((uint32_t) (addr) << 4) | (uint32_t) (format))
+#define MIRISDR_PARAMS_FORMAT(v)            ((int) ((v) & 0x0f))
+#define MIRISDR_PARAMS_ADDR(v)              (((v) >> 4) & 0x0fff)
+
+/* one arena for the transfer buffers and the unpacked samples */
+#define MIRISDR_CACHE_LINE      64
+#define MIRISDR_HUGE_PAGE       (2 * 1024 * 1024)
+
+/********************************* atomic.h *********************************/
+
+/* 32 bit fields shared by the control threads and the thread running the libusb events */
+#if defined(__GNUC__)
+#define mirisdr_load(x)                     __atomic_load_n((x), __ATOMIC_ACQUIRE)
+#define mirisdr_store(x, v)                 __atomic_store_n((x), (v), __ATOMIC_RELEASE)
+#define mirisdr_cas(x, e, v) \
+    __atomic_compare_exchange_n((x), (e), (v), 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#else
+#include <intrin.h>
+/* MSVC gives volatile accesses acquire/release semantics */
+#define mirisdr_load(x)                     (*(volatile long *) (x))
+#define mirisdr_store(x, v)                 (*(volatile long *) (x) = (long) (v))
+static __inline int mirisdr_cas_long (volatile long *x, long *e, long v) {
+    long old = _InterlockedCompareExchange(x, v, *e);
+    if (old == *e) return 1;
+    *e = old;
+    return 0;
+}
+#define mirisdr_cas(x, e, v)                mirisdr_cas_long((volatile long *) (x), (long *) (e), (long) (v))
+#endif
+
+#define mirisdr_async_get(p)                mirisdr_load((int *) &(p)->async_status)
+#define mirisdr_async_set(p, s)             mirisdr_store((int *) &(p)->async_status, (int) (s))
+#define mirisdr_async_cas(p, e, s)          mirisdr_cas((int *) &(p)->async_status, (e), (int) (s))
+
 /******************************** structs.h *********************************/
 
 typedef struct mirisdr_device {
@@ -133,23 +173,85 @@ struct mirisdr_dev {
         MIRISDR_ASYNC_PAUSED,
         MIRISDR_ASYNC_FAILED
     } async_status;
+    pthread_mutex_t     async_lock;     /* only for waiting on async_done */
+    pthread_cond_t      async_done;     /* async_status became inactive or failed */
+    pthread_mutex_t     ctrl_lock;      /* recursive, serializes the setters */
+    uint32_t            params;         /* MIRISDR_PARAMS, written by the control side */
+    uint32_t            params_gen;
+    uint32_t            params_seen;    /* event thread only from here on */
+    int                 stream_format;
     mirisdr_read_async_cb_t cb;
     void                *cb_ctx;
+    mirisdr_get_buffer_cb_t buf_cb;
+    void                *buf_ctx;
     size_t              xfer_buf_num;
     struct libusb_transfer **xfer;
     unsigned char       **xfer_buf;
+    size_t              xfer_buf_len;
+    int                 xfer_dev_mem;   /* xfer_buf from libusb_dev_mem_alloc */
+    unsigned char       *xfer_arena;
+    size_t              xfer_arena_len;
+    int                 xfer_arena_huge;
+    /* geometry of the pool, it lives across reads until mirisdr_close */
+    size_t              pool_buf_num;
+    int                 pool_transfer;
+    size_t              pool_out_len;
+    mirisdr_mlock_t     pool_mlock;
     size_t              xfer_out_len;
     size_t              xfer_out_pos;
     unsigned char       *xfer_out;
+    uint64_t            xfer_out_index;
+    uint64_t            sample_index;   /* header index of the current transfer */
+    uint64_t            cb_index;       /* header index of the buffer in the callback */
     uint32_t            addr;
     int                 driver_active;
     int                 bias;
     int                 reg8;
     uint8_t             *samples;
     int                 samples_size;
+    int                 samples_arena;  /* samples point into xfer_arena */
     int                 sync_loss_cnt;
+    struct mirisdr_trace *trace;
+    struct mirisdr_frontend *frontend;  /* rotace a decimace při rozbalení */
+
+    /* kanály DDC a vlákna, která je počítají */
+    struct mirisdr_consumer *consumers;
+    int                 channel_threads;
+    struct mirisdr_channel_pool *channel_pool;
+
+    /* plánování vlákna, které čte data */
+    mirisdr_sched_t     sched_policy;
+    int                 sched_priority;
+    int                 *cpus;
+    int                 cpu_count;
+    mirisdr_mlock_t     mlock;
+    int                 sched_pending;  /* sync reads apply it on the next read */
+};
+
+/********************************** trace.h **********************************/
+
+/* tracepoints, compiled in only with -DTRACE=ON */
+enum {
+    MIRISDR_TRACE_URB = 0,
+    MIRISDR_TRACE_UNPACK,
+    MIRISDR_TRACE_FEED,
+    MIRISDR_TRACE_CALLBACK,
+    MIRISDR_TRACE_MAX
 };
 
+#ifdef MIRISDR_TRACE
+void mirisdr_trace_event (mirisdr_dev_t *p, int id, char phase, uint32_t arg);
+void mirisdr_trace_free (mirisdr_dev_t *p);
+#define MIRISDR_TRACE_BEGIN(p, id, arg) \
+    do { if ((p)->trace) mirisdr_trace_event((p), (id), 'B', (arg)); } while (0)
+#define MIRISDR_TRACE_END(p, id, arg) \
+    do { if ((p)->trace) mirisdr_trace_event((p), (id), 'E', (arg)); } while (0)
+#else
+#define mirisdr_trace_free(p)               do { } while (0)
+#define MIRISDR_TRACE_BEGIN(p, id, arg)     do { } while (0)
+#define MIRISDR_TRACE_END(p, id, arg)       do { } while (0)
+#endif
+
 /********************************** soft.h ***********************************/
 
 /*** Register 0: IC Mode / Power Control ***/
@@ -278,10 +380,38 @@ int mirisdr_set_soft(mirisdr_dev_t *p);
 mirisdr_device_t *mirisdr_device_get (uint16_t vid, uint16_t pid);
 int mirisdr_write_reg (mirisdr_dev_t *p, uint8_t reg, uint32_t val);
 
+int mirisdr_async_free (mirisdr_dev_t *p);
+
+void *mirisdr_thread_enter (mirisdr_dev_t *p);
+void mirisdr_thread_leave (void *saved);
+void mirisdr_thread_worker (int cpu);
+void mirisdr_buffer_lock (mirisdr_dev_t *p, void *buf, size_t len);
+void mirisdr_buffer_unlock (mirisdr_dev_t *p, void *buf, size_t len);
+
 int mirisdr_samples_convert_252_s16 (mirisdr_dev_t *p, unsigned char* buf, uint8_t *dst8, int cnt);
 int mirisdr_samples_convert_336_s16 (mirisdr_dev_t *p, unsigned char* buf, uint8_t *dst8, int cnt);
 int mirisdr_samples_convert_384_s16 (mirisdr_dev_t *p, unsigned char* buf, uint8_t *dst8, int cnt);
 int mirisdr_samples_convert_504_s16 (mirisdr_dev_t *p, unsigned char* buf, uint8_t *dst8, int cnt);
 int mirisdr_samples_convert_504_s8 (mirisdr_dev_t *p, unsigned char* src, uint8_t *dst, int cnt);
 
+void mirisdr_frontend_reset (mirisdr_dev_t *p);
+uint32_t mirisdr_frontend_delay (mirisdr_dev_t *p);
+uint32_t mirisdr_frontend_decimation (mirisdr_dev_t *p);
+int mirisdr_frontend_run (mirisdr_dev_t *p, unsigned char *buf, uint8_t *dst8, int cnt);
+
+/* a channel or a channelizer fed by the worker pool (channel.c) */
+struct mirisdr_consumer {
+    int                 (*process) (struct mirisdr_consumer *c, const int16_t *iq, uint32_t len);
+    mirisdr_dev_t       *dev;
+    int                 worker;
+    struct mirisdr_consumer *next;
+};
+
+int mirisdr_consumer_add (mirisdr_dev_t *p, struct mirisdr_consumer *c);
+int mirisdr_consumer_remove (mirisdr_dev_t *p, struct mirisdr_consumer *c);
+int mirisdr_channels_start (mirisdr_dev_t *p, size_t block_bytes);
+void mirisdr_channels_stop (mirisdr_dev_t *p);
+void mirisdr_channels_feed (mirisdr_dev_t *p, const uint8_t *samples, uint32_t bytes, int s8);
+void mirisdr_channels_detach (mirisdr_dev_t *p);
+
 #endif
\ No newline at end of file
@@ -18,8 +18,24 @@
 #include "mirisdr_private.h"
 #include <stdio.h>
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+/* předání dat aplikaci */
+static void mirisdr_callback_run (mirisdr_dev_t *p, unsigned char *buf, uint32_t len, uint64_t index) {
+    p->cb_index = index;
+
+    MIRISDR_TRACE_BEGIN(p, MIRISDR_TRACE_CALLBACK, len);
+    p->cb(buf, len, p->cb_ctx);
+    MIRISDR_TRACE_END(p, MIRISDR_TRACE_CALLBACK, len);
+}
+
 /* uložení dat */
-static int mirisdr_feed_async (mirisdr_dev_t *p, unsigned char *samples, uint32_t bytes) {
+static int mirisdr_feed_async (mirisdr_dev_t *p, unsigned char *samples, uint32_t bytes, uint32_t sample_bytes,
+                               uint64_t index, uint32_t step) {
     uint32_t i;
 
     if (!p) goto failed;
@@ -32,7 +48,7 @@ static int mirisdr_feed_async (mirisdr_dev_t *p, unsigned char *samples, uint32_
     /* auto size */
     if (!p->xfer_out_len) {
         /* direct call */
-        p->cb(samples, bytes, p->cb_ctx);
+        mirisdr_callback_run(p, samples, bytes, index);
     /* fixed buffer size without previous data */
     } else {
         while (p->xfer_out_pos + bytes >= p->xfer_out_len) {
@@ -40,17 +56,19 @@ static int mirisdr_feed_async (mirisdr_dev_t *p, unsigned char *samples, uint32_
 
             if (p->xfer_out_pos > 0) {
                 memcpy(p->xfer_out + p->xfer_out_pos, samples, (size_t)i);
-                p->cb(p->xfer_out, p->xfer_out_len, p->cb_ctx);
+                mirisdr_callback_run(p, p->xfer_out, p->xfer_out_len, p->xfer_out_index);
             }
             else {
-                p->cb(samples, i, p->cb_ctx);
+                mirisdr_callback_run(p, samples, i, index);
             }
 
             bytes -= i;
             samples += i;
+            index += (uint64_t) (i / sample_bytes) * step;
             p->xfer_out_pos = 0;
         }
         if (bytes > 0) {
+            if (p->xfer_out_pos == 0) p->xfer_out_index = index;
             memcpy(p->xfer_out + p->xfer_out_pos, samples, (size_t)bytes);
             p->xfer_out_pos += bytes;
         }
@@ -61,27 +79,88 @@ failed:
     return -1;
 }
 
+/* extend the 32 bit sample counter from the block header to 64 bits */
+static void mirisdr_index_update (mirisdr_dev_t *p, const unsigned char *src) {
+    uint32_t addr = src[3] << 24 | src[2] << 16 | src[1] << 8 | src[0] << 0;
+    uint64_t index = (p->sample_index & ~(uint64_t) 0xffffffff) | addr;
+
+    /* the counter wrapped around since the last transfer */
+    if (index + 0x80000000ULL < p->sample_index) index += 0x100000000ULL;
+
+    p->sample_index = index;
+}
+
+/* header index of the first sample in the buffer handed to the async callback */
+uint64_t mirisdr_get_sample_index (mirisdr_dev_t *p) {
+    if (!p) return 0;
+
+    return p->cb_index;
+}
+
+/* let the unpackers write straight into application memory, only with automatic output size */
+int mirisdr_set_async_buffer (mirisdr_dev_t *p, mirisdr_get_buffer_cb_t cb, void *ctx) {
+    if (!p) goto failed;
+
+    /* nelze měnit za běhu */
+    if (mirisdr_async_get(p) != MIRISDR_ASYNC_INACTIVE) goto failed;
+
+    p->buf_cb = cb;
+    p->buf_ctx = ctx;
+
+    return 0;
+
+failed:
+    return -1;
+}
+
 static uint8_t *samples_realloc(mirisdr_dev_t *p, int size)
 {
     if(p->samples_size < size)
     {
-        if(p->samples)
+        /* the arena is sized for the largest format, this is only a safety net */
+        if((p->samples) && (!p->samples_arena))
+        {
+            mirisdr_buffer_unlock(p, p->samples, p->samples_size);
             free(p->samples);
+        }
+        p->samples_arena=0;
         p->samples=malloc(size);
         p->samples_size=size;
+        mirisdr_buffer_lock(p, p->samples, size);
     }
     return p->samples;
 }
 
-static int _process_isochronous_transfer(mirisdr_dev_t *p, struct libusb_transfer *xfer) {
+/* destination of the unpacked samples, either supplied by the application or our own */
+static uint8_t *samples_get(mirisdr_dev_t *p, int size)
+{
+    uint8_t *samples;
+
+    if ((p->buf_cb) && (!p->xfer_out_len) &&
+        (samples = p->buf_cb((uint32_t) size, p->buf_ctx))) {
+        return samples;
+    }
+
+    return samples_realloc(p, size);
+}
+
+static int _process_isochronous_transfer(mirisdr_dev_t *p, struct libusb_transfer *xfer, uint8_t **out) {
     size_t i;
     int len, bytes = 0;
     static unsigned char *iso_packet_buf;
     uint8_t *samples = p->samples;
 
-    switch (p->format) {
+    for (i = 0; i < DEFAULT_ISO_PACKETS; i++) {
+        if ((xfer->iso_packet_desc[i].actual_length > 0) &&
+            (iso_packet_buf = libusb_get_iso_packet_buffer_simple(xfer, i))) {
+            mirisdr_index_update(p, iso_packet_buf);
+            break;
+        }
+    }
+
+    switch (p->stream_format) {
     case MIRISDR_FORMAT_252_S16:
-        samples = samples_realloc(p, 504 * DEFAULT_ISO_BUFFERS * DEFAULT_ISO_PACKETS * 2);
+        samples = samples_get(p, 504 * DEFAULT_ISO_BUFFERS * DEFAULT_ISO_PACKETS * 2);
         for (i = 0; i < DEFAULT_ISO_PACKETS; i++) {
             struct libusb_iso_packet_descriptor *packet = &xfer->iso_packet_desc[i];
 
@@ -95,7 +174,7 @@ static int _process_isochronous_transfer(mirisdr_dev_t *p, struct libusb_transfe
         }
         break;
     case MIRISDR_FORMAT_336_S16:
-        samples = samples_realloc(p, 672 * DEFAULT_ISO_BUFFERS * DEFAULT_ISO_PACKETS * 2);
+        samples = samples_get(p, 672 * DEFAULT_ISO_BUFFERS * DEFAULT_ISO_PACKETS * 2);
         for (i = 0; i < DEFAULT_ISO_PACKETS; i++) {
             struct libusb_iso_packet_descriptor *packet = &xfer->iso_packet_desc[i];
             if ((packet->actual_length > 0) &&
@@ -106,7 +185,7 @@ static int _process_isochronous_transfer(mirisdr_dev_t *p, struct libusb_transfe
         }
         break;
     case MIRISDR_FORMAT_384_S16:
-        samples = samples_realloc(p, 768 * DEFAULT_ISO_BUFFERS * DEFAULT_ISO_PACKETS * 2);
+        samples = samples_get(p, 768 * DEFAULT_ISO_BUFFERS * DEFAULT_ISO_PACKETS * 2);
         for (i = 0; i < DEFAULT_ISO_PACKETS; i++) {
             struct libusb_iso_packet_descriptor *packet = &xfer->iso_packet_desc[i];
             if ((packet->actual_length > 0) &&
@@ -117,7 +196,7 @@ static int _process_isochronous_transfer(mirisdr_dev_t *p, struct libusb_transfe
         }
         break;
     case MIRISDR_FORMAT_504_S16:
-        samples = samples_realloc(p, 1008 * DEFAULT_ISO_BUFFERS * DEFAULT_ISO_PACKETS * 2);
+        samples = samples_get(p, 1008 * DEFAULT_ISO_BUFFERS * DEFAULT_ISO_PACKETS * 2);
         for (i = 0; i < DEFAULT_ISO_PACKETS; i++) {
             struct libusb_iso_packet_descriptor *packet = &xfer->iso_packet_desc[i];
             if ((packet->actual_length > 0) &&
@@ -128,7 +207,7 @@ static int _process_isochronous_transfer(mirisdr_dev_t *p, struct libusb_transfe
         }
         break;
     case MIRISDR_FORMAT_504_S8:
-        samples = samples_realloc(p, 1008 * DEFAULT_ISO_BUFFERS * DEFAULT_ISO_PACKETS);
+        samples = samples_get(p, 1008 * DEFAULT_ISO_BUFFERS * DEFAULT_ISO_PACKETS);
         for (i = 0; i < DEFAULT_ISO_PACKETS; i++) {
             struct libusb_iso_packet_descriptor *packet = &xfer->iso_packet_desc[i];
             if ((packet->actual_length > 0) &&
@@ -140,66 +219,169 @@ static int _process_isochronous_transfer(mirisdr_dev_t *p, struct libusb_transfe
         break;
     }
 
+    *out = samples;
     return bytes;
 }
 
-static int _process_bulk_transfer(mirisdr_dev_t *p, struct libusb_transfer *xfer) {
+static int _process_bulk_transfer(mirisdr_dev_t *p, struct libusb_transfer *xfer, uint8_t **out) {
     int bytes = 0;
     uint8_t *samples = p->samples;
 
-    switch (p->format) {
+    if (xfer->actual_length >= 16) mirisdr_index_update(p, xfer->buffer);
+
+    switch (p->stream_format) {
     case MIRISDR_FORMAT_252_S16:
-        samples = samples_realloc(p, (DEFAULT_BULK_BUFFER / 1024) * 1008);
+        samples = samples_get(p, (DEFAULT_BULK_BUFFER / 1024) * 1008);
         bytes = mirisdr_samples_convert_252_s16(p, xfer->buffer, samples, xfer->actual_length);
         break;
     case MIRISDR_FORMAT_336_S16:
-        samples = samples_realloc(p, (DEFAULT_BULK_BUFFER / 1024) * 1344);
+        samples = samples_get(p, (DEFAULT_BULK_BUFFER / 1024) * 1344);
         bytes = mirisdr_samples_convert_336_s16(p, xfer->buffer, samples, xfer->actual_length);
         break;
     case MIRISDR_FORMAT_384_S16:
-        samples = samples_realloc(p, (DEFAULT_BULK_BUFFER / 1024) * 1536);
+        samples = samples_get(p, (DEFAULT_BULK_BUFFER / 1024) * 1536);
         bytes = mirisdr_samples_convert_384_s16(p, xfer->buffer, samples, xfer->actual_length);
         break;
     case MIRISDR_FORMAT_504_S16:
-        samples = samples_realloc(p, (DEFAULT_BULK_BUFFER / 1024) * 2016);
+        samples = samples_get(p, (DEFAULT_BULK_BUFFER / 1024) * 2016);
         bytes = mirisdr_samples_convert_504_s16(p, xfer->buffer, samples, xfer->actual_length);
         break;
     case MIRISDR_FORMAT_504_S8:
-        samples = samples_realloc(p, (DEFAULT_BULK_BUFFER / 1024) * 1008);
+        samples = samples_get(p, (DEFAULT_BULK_BUFFER / 1024) * 1008);
         bytes = mirisdr_samples_convert_504_s8(p, xfer->buffer, samples, xfer->actual_length);
         break;
     }
 
+    *out = samples;
     return bytes;
 }
 
+static size_t mirisdr_samples_max (mirisdr_dev_t *p);
+
+/* front end instead of plain unpacking, the output is never larger than the 504_S16 one */
+static int _process_frontend_transfer(mirisdr_dev_t *p, struct libusb_transfer *xfer, uint8_t **out) {
+    size_t i;
+    int bytes = 0, first = 1;
+    unsigned char *iso_packet_buf;
+    uint8_t *samples = samples_get(p, (int) mirisdr_samples_max(p));
+
+    if (xfer->type == LIBUSB_TRANSFER_TYPE_BULK) {
+        if (xfer->actual_length >= 16) mirisdr_index_update(p, xfer->buffer);
+        bytes = mirisdr_frontend_run(p, xfer->buffer, samples, xfer->actual_length);
+    } else {
+        for (i = 0; i < DEFAULT_ISO_PACKETS; i++) {
+            struct libusb_iso_packet_descriptor *packet = &xfer->iso_packet_desc[i];
+
+            if ((packet->actual_length > 0) &&
+                (iso_packet_buf = libusb_get_iso_packet_buffer_simple(xfer, i))) {
+                if (first) {
+                    mirisdr_index_update(p, iso_packet_buf);
+                    first = 0;
+                }
+                bytes += mirisdr_frontend_run(p, iso_packet_buf, samples + bytes, packet->actual_length);
+            }
+        }
+    }
+
+    *out = samples;
+    return bytes;
+}
+
+/* final states, wakes up mirisdr_cancel_async_now */
+static void mirisdr_async_finish (mirisdr_dev_t *p, int status) {
+    pthread_mutex_lock(&p->async_lock);
+    mirisdr_async_set(p, status);
+    pthread_cond_broadcast(&p->async_done);
+    pthread_mutex_unlock(&p->async_lock);
+}
+
+/* let the thread in libusb_handle_events_timeout notice the new state immediately */
+static void mirisdr_async_wakeup (mirisdr_dev_t *p) {
+#if defined(LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000105)
+    if (p->ctx) libusb_interrupt_event_handler(p->ctx);
+#else
+    (void) p;
+#endif
+}
+
 /* called when data is received */
 static void LIBUSB_CALL _libusb_callback (struct libusb_transfer *xfer) {
     int bytes = 0;
+    uint8_t *samples = NULL;
+    uint32_t usb_bytes = 0, params, delay;
+    uint64_t index;
     mirisdr_dev_t *p = (mirisdr_dev_t*) xfer->user_data;
 
     if (!p) goto failed;
 
     /* we will only process a completed transfer */
     if (xfer->status == LIBUSB_TRANSFER_COMPLETED) {
+#ifdef MIRISDR_TRACE
+        if (xfer->type == LIBUSB_TRANSFER_TYPE_ISOCHRONOUS) {
+            int i;
+            for (i = 0; i < xfer->num_iso_packets; i++)
+                usb_bytes += xfer->iso_packet_desc[i].actual_length;
+        } else {
+            usb_bytes = xfer->actual_length;
+        }
+#endif
+        MIRISDR_TRACE_BEGIN(p, MIRISDR_TRACE_URB, usb_bytes);
+        MIRISDR_TRACE_BEGIN(p, MIRISDR_TRACE_UNPACK, usb_bytes);
+
         /*
-          * To determine the correct buffer size, this part must be done
-          * in one step, otherwise the format may change in the middle of the process,
-          * the second option is to use lock.
+         * New parameters from the control threads are taken only here, between
+         * two transfers, so the format can't change in the middle of one.
          */
+        params = mirisdr_load(&p->params);
+        if (params != p->params_seen) {
+            p->params_seen = params;
+            p->stream_format = MIRISDR_PARAMS_FORMAT(params);
+            p->addr = MIRISDR_PARAMS_ADDR(params);
+        }
+
+        /* the first output sample of the front end lags the header index */
+        delay = p->frontend ? mirisdr_frontend_delay(p) : 0;
+
         switch (xfer->type) {
         case LIBUSB_TRANSFER_TYPE_ISOCHRONOUS:
-            bytes = _process_isochronous_transfer(p, xfer);
+            if (p->frontend) {
+                bytes = _process_frontend_transfer(p, xfer, &samples);
+                break;
+            }
+            bytes = _process_isochronous_transfer(p, xfer, &samples);
             break;
         case LIBUSB_TRANSFER_TYPE_BULK:
-            bytes = _process_bulk_transfer(p, xfer);
+            if (p->frontend) {
+                bytes = _process_frontend_transfer(p, xfer, &samples);
+                break;
+            }
+            bytes = _process_bulk_transfer(p, xfer, &samples);
             break;
         default:
             fprintf( stderr, "not isoc or bulk transfer type on usb device: %u\n", p->index);
             goto failed;
         }
 
-        if (bytes > 0) mirisdr_feed_async(p, p->samples, bytes);
+        MIRISDR_TRACE_END(p, MIRISDR_TRACE_UNPACK, bytes);
+
+        index = p->sample_index + delay;
+
+        /* kanály dostanou kopii, aplikace data dál může měnit */
+        if ((bytes > 0) && (p->channel_pool)) {
+            mirisdr_channels_feed(p, samples, (uint32_t) bytes,
+                                  (!p->frontend) && (p->stream_format == MIRISDR_FORMAT_504_S8));
+        }
+
+        if ((bytes > 0) && (p->cb)) {
+            MIRISDR_TRACE_BEGIN(p, MIRISDR_TRACE_FEED, bytes);
+            if (p->frontend) {
+                mirisdr_feed_async(p, samples, bytes, 4, index, mirisdr_frontend_decimation(p));
+            } else {
+                mirisdr_feed_async(p, samples, bytes,
+                                   (p->stream_format == MIRISDR_FORMAT_504_S8) ? 2 : 4, index, 1);
+            }
+            MIRISDR_TRACE_END(p, MIRISDR_TRACE_FEED, bytes);
+        }
 
         if (xfer->type == LIBUSB_TRANSFER_TYPE_BULK)
         {
@@ -216,6 +398,8 @@ static void LIBUSB_CALL _libusb_callback (struct libusb_transfer *xfer) {
             fprintf( stderr, "error re-submitting URB on device %u\n", p->index);
             goto failed;
         }
+
+        MIRISDR_TRACE_END(p, MIRISDR_TRACE_URB, usb_bytes);
     } else if (xfer->status != LIBUSB_TRANSFER_CANCELLED) {
         fprintf( stderr, "error async transfer status %d on device %u\n", xfer->status, p->index);
         goto failed;
@@ -226,24 +410,28 @@ static void LIBUSB_CALL _libusb_callback (struct libusb_transfer *xfer) {
 failed:
     mirisdr_cancel_async(p);
     /* the failed status has absolute priority */
-    p->async_status = MIRISDR_ASYNC_FAILED;
+    mirisdr_async_finish(p, MIRISDR_ASYNC_FAILED);
 }
 
 /* ukončení async části */
 int mirisdr_cancel_async (mirisdr_dev_t *p) {
+    int status;
+
     if (!p) goto failed;
 
-    switch (p->async_status) {
-    case MIRISDR_ASYNC_INACTIVE:
-    case MIRISDR_ASYNC_CANCELING:
-        goto canceled;
-    case MIRISDR_ASYNC_RUNNING:
-    case MIRISDR_ASYNC_PAUSED:
-        p->async_status = MIRISDR_ASYNC_CANCELING;
-        break;
-    case MIRISDR_ASYNC_FAILED:
-        goto failed;
-    }
+    /* may race with the event thread failing, the failed status must stay */
+    status = mirisdr_async_get(p);
+    do {
+        switch (status) {
+        case MIRISDR_ASYNC_INACTIVE:
+        case MIRISDR_ASYNC_CANCELING:
+            goto canceled;
+        case MIRISDR_ASYNC_FAILED:
+            goto failed;
+        }
+    } while (!mirisdr_async_cas(p, &status, MIRISDR_ASYNC_CANCELING));
+
+    mirisdr_async_wakeup(p);
 
     return 0;
 
@@ -258,27 +446,20 @@ canceled:
 int mirisdr_cancel_async_now (mirisdr_dev_t *p) {
     if (!p) goto failed;
 
-    switch (p->async_status) {
-    case MIRISDR_ASYNC_INACTIVE:
-        goto done;
-    case MIRISDR_ASYNC_CANCELING:
-        break;
-    case MIRISDR_ASYNC_RUNNING:
-    case MIRISDR_ASYNC_PAUSED:
-        p->async_status = MIRISDR_ASYNC_CANCELING;
-        break;
-    case MIRISDR_ASYNC_FAILED:
+    switch (mirisdr_cancel_async(p)) {
+    case -1:
         goto failed;
+    case -2:
+        if (mirisdr_async_get(p) == MIRISDR_ASYNC_INACTIVE) goto done;
+        break;
     }
 
-    /* cyklujeme dokud není vše ukončeno */
-    while ((p->async_status != MIRISDR_ASYNC_INACTIVE) &&
-           (p->async_status != MIRISDR_ASYNC_FAILED))
-#if defined (_WIN32) && !defined(__MINGW32__)
-    Sleep(20);
-#else
-    usleep(20000);
-#endif
+    /* čekáme dokud není vše ukončeno, nesmí běžet ve vlákně obsluhujícím události */
+    pthread_mutex_lock(&p->async_lock);
+    while ((mirisdr_async_get(p) != MIRISDR_ASYNC_INACTIVE) &&
+           (mirisdr_async_get(p) != MIRISDR_ASYNC_FAILED))
+        pthread_cond_wait(&p->async_done, &p->async_lock);
+    pthread_mutex_unlock(&p->async_lock);
 
 done:
     return 0;
@@ -287,21 +468,94 @@ failed:
     return -1;
 }
 
-/* allocation of asynchronous buffers */
+/* size of one transfer buffer */
+static size_t mirisdr_xfer_buf_size (mirisdr_dev_t *p) {
+    return (p->transfer == MIRISDR_TRANSFER_BULK) ? DEFAULT_BULK_BUFFER :
+           DEFAULT_ISO_BUFFER * DEFAULT_ISO_BUFFERS * DEFAULT_ISO_PACKETS;
+}
+
+/* largest unpacked transfer, 504_S16 (see samples_get in the process functions) */
+static size_t mirisdr_samples_max (mirisdr_dev_t *p) {
+    return (p->transfer == MIRISDR_TRANSFER_BULK) ? (DEFAULT_BULK_BUFFER / 1024) * 2016 :
+           1008 * DEFAULT_ISO_BUFFERS * DEFAULT_ISO_PACKETS * 2;
+}
+
+/* page aligned memory, backed by huge pages when the system has some reserved */
+static unsigned char *mirisdr_arena_alloc (size_t *len, int *huge) {
+    unsigned char *a;
+
+    *huge = 0;
+
+#if defined(_WIN32)
+    a = VirtualAlloc(NULL, *len, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+#ifdef MAP_HUGETLB
+    size_t huge_len = (*len + MIRISDR_HUGE_PAGE - 1) / MIRISDR_HUGE_PAGE * MIRISDR_HUGE_PAGE;
+
+    a = mmap(NULL, huge_len, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (a != MAP_FAILED) {
+        *len = huge_len;
+        *huge = 1;
+        return a;
+    }
+#endif
+#ifdef MAP_ANONYMOUS
+    a = mmap(NULL, *len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#else
+    a = mmap(NULL, *len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+#endif
+    if (a == MAP_FAILED) return NULL;
+#ifdef MADV_HUGEPAGE
+    /* transparent huge pages only cover whole 2 MB ranges */
+    if (*len >= MIRISDR_HUGE_PAGE) madvise(a, *len, MADV_HUGEPAGE);
+#endif
+#endif
+
+    return a;
+}
+
+static void mirisdr_arena_free (unsigned char *a, size_t len) {
+#if defined(_WIN32)
+    (void) len;
+    VirtualFree(a, 0, MEM_RELEASE);
+#else
+    munmap(a, len);
+#endif
+}
+
+/* allocation of asynchronous buffers, an existing pool is reused when the geometry matches */
 static int mirisdr_async_alloc (mirisdr_dev_t *p) {
-    size_t i;
+    size_t i, samples_len, off;
+
+    if ((p->xfer || p->xfer_buf || p->xfer_out) &&
+        ((p->pool_buf_num != p->xfer_buf_num) ||
+         (p->pool_transfer != (int) p->transfer) ||
+         (p->pool_out_len != p->xfer_out_len) ||
+         (p->pool_mlock != p->mlock))) {
+#if MIRISDR_DEBUG >= 1
+        fprintf(stderr, "transfer pool geometry changed, reallocating\n");
+#endif
+        mirisdr_async_free(p);
+    }
+
+    p->pool_buf_num = p->xfer_buf_num;
+    p->pool_transfer = (int) p->transfer;
+    p->pool_out_len = p->xfer_out_len;
+    p->pool_mlock = p->mlock;
 
     if (!p->xfer) {
-        p->xfer = malloc(p->xfer_buf_num * sizeof(*p->xfer));
+        p->xfer = calloc(p->xfer_buf_num, sizeof(*p->xfer));
+        if (!p->xfer) goto failed;
 
         for (i = 0; i < p->xfer_buf_num; i++) {
             switch (p->transfer) {
             case MIRISDR_TRANSFER_BULK:
-                p->xfer[i] = libusb_alloc_transfer(0);
+                if (!(p->xfer[i] = libusb_alloc_transfer(0))) goto failed;
                 p->xfer[i]->type = LIBUSB_TRANSFER_TYPE_BULK;
                 break;
             case MIRISDR_TRANSFER_ISOC:
-                p->xfer[i] = libusb_alloc_transfer(DEFAULT_ISO_PACKETS);
+                if (!(p->xfer[i] = libusb_alloc_transfer(DEFAULT_ISO_PACKETS))) goto failed;
                 p->xfer[i]->type = LIBUSB_TRANSFER_TYPE_ISOCHRONOUS;
                 break;
             }
@@ -309,34 +563,80 @@ static int mirisdr_async_alloc (mirisdr_dev_t *p) {
     }
 
     if (!p->xfer_buf) {
-        p->xfer_buf = malloc(p->xfer_buf_num * sizeof(*p->xfer_buf));
+        p->xfer_buf = calloc(p->xfer_buf_num, sizeof(*p->xfer_buf));
+        if (!p->xfer_buf) goto failed;
+
+        p->xfer_buf_len = mirisdr_xfer_buf_size(p);
+        samples_len = (mirisdr_samples_max(p) + MIRISDR_CACHE_LINE - 1) & ~(size_t) (MIRISDR_CACHE_LINE - 1);
 
+        /* usbfs zero copy, the kernel DMAs straight into these pages */
+        p->xfer_dev_mem = 0;
+#if defined(LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000105)
         for (i = 0; i < p->xfer_buf_num; i++) {
-            switch (p->transfer) {
-            case MIRISDR_TRANSFER_BULK:
-                p->xfer_buf[i] = malloc(DEFAULT_BULK_BUFFER);
-                break;
-            case MIRISDR_TRANSFER_ISOC:
-                p->xfer_buf[i] = malloc(DEFAULT_ISO_BUFFER * DEFAULT_ISO_BUFFERS * DEFAULT_ISO_PACKETS);
-                break;
+            if (!(p->xfer_buf[i] = libusb_dev_mem_alloc(p->dh, p->xfer_buf_len))) break;
+        }
+        if (i == p->xfer_buf_num) {
+            p->xfer_dev_mem = 1;
+        } else {
+            while (i-- > 0) {
+                libusb_dev_mem_free(p->dh, p->xfer_buf[i], p->xfer_buf_len);
+                p->xfer_buf[i] = NULL;
             }
         }
+#endif
+
+        /* jinak jeden souvislý blok, buffery i vzorky zarovnané na cache line */
+        p->xfer_arena_len = samples_len;
+        if (!p->xfer_dev_mem) p->xfer_arena_len += p->xfer_buf_num * p->xfer_buf_len;
+
+        if (!(p->xfer_arena = mirisdr_arena_alloc(&p->xfer_arena_len, &p->xfer_arena_huge))) {
+            fprintf(stderr, "failed to allocate %lu bytes of transfer buffers\n", (unsigned long) p->xfer_arena_len);
+            goto failed;
+        }
+
+        off = 0;
+        if (!p->xfer_dev_mem) {
+            for (i = 0; i < p->xfer_buf_num; i++) {
+                p->xfer_buf[i] = p->xfer_arena + off;
+                off += p->xfer_buf_len;
+            }
+        }
+
+        if ((p->samples) && (!p->samples_arena)) {
+            mirisdr_buffer_unlock(p, p->samples, p->samples_size);
+            free(p->samples);
+        }
+        p->samples = p->xfer_arena + off;
+        p->samples_size = (int) samples_len;
+        p->samples_arena = 1;
+
+        mirisdr_buffer_lock(p, p->xfer_arena, p->xfer_arena_len);
+
+#if MIRISDR_DEBUG >= 1
+        fprintf(stderr, "transfer buffers: %s, arena %lu bytes%s\n",
+                p->xfer_dev_mem ? "usbfs zero copy" : "arena",
+                (unsigned long) p->xfer_arena_len, p->xfer_arena_huge ? " in huge pages" : "");
+#endif
     }
 
     if ((!p->xfer_out) &&
         (p->xfer_out_len)) {
         p->xfer_out = malloc(p->xfer_out_len * sizeof(*p->xfer_out));
+        mirisdr_buffer_lock(p, p->xfer_out, p->xfer_out_len * sizeof(*p->xfer_out));
     }
 
     return 0;
+
+failed:
+    return -1;
 }
 
-/* releasing asynchronous buffers */
-static int mirisdr_async_free (mirisdr_dev_t *p) {
+/* releasing asynchronous buffers, on close or when the pool geometry changes */
+int mirisdr_async_free (mirisdr_dev_t *p) {
     size_t i;
 
     if (p->xfer) {
-        for (i = 0; i < p->xfer_buf_num; i++) {
+        for (i = 0; i < p->pool_buf_num; i++) {
             if (p->xfer[i]) libusb_free_transfer(p->xfer[i]);
         }
 
@@ -345,15 +645,34 @@ static int mirisdr_async_free (mirisdr_dev_t *p) {
     }
 
     if (p->xfer_buf) {
-        for (i = 0; i < p->xfer_buf_num; i++) {
-            if (p->xfer_buf[i]) free(p->xfer_buf[i]);
+#if defined(LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000105)
+        if (p->xfer_dev_mem) {
+            for (i = 0; i < p->pool_buf_num; i++) {
+                if (p->xfer_buf[i]) libusb_dev_mem_free(p->dh, p->xfer_buf[i], p->xfer_buf_len);
+            }
         }
+#endif
+        p->xfer_dev_mem = 0;
 
         free(p->xfer_buf);
         p->xfer_buf = NULL;
     }
 
+    if (p->xfer_arena) {
+        if (p->samples_arena) {
+            p->samples = NULL;
+            p->samples_size = 0;
+            p->samples_arena = 0;
+        }
+
+        mirisdr_buffer_unlock(p, p->xfer_arena, p->xfer_arena_len);
+        mirisdr_arena_free(p->xfer_arena, p->xfer_arena_len);
+        p->xfer_arena = NULL;
+        p->xfer_arena_len = 0;
+    }
+
     if (p->xfer_out) {
+        mirisdr_buffer_unlock(p, p->xfer_out, p->xfer_out_len * sizeof(*p->xfer_out));
         free(p->xfer_out);
         p->xfer_out = NULL;
     }
@@ -361,17 +680,10 @@ static int mirisdr_async_free (mirisdr_dev_t *p) {
     return 0;
 }
 
-/* spuštění async části */
-int mirisdr_read_async (mirisdr_dev_t *p, mirisdr_read_async_cb_t cb, void *ctx, uint32_t num, uint32_t len) {
+/* configure, allocate and submit the transfers, shared by read_async and the poll API */
+static int mirisdr_async_begin (mirisdr_dev_t *p, mirisdr_read_async_cb_t cb, void *ctx, uint32_t num, uint32_t len) {
     size_t i;
-    int r, semafor;
-    struct timeval tv = {1, 0};
-
-    if (!p) goto failed;
-    if (!p->dh) goto failed;
-
-    /* nedovolíme spustit jiný stav než neaktivní */
-    if (p->async_status != MIRISDR_ASYNC_INACTIVE) goto failed;
+    int r;
 
     p->cb = cb;
     p->cb_ctx = ctx;
@@ -380,6 +692,9 @@ int mirisdr_read_async (mirisdr_dev_t *p, mirisdr_read_async_cb_t cb, void *ctx,
     /* jde o fixní velikost výstupního bufferu */
     p->xfer_out_len = (len == 0) ? 0 : len;
     p->xfer_out_pos = 0;
+    p->sample_index = 0;
+    p->cb_index = 0;
+    mirisdr_frontend_reset(p);
 #if MIRISDR_DEBUG >= 1
     fprintf( stderr, "async read on device %u, buffers: %lu, output size: ",
                                 p->index, (long)p->xfer_buf_num);
@@ -390,6 +705,10 @@ int mirisdr_read_async (mirisdr_dev_t *p, mirisdr_read_async_cb_t cb, void *ctx,
     }
 #endif
     p->sync_loss_cnt = 0;
+
+    /* vlákna kanálů musí běžet dřív než první přenos */
+    if (mirisdr_channels_start(p, mirisdr_samples_max(p)) < 0) goto failed;
+
     /* použití správného rozhraní které zasílá data - není kritické */
     switch (p->transfer) {
     case MIRISDR_TRANSFER_BULK:
@@ -413,7 +732,7 @@ int mirisdr_read_async (mirisdr_dev_t *p, mirisdr_read_async_cb_t cb, void *ctx,
         goto failed;
     }
 
-    mirisdr_async_alloc(p);
+    if (mirisdr_async_alloc(p) < 0) goto failed;
 
     /* submit the transfers */
     for (i = 0; i < p->xfer_buf_num; i++) {
@@ -442,23 +761,99 @@ int mirisdr_read_async (mirisdr_dev_t *p, mirisdr_read_async_cb_t cb, void *ctx,
             break;
         default:
             fprintf( stderr, "unsupported transfer type\n");
-            goto failed_free;
+            goto failed;
         }
 
+        /* a pooled transfer still carries the status of the last cancel */
+        p->xfer[i]->status = LIBUSB_TRANSFER_COMPLETED;
         r = libusb_submit_transfer(p->xfer[i]);
 
 		if (r < 0) {
 			fprintf(stderr, "Failed to submit transfer %lu reason: %d\n", i, r);
-			goto failed_free;
+			goto failed;
 		}
     }
 
     /* spustíme streamování dat */
     mirisdr_streaming_start(p);
 
-    p->async_status = MIRISDR_ASYNC_RUNNING;
+    mirisdr_async_set(p, MIRISDR_ASYNC_RUNNING);
+
+    return 0;
+
+failed:
+    mirisdr_channels_stop(p);
+    mirisdr_async_free(p);
+    return -1;
+}
+
+/* cancellation of the transfers, 1 once all of them are back, -1 on failure */
+static int mirisdr_async_step (mirisdr_dev_t *p) {
+    size_t i;
+    int semafor, status;
+
+    /* dochází k ukončení */
+    status = mirisdr_async_get(p);
+    if (status == MIRISDR_ASYNC_CANCELING) {
+        if (!p->xfer) {
+            mirisdr_async_finish(p, MIRISDR_ASYNC_INACTIVE);
+            return 1;
+        }
+
+        /* ukončíme všechny přenosy */
+        semafor = 1;
+        for (i = 0; i < p->xfer_buf_num; i++) {
+            if (!p->xfer[i]) continue;
 
-    while (p->async_status != MIRISDR_ASYNC_INACTIVE) {
+            /* pro isoc režim je completed i v případě chyb */
+            if (p->xfer[i]->status != LIBUSB_TRANSFER_CANCELLED) {
+                libusb_cancel_transfer(p->xfer[i]);
+                semafor = 0;
+            }
+        }
+
+        /* všechny přenosy se vrátily (status nastavuje až callback), skončíme */
+        if (semafor) {
+            mirisdr_async_finish(p, MIRISDR_ASYNC_INACTIVE);
+            return 1;
+        }
+    } else if (status == MIRISDR_ASYNC_FAILED) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/* all transfers are back, stop the device */
+static void mirisdr_async_end (mirisdr_dev_t *p) {
+    /* buffery zůstávají pro další čtení, uvolní je až mirisdr_close */
+
+    /* ukončíme streamování dat, žádný přenos už neběží */
+    mirisdr_streaming_stop(p);
+
+    /* kanály dopočítají frontu */
+    mirisdr_channels_stop(p);
+    /* je vhodné ukončit i adc, jenže pak by při dalším otevření bylo nutné provést inicializaci */
+}
+
+/* spuštění async části */
+int mirisdr_read_async (mirisdr_dev_t *p, mirisdr_read_async_cb_t cb, void *ctx, uint32_t num, uint32_t len) {
+    int r;
+    struct timeval tv = {1, 0};
+    void *saved = NULL;
+
+    if (!p) goto failed;
+    if (!p->dh) goto failed;
+
+    /* nedovolíme spustit jiný stav než neaktivní */
+    if (mirisdr_async_get(p) != MIRISDR_ASYNC_INACTIVE) goto failed;
+
+    /* priorita a afinita vlákna obsluhujícího události */
+    saved = mirisdr_thread_enter(p);
+
+    if (mirisdr_async_begin(p, cb, ctx, num, len) < 0) goto failed;
+
+    while (mirisdr_async_get(p) != MIRISDR_ASYNC_INACTIVE) {
         /* počkáme na další událost */
         if ((r = libusb_handle_events_timeout(p->ctx, &tv)) < 0) {
             fprintf( stderr, "libusb_handle_events returned: %d\n", r);
@@ -466,53 +861,140 @@ int mirisdr_read_async (mirisdr_dev_t *p, mirisdr_read_async_cb_t cb, void *ctx,
             goto failed_free;
         }
 
-        /* dochází k ukončení */
-        if (p->async_status == MIRISDR_ASYNC_CANCELING) {
-            if (!p->xfer) {
-                p->async_status = MIRISDR_ASYNC_INACTIVE;
-                break;
-            }
+        if ((r = mirisdr_async_step(p)) < 0) goto failed_free;
+        if (r > 0) break;
+    }
 
-            /* ukončíme všechny přenosy */
-            semafor = 1;
-            for (i = 0; i < p->xfer_buf_num; i++) {
-                if (!p->xfer[i]) continue;
+    mirisdr_async_end(p);
 
-                /* pro isoc režim je completed i v případě chyb */
-                if (p->xfer[i]->status != LIBUSB_TRANSFER_CANCELLED) {
-                    libusb_cancel_transfer(p->xfer[i]);
-                    semafor = 0;
-                }
-            }
+    mirisdr_thread_leave(saved);
 
-            /* nedošlo k žádnému vynuceném ukončení přenosu, skončíme */
-            if (semafor) {
-                p->async_status = MIRISDR_ASYNC_INACTIVE;
-                /* počkáme na dokončení všech procesů */
-                libusb_handle_events_timeout(p->ctx, &tv);
-                break;
-            }
-        } else if (p->async_status == MIRISDR_ASYNC_FAILED) {
-            goto failed_free;
+    return 0;
+
+failed_free:
+    mirisdr_channels_stop(p);
+    mirisdr_async_free(p);
+    mirisdr_async_finish(p, MIRISDR_ASYNC_FAILED);
+
+failed:
+    mirisdr_thread_leave(saved);
+    return -1;
+}
+
+/*
+ * Non-blocking streaming for an external event loop
+ *
+ * mirisdr_poll_start() submits the transfers and returns, the application
+ * watches the descriptors from mirisdr_poll_get_fds() (one libusb context per
+ * device) and calls mirisdr_poll_process() whenever one of them is ready or the
+ * mirisdr_poll_timeout() expires.  The callback runs from mirisdr_poll_process()
+ * exactly as from mirisdr_read_async().  mirisdr_poll_stop() or
+ * mirisdr_cancel_async() only start the cancellation, the stream is finished
+ * when mirisdr_poll_process() returns 1.  The scheduling settings are not
+ * applied, the loop thread belongs to the application.  mirisdr_cancel_async_now()
+ * waits for the loop, it must only be called from another thread.
+ */
+int mirisdr_poll_start (mirisdr_dev_t *p, mirisdr_read_async_cb_t cb, void *ctx, uint32_t num, uint32_t len) {
+    if (!p) goto failed;
+    if (!p->dh) goto failed;
+
+    if (mirisdr_async_get(p) != MIRISDR_ASYNC_INACTIVE) goto failed;
+
+    return mirisdr_async_begin(p, cb, ctx, num, len);
+
+failed:
+    return -1;
+}
+
+int mirisdr_poll_get_fds (mirisdr_dev_t *p, mirisdr_pollfd_t *fds, int max) {
+    const struct libusb_pollfd **list;
+    int n;
+
+    if (!p) goto failed;
+    if (!p->ctx) goto failed;
+
+    /* not available on Windows */
+    if (!(list = libusb_get_pollfds(p->ctx))) goto failed;
+
+    for (n = 0; list[n]; n++) {
+        if (n < max) {
+            fds[n].fd = list[n]->fd;
+            fds[n].events = list[n]->events;
         }
     }
 
-    /* dealokujeme buffer */
-    mirisdr_async_free(p);
+    libusb_free_pollfds(list);
 
-    /* ukončíme streamování dat */
-#if defined (_WIN32) && !defined(__MINGW32__)
-    Sleep(20);
-#else
-    usleep(20000);
-#endif
-    mirisdr_streaming_stop(p);
-    /* je vhodné ukončit i adc, jenže pak by při dalším otevření bylo nutné provést inicializaci */
+    /* stejně jako snprintf vracíme celkový počet */
+    return n;
+
+failed:
+    return -1;
+}
+
+/* milliseconds for poll(), -1 is no timeout pending as for poll(), -2 an error */
+int mirisdr_poll_timeout (mirisdr_dev_t *p) {
+    struct timeval tv;
+    int r;
+
+    if (!p) return -2;
+    if (!p->ctx) return -2;
+
+    /* timeouts go through a timerfd among the descriptors */
+    if (libusb_pollfds_handle_timeouts(p->ctx)) return -1;
+    if ((r = libusb_get_next_timeout(p->ctx, &tv)) < 0) return -2;
+    if (r == 0) return -1;
+
+    return (int) (tv.tv_sec * 1000 + (tv.tv_usec + 999) / 1000);
+}
+
+int mirisdr_poll_process (mirisdr_dev_t *p) {
+    int r;
+    struct timeval tv = {0, 0};
+
+    if (!p) goto failed;
+
+    switch (mirisdr_async_get(p)) {
+    case MIRISDR_ASYNC_INACTIVE:
+        return 1;
+    case MIRISDR_ASYNC_FAILED:
+        goto failed;
+    default:
+        break;
+    }
+
+    if (((r = libusb_handle_events_timeout(p->ctx, &tv)) < 0) &&
+        (r != LIBUSB_ERROR_INTERRUPTED)) {
+        fprintf( stderr, "libusb_handle_events returned: %d\n", r);
+        goto failed_free;
+    }
+
+    if ((r = mirisdr_async_step(p)) < 0) goto failed_free;
+    if (r > 0) {
+        mirisdr_async_end(p);
+        return 1;
+    }
 
     return 0;
 
 failed_free:
+    mirisdr_channels_stop(p);
     mirisdr_async_free(p);
+    mirisdr_async_finish(p, MIRISDR_ASYNC_FAILED);
+
+failed:
+    return -1;
+}
+
+int mirisdr_poll_stop (mirisdr_dev_t *p) {
+    if (!p) goto failed;
+
+    if (mirisdr_cancel_async(p) == -1) goto failed;
+
+    /* first round of cancels right away, the rest from mirisdr_poll_process */
+    if (mirisdr_async_step(p) > 0) mirisdr_async_end(p);
+
+    return 0;
 
 failed:
     return -1;
@@ -522,8 +1004,10 @@ failed:
 int mirisdr_start_async (mirisdr_dev_t *p) {
     size_t i;
 
+    int status = MIRISDR_ASYNC_PAUSED;
+
     /* nedovolíme jiný stav než pozastavený */
-    if (p->async_status != MIRISDR_ASYNC_PAUSED) goto failed;
+    if (mirisdr_async_get(p) != MIRISDR_ASYNC_PAUSED) goto failed;
 
     /* reset interního bufferu */
     p->xfer_out_pos = 0;
@@ -531,16 +1015,18 @@ int mirisdr_start_async (mirisdr_dev_t *p) {
     for (i = 0; i < p->xfer_buf_num; i++) {
         if (!p->xfer[i]) continue;
 
+        p->xfer[i]->status = LIBUSB_TRANSFER_COMPLETED;
         if (libusb_submit_transfer(p->xfer[i])< 0) {
             goto failed;
         }
     }
 
-    if (p->async_status != MIRISDR_ASYNC_PAUSED) goto failed;
+    if (mirisdr_async_get(p) != MIRISDR_ASYNC_PAUSED) goto failed;
 
     mirisdr_streaming_start(p);
 
-    p->async_status = MIRISDR_ASYNC_RUNNING;
+    /* a cancel in the meantime wins */
+    if (!mirisdr_async_cas(p, &status, MIRISDR_ASYNC_RUNNING)) goto failed;
 
     return 0;
 
@@ -551,13 +1037,13 @@ failed:
 /* zastavení streamování */
 int mirisdr_stop_async (mirisdr_dev_t *p) {
     size_t i;
-    int r, semafor;
+    int r, semafor, status = MIRISDR_ASYNC_RUNNING;
     struct timeval tv = {1, 0};
 
     /* nedovolíme jiný stav než spuštěný */
-    if (p->async_status != MIRISDR_ASYNC_RUNNING) goto failed;
+    if (mirisdr_async_get(p) != MIRISDR_ASYNC_RUNNING) goto failed;
 
-    while (p->async_status == MIRISDR_ASYNC_RUNNING) {
+    while (mirisdr_async_get(p) == MIRISDR_ASYNC_RUNNING) {
         semafor = 1;
         for (i = 0; i < p->xfer_buf_num; i++) {
             if (!p->xfer[i]) continue;
@@ -579,16 +1065,11 @@ int mirisdr_stop_async (mirisdr_dev_t *p) {
         }
     }
 
-    if (p->async_status != MIRISDR_ASYNC_RUNNING) goto failed;
+    if (mirisdr_async_get(p) != MIRISDR_ASYNC_RUNNING) goto failed;
 
-#if defined (_WIN32) && !defined(__MINGW32__)
-    Sleep(20);
-#else
-    usleep(20000);
-#endif
     mirisdr_streaming_stop(p);
 
-    p->async_status = MIRISDR_ASYNC_PAUSED;
+    if (!mirisdr_async_cas(p, &status, MIRISDR_ASYNC_PAUSED)) goto failed;
 
     return 0;
 
@@ -0,0 +1,648 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Digital down converter channels
+ *
+ * A channel mixes its offset down to DC with a complex oscillator and
+ * decimates in stages: half-band filters by two while at least a factor of
+ * two is left for the last stage, then a windowed sinc FIR given by the
+ * channel bandwidth.  Each stage computes only the samples it keeps.  I and Q
+ * are kept in separate float arrays and the inner loops run over fixed lanes,
+ * so the compiler vectorizes them.
+ *
+ * Channels work on their own (mirisdr_channel_process) or attached to a
+ * device.  Then the async path copies every unpacked transfer into a ring of
+ * blocks and a pool of worker threads runs the consumers (channels and
+ * channelizers), each worker its own share of them, in the order of the
+ * blocks.  The USB thread never waits, a
+ * block which doesn't fit into the ring is dropped and counted.
+ */
+
+#include <math.h>
+
+#include "mirisdr_private.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define CHANNEL_BLOCK           4096    /* complex samples processed at once */
+#define CHANNEL_LANES           8
+#define CHANNEL_HALFBAND_K      5       /* 4 * K + 3 taps */
+#define CHANNEL_MAX_TAPS        511
+#define CHANNEL_MAX_STAGES      16
+#define CHANNEL_QUEUE           16
+#define CHANNEL_MAX_THREADS     64
+
+struct mirisdr_channel_stage {
+    int                 decim;
+    int                 halfband;
+    int                 ntaps;          /* FIR: padded to the lanes */
+    int                 span;           /* samples under the filter */
+    float               *taps;          /* half-band: the odd taps from the center */
+    float               center;
+    float               *i, *q;         /* span - 1 samples of history, then the input */
+    int                 start;          /* first sample of the next output */
+};
+
+struct mirisdr_channel {
+    struct mirisdr_consumer consumer;   /* první, ukazatele jsou zaměnitelné */
+    uint32_t            in_rate;
+    uint32_t            rate;
+    mirisdr_channel_cb_t cb;
+    void                *cb_ctx;
+
+    /* oscilátor */
+    double              phase;
+    double              step;
+    float               rot_i[CHANNEL_LANES], rot_q[CHANNEL_LANES];
+
+    int                 stages;
+    struct mirisdr_channel_stage stage[CHANNEL_MAX_STAGES];
+    float               *out_i, *out_q;
+    float               *out;           /* interleaved I/Q for the callback */
+};
+
+/********************************** filters ***********************************/
+
+static double channel_blackman (int n, int len) {
+    double x = 2.0 * M_PI * n / (len - 1);
+
+    return 0.42 - 0.5 * cos(x) + 0.08 * cos(2.0 * x);
+}
+
+static double channel_sinc (double x) {
+    return (x == 0.0) ? 1.0 : sin(M_PI * x) / (M_PI * x);
+}
+
+static int channel_stage_alloc (struct mirisdr_channel_stage *s) {
+    size_t len = (size_t) (s->span - 1 + CHANNEL_BLOCK);
+
+    s->i = calloc(len, sizeof(float));
+    s->q = calloc(len, sizeof(float));
+    if ((!s->i) || (!s->q)) return -1;
+
+    s->start = 0;
+    return 0;
+}
+
+/* decimation by two, every other tap is zero apart from the center */
+static int channel_halfband_init (struct mirisdr_channel_stage *s) {
+    int len = 4 * CHANNEL_HALFBAND_K + 3, c = (len - 1) / 2, k;
+    double sum;
+
+    s->decim = 2;
+    s->halfband = 1;
+    s->span = len;
+    s->ntaps = CHANNEL_HALFBAND_K + 1;
+    if (!(s->taps = calloc((size_t) s->ntaps, sizeof(float)))) return -1;
+
+    sum = 0.5;
+    for (k = 0; k < s->ntaps; k++) {
+        s->taps[k] = (float) (0.5 * channel_sinc((2 * k + 1) / 2.0) * channel_blackman(c + 2 * k + 1, len));
+        sum += 2.0 * s->taps[k];
+    }
+
+    /* jednotkový zisk pro DC */
+    s->center = (float) (0.5 / sum);
+    for (k = 0; k < s->ntaps; k++) s->taps[k] = (float) (s->taps[k] / sum);
+
+    return channel_stage_alloc(s);
+}
+
+/* windowed sinc with the cutoff fc as a fraction of the input rate */
+static int channel_fir_init (struct mirisdr_channel_stage *s, int decim, double fc, int len) {
+    int n;
+    double sum = 0.0;
+
+    s->decim = decim;
+    s->halfband = 0;
+    s->span = len;
+    s->ntaps = (len + CHANNEL_LANES - 1) / CHANNEL_LANES * CHANNEL_LANES;
+    if (!(s->taps = calloc((size_t) s->ntaps, sizeof(float)))) return -1;
+
+    for (n = 0; n < len; n++) {
+        s->taps[n] = (float) (2.0 * fc * channel_sinc(2.0 * fc * (n - (len - 1) / 2.0)) * channel_blackman(n, len));
+        sum += s->taps[n];
+    }
+    for (n = 0; n < len; n++) s->taps[n] = (float) (s->taps[n] / sum);
+
+    /* nulové koeficienty na konci čtou až za data, historie má rezervu */
+    s->span = s->ntaps;
+
+    return channel_stage_alloc(s);
+}
+
+static inline float channel_dot (const float *a, const float *b, int n) {
+    float acc[CHANNEL_LANES] = {0};
+    float r = 0.0f;
+    int j, l;
+
+    for (j = 0; j < n; j += CHANNEL_LANES)
+        for (l = 0; l < CHANNEL_LANES; l++)
+            acc[l] += a[j + l] * b[j + l];
+
+    for (l = 0; l < CHANNEL_LANES; l++) r += acc[l];
+
+    return r;
+}
+
+/* n new samples are in s->i/q after the history, returns the number of outputs */
+static int channel_stage_run (struct mirisdr_channel_stage *s, int n, float *out_i, float *out_q) {
+    int total = s->span - 1 + n, pos, m = 0, k, c;
+    float *x, *y;
+
+    if (s->halfband) {
+        c = (s->span - 1) / 2;
+        for (pos = s->start; pos + s->span <= total; pos += 2, m++) {
+            x = s->i + pos + c;
+            y = s->q + pos + c;
+            out_i[m] = s->center * x[0];
+            out_q[m] = s->center * y[0];
+            for (k = 0; k < s->ntaps; k++) {
+                out_i[m] += s->taps[k] * (x[-1 - 2 * k] + x[1 + 2 * k]);
+                out_q[m] += s->taps[k] * (y[-1 - 2 * k] + y[1 + 2 * k]);
+            }
+        }
+    } else {
+        for (pos = s->start; pos + s->span <= total; pos += s->decim, m++) {
+            out_i[m] = channel_dot(s->taps, s->i + pos, s->ntaps);
+            out_q[m] = channel_dot(s->taps, s->q + pos, s->ntaps);
+        }
+    }
+
+    /* historie pro další blok */
+    s->start = pos - n;
+    memmove(s->i, s->i + n, (size_t) (s->span - 1) * sizeof(float));
+    memmove(s->q, s->q + n, (size_t) (s->span - 1) * sizeof(float));
+
+    return m;
+}
+
+/* complex oscillator, the phase is kept in double and restarted for every block */
+static void channel_mix (mirisdr_channel_t *c, const int16_t *iq, int n, float *out_i, float *out_q) {
+    float ph_i = (float) cos(c->phase), ph_q = (float) sin(c->phase);
+    float step_i = (float) cos(c->step * CHANNEL_LANES), step_q = (float) sin(c->step * CHANNEL_LANES);
+    float re, im, t;
+    int i, l;
+
+    for (i = 0; i + CHANNEL_LANES <= n; i += CHANNEL_LANES) {
+        for (l = 0; l < CHANNEL_LANES; l++) {
+            float xi = iq[2 * (i + l)] * (1.0f / 32768.0f);
+            float xq = iq[2 * (i + l) + 1] * (1.0f / 32768.0f);
+
+            re = ph_i * c->rot_i[l] - ph_q * c->rot_q[l];
+            im = ph_i * c->rot_q[l] + ph_q * c->rot_i[l];
+            out_i[i + l] = xi * re - xq * im;
+            out_q[i + l] = xi * im + xq * re;
+        }
+
+        t = ph_i * step_i - ph_q * step_q;
+        ph_q = ph_i * step_q + ph_q * step_i;
+        ph_i = t;
+    }
+
+    for (l = 0; i < n; i++, l++) {
+        float xi = iq[2 * i] * (1.0f / 32768.0f);
+        float xq = iq[2 * i + 1] * (1.0f / 32768.0f);
+
+        re = ph_i * c->rot_i[l] - ph_q * c->rot_q[l];
+        im = ph_i * c->rot_q[l] + ph_q * c->rot_i[l];
+        out_i[i] = xi * re - xq * im;
+        out_q[i] = xi * im + xq * re;
+    }
+
+    c->phase = fmod(c->phase + c->step * n, 2.0 * M_PI);
+}
+
+/* one block of at most CHANNEL_BLOCK samples through all the stages */
+static void channel_block (mirisdr_channel_t *c, const int16_t *iq, int n) {
+    struct mirisdr_channel_stage *s;
+    float *out_i = c->out_i, *out_q = c->out_q;
+    int k, i;
+
+    if (c->stages > 0) {
+        out_i = c->stage[0].i + c->stage[0].span - 1;
+        out_q = c->stage[0].q + c->stage[0].span - 1;
+    }
+    channel_mix(c, iq, n, out_i, out_q);
+
+    for (k = 0; k < c->stages; k++) {
+        s = &c->stage[k];
+        if (k + 1 < c->stages) {
+            out_i = c->stage[k + 1].i + c->stage[k + 1].span - 1;
+            out_q = c->stage[k + 1].q + c->stage[k + 1].span - 1;
+        } else {
+            out_i = c->out_i;
+            out_q = c->out_q;
+        }
+        n = channel_stage_run(s, n, out_i, out_q);
+    }
+
+    if (n <= 0) return;
+
+    for (i = 0; i < n; i++) {
+        c->out[2 * i] = c->out_i[i];
+        c->out[2 * i + 1] = c->out_q[i];
+    }
+
+    c->cb(c->out, (uint32_t) n, c->cb_ctx);
+}
+
+/*********************************** channel **********************************/
+
+static int channel_consumer_process (struct mirisdr_consumer *c, const int16_t *iq, uint32_t len) {
+    return mirisdr_channel_process((mirisdr_channel_t *) c, iq, len);
+}
+
+int mirisdr_channel_create (mirisdr_channel_t **c, uint32_t in_rate, int32_t offset, uint32_t bandwidth,
+                            uint32_t rate, mirisdr_channel_cb_t cb, void *ctx) {
+    mirisdr_channel_t *n = NULL;
+    int decim, k, len;
+    double fs, transition;
+
+    if (!c) goto failed;
+    if ((!cb) || (!in_rate) || (!rate) || (rate > in_rate)) goto failed;
+
+    decim = (int) (in_rate / rate);
+    rate = in_rate / (uint32_t) decim;
+
+    /* šířka pásma bez aliasů je nejvýše výstupní vzorkovací frekvence */
+    if ((!bandwidth) || (bandwidth > rate * 9 / 10)) bandwidth = rate * 8 / 10;
+
+    if ((uint32_t) abs(offset) + bandwidth / 2 > in_rate / 2) {
+        fprintf(stderr, "channel at %d Hz doesn't fit into %u Hz\n", offset, in_rate);
+        goto failed;
+    }
+
+    if (!(n = calloc(1, sizeof(*n)))) goto failed;
+
+    n->consumer.process = channel_consumer_process;
+    n->in_rate = in_rate;
+    n->rate = rate;
+    n->cb = cb;
+    n->cb_ctx = ctx;
+
+    /* posun kanálu na DC */
+    n->step = -2.0 * M_PI * offset / in_rate;
+    for (k = 0; k < CHANNEL_LANES; k++) {
+        n->rot_i[k] = (float) cos(n->step * k);
+        n->rot_q[k] = (float) sin(n->step * k);
+    }
+
+    fs = in_rate;
+    while ((decim % 2 == 0) && (decim >= 4) && (n->stages < CHANNEL_MAX_STAGES - 1)) {
+        if (channel_halfband_init(&n->stage[n->stages++]) < 0) goto failed;
+        decim /= 2;
+        fs /= 2;
+    }
+
+    /* poslední stupeň podle šířky pásma, přechod mezi pásmem a prvním aliasem */
+    if (decim > 1) {
+        transition = (double) rate - bandwidth;
+        len = (int) ceil(5.5 * fs / transition) | 1;
+        if (len > CHANNEL_MAX_TAPS) len = CHANNEL_MAX_TAPS;
+        if (channel_fir_init(&n->stage[n->stages++], decim, 0.5 / decim, len) < 0) goto failed;
+    }
+
+    n->out_i = malloc(CHANNEL_BLOCK * sizeof(float));
+    n->out_q = malloc(CHANNEL_BLOCK * sizeof(float));
+    n->out = malloc(2 * CHANNEL_BLOCK * sizeof(float));
+    if ((!n->out_i) || (!n->out_q) || (!n->out)) goto failed;
+
+    *c = n;
+    return 0;
+
+failed:
+    if (n) mirisdr_channel_destroy(n);
+    return -1;
+}
+
+uint32_t mirisdr_channel_get_rate (mirisdr_channel_t *c) {
+    if (!c) return 0;
+
+    return c->rate;
+}
+
+/* interleaved 16 bit I/Q at the input rate, the callback runs from here */
+int mirisdr_channel_process (mirisdr_channel_t *c, const int16_t *iq, uint32_t len) {
+    uint32_t n;
+
+    if ((!c) || (!iq)) goto failed;
+
+    while (len > 0) {
+        n = (len > CHANNEL_BLOCK) ? CHANNEL_BLOCK : len;
+        channel_block(c, iq, (int) n);
+        iq += 2 * n;
+        len -= n;
+    }
+
+    return 0;
+
+failed:
+    return -1;
+}
+
+int mirisdr_channel_destroy (mirisdr_channel_t *c) {
+    int k;
+
+    if (!c) goto failed;
+
+    /* připojený kanál nejdřív odpojíme */
+    if ((c->consumer.dev) && (mirisdr_consumer_remove(c->consumer.dev, &c->consumer) < 0)) goto failed;
+
+    for (k = 0; k < CHANNEL_MAX_STAGES; k++) {
+        free(c->stage[k].taps);
+        free(c->stage[k].i);
+        free(c->stage[k].q);
+    }
+    free(c->out_i);
+    free(c->out_q);
+    free(c->out);
+    free(c);
+
+    return 0;
+
+failed:
+    return -1;
+}
+
+/********************************** device ************************************/
+
+int mirisdr_consumer_add (mirisdr_dev_t *p, struct mirisdr_consumer *c) {
+    struct mirisdr_consumer **l;
+
+    if ((!p) || (!c) || (c->dev)) goto failed;
+    if (mirisdr_async_get(p) != MIRISDR_ASYNC_INACTIVE) goto failed;
+
+    /* na konec, pořadí určuje rozdělení mezi vlákna */
+    for (l = &p->consumers; *l; l = &(*l)->next);
+    *l = c;
+    c->next = NULL;
+    c->dev = p;
+
+    return 0;
+
+failed:
+    return -1;
+}
+
+int mirisdr_consumer_remove (mirisdr_dev_t *p, struct mirisdr_consumer *c) {
+    struct mirisdr_consumer **l;
+
+    if ((!p) || (!c) || (c->dev != p)) goto failed;
+    if (mirisdr_async_get(p) != MIRISDR_ASYNC_INACTIVE) goto failed;
+
+    for (l = &p->consumers; *l; l = &(*l)->next) {
+        if (*l == c) {
+            *l = c->next;
+            c->next = NULL;
+            c->dev = NULL;
+            return 0;
+        }
+    }
+
+failed:
+    return -1;
+}
+
+int mirisdr_add_channel (mirisdr_dev_t *p, mirisdr_channel_t *c) {
+    return c ? mirisdr_consumer_add(p, &c->consumer) : -1;
+}
+
+int mirisdr_remove_channel (mirisdr_dev_t *p, mirisdr_channel_t *c) {
+    return c ? mirisdr_consumer_remove(p, &c->consumer) : -1;
+}
+
+int mirisdr_set_channel_threads (mirisdr_dev_t *p, int threads) {
+    if (!p) goto failed;
+    if ((threads < 0) || (threads > CHANNEL_MAX_THREADS)) goto failed;
+    if (mirisdr_async_get(p) != MIRISDR_ASYNC_INACTIVE) goto failed;
+
+    p->channel_threads = threads;
+
+    return 0;
+
+failed:
+    return -1;
+}
+
+/******************************** worker pool *********************************/
+
+struct mirisdr_channel_block {
+    int16_t             *iq;
+    uint32_t            len;            /* complex samples */
+};
+
+struct mirisdr_channel_worker {
+    pthread_t           thread;
+    struct mirisdr_channel_pool *pool;
+    int                 id;
+    int                 cpu;            /* of the cpu list, -1 for any */
+    uint64_t            seq;            /* next block to process */
+};
+
+struct mirisdr_channel_pool {
+    mirisdr_dev_t       *dev;
+    pthread_mutex_t     lock;
+    pthread_cond_t      ready;
+    int                 threads;
+    struct mirisdr_channel_worker *workers;
+    struct mirisdr_channel_block blocks[CHANNEL_QUEUE];
+    uint64_t            head;           /* blocks produced */
+    uint64_t            dropped;
+    int                 exit_flag;
+};
+
+static void *mirisdr_channel_worker_thread (void *arg) {
+    struct mirisdr_channel_worker *w = arg;
+    struct mirisdr_channel_pool *pool = w->pool;
+    struct mirisdr_channel_block *b;
+    struct mirisdr_consumer *c;
+
+    mirisdr_thread_worker(w->cpu);
+
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        while ((w->seq == pool->head) && (!pool->exit_flag))
+            pthread_cond_wait(&pool->ready, &pool->lock);
+        if (w->seq == pool->head) break;
+
+        b = &pool->blocks[w->seq % CHANNEL_QUEUE];
+        pthread_mutex_unlock(&pool->lock);
+
+        for (c = pool->dev->consumers; c; c = c->next) {
+            if (c->worker == w->id) c->process(c, b->iq, b->len);
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        w->seq++;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+static int mirisdr_channel_cpus (void) {
+#if defined(_SC_NPROCESSORS_ONLN)
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return (n > 0) ? (int) n : 1;
+#else
+    return 1;
+#endif
+}
+
+/* start the workers, block_bytes is the largest unpacked transfer */
+int mirisdr_channels_start (mirisdr_dev_t *p, size_t block_bytes) {
+    struct mirisdr_channel_pool *pool;
+    struct mirisdr_consumer *c;
+    pthread_attr_t attr;
+    struct sched_param param;
+    int i, r, count = 0;
+
+    if (!p->consumers) return 0;
+
+    if (!(pool = calloc(1, sizeof(*pool)))) goto failed;
+    p->channel_pool = pool;
+    pool->dev = p;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->ready, NULL);
+
+    for (c = p->consumers; c; c = c->next) count++;
+    pool->threads = p->channel_threads ? p->channel_threads : mirisdr_channel_cpus();
+    if (pool->threads > count) pool->threads = count;
+
+    for (i = 0, c = p->consumers; c; c = c->next, i++) c->worker = i % pool->threads;
+
+    /* 8 bitové vzorky se rozšíří, blok pojme vždy 16 bitovou velikost */
+    for (i = 0; i < CHANNEL_QUEUE; i++) {
+        if (!(pool->blocks[i].iq = malloc(block_bytes))) goto failed;
+    }
+
+    if (!(pool->workers = calloc((size_t) pool->threads, sizeof(*pool->workers)))) goto failed;
+
+    /* created from the USB thread, which may run realtime: the workers would
+     * inherit that and starve the event loop on a shared cpu, they get the
+     * default policy and one cpu of the list each instead */
+    pthread_attr_init(&attr);
+    memset(&param, 0, sizeof(param));
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+    pthread_attr_setschedparam(&attr, &param);
+
+    for (i = 0; i < pool->threads; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].id = i;
+        pool->workers[i].cpu = (p->cpu_count > 0) ? p->cpus[i % p->cpu_count] : -1;
+        if ((r = pthread_create(&pool->workers[i].thread, &attr, mirisdr_channel_worker_thread, &pool->workers[i])) != 0) {
+            fprintf(stderr, "failed to create a channel worker: %s\n", strerror(r));
+            pool->threads = i;
+            pthread_attr_destroy(&attr);
+            goto failed;
+        }
+    }
+    pthread_attr_destroy(&attr);
+
+    return 0;
+
+failed:
+    fprintf(stderr, "failed to start the channel workers\n");
+    mirisdr_channels_stop(p);
+    return -1;
+}
+
+/* the workers finish the queued blocks and exit */
+void mirisdr_channels_stop (mirisdr_dev_t *p) {
+    struct mirisdr_channel_pool *pool = p->channel_pool;
+    int i;
+
+    if (!pool) return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->exit_flag = 1;
+    pthread_cond_broadcast(&pool->ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    if (pool->workers) {
+        for (i = 0; i < pool->threads; i++) pthread_join(pool->workers[i].thread, NULL);
+        free(pool->workers);
+    }
+
+    if (pool->dropped) fprintf(stderr, "channels: %llu blocks dropped\n", (unsigned long long) pool->dropped);
+
+    for (i = 0; i < CHANNEL_QUEUE; i++) free(pool->blocks[i].iq);
+    pthread_cond_destroy(&pool->ready);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+    p->channel_pool = NULL;
+}
+
+/* from the USB thread, never blocks on the workers */
+void mirisdr_channels_feed (mirisdr_dev_t *p, const uint8_t *samples, uint32_t bytes, int s8) {
+    struct mirisdr_channel_pool *pool = p->channel_pool;
+    struct mirisdr_channel_block *b;
+    uint64_t tail;
+    uint32_t i;
+    int k;
+
+    if (!pool) return;
+
+    /* nejpomalejší vlákno určuje volné místo */
+    pthread_mutex_lock(&pool->lock);
+    tail = pool->head;
+    for (k = 0; k < pool->threads; k++) {
+        if (pool->workers[k].seq < tail) tail = pool->workers[k].seq;
+    }
+    if (pool->head - tail >= CHANNEL_QUEUE) {
+        pool->dropped++;
+        pthread_mutex_unlock(&pool->lock);
+        return;
+    }
+    b = &pool->blocks[pool->head % CHANNEL_QUEUE];
+    pthread_mutex_unlock(&pool->lock);
+
+    /* do bloku nikdo nečte, všechna vlákna jsou za ním */
+    if (s8) {
+        for (i = 0; i < bytes; i++) b->iq[i] = (int16_t) (((int8_t) samples[i]) * 256);
+        b->len = bytes / 2;
+    } else {
+        memcpy(b->iq, samples, bytes);
+        b->len = bytes / 4;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->head++;
+    pthread_cond_broadcast(&pool->ready);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/* the device goes away, the channels stay with the application */
+void mirisdr_channels_detach (mirisdr_dev_t *p) {
+    struct mirisdr_consumer *c;
+
+    mirisdr_channels_stop(p);
+
+    while ((c = p->consumers)) {
+        p->consumers = c->next;
+        c->next = NULL;
+        c->dev = NULL;
+    }
+}
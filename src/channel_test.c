@@ -0,0 +1,197 @@
+/*
+ * MiriSDR
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * test of the channel worker pool without a device: blocks go through
+ * mirisdr_channels_feed the way the async path hands them over, from a
+ * thread set up like the streaming thread, and every channel has to give
+ * exactly what the same channel gives run directly.  The workers must not
+ * have inherited the realtime policy and must sit on the cpu of the list.
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include "mirisdr_private.h"
+
+#include <sched.h>
+
+#define TEST_RATE               2000000
+#define TEST_OUT_RATE           25000
+#define TEST_BLOCK              16128   /* one bulk transfer of 504_S16 */
+#define TEST_BLOCKS             64
+#define TEST_CHANNELS           6
+#define TEST_THREADS            3
+#define TEST_AHEAD              8       /* blocks in the queue, it holds 16 */
+
+struct test_channel
+{
+    mirisdr_channel_t *c;
+    float       *out;
+    uint32_t    len;            /* floats so far */
+    uint32_t    size;
+    int         policy;         /* of the thread of the first callback */
+    int         cpus;           /* how many it may run on */
+    int         on_cpu;         /* the one of the list among them */
+};
+
+static int16_t *input;
+static struct test_channel pooled[TEST_CHANNELS], direct[TEST_CHANNELS];
+
+static void test_cb(const float *iq, uint32_t len, void *ctx)
+{
+    struct test_channel *t = ctx;
+    struct sched_param param;
+
+    if (t->policy < 0) {
+        pthread_getschedparam(pthread_self(), &t->policy, &param);
+#if defined(__linux__)
+        {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            pthread_getaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+            t->cpus = CPU_COUNT(&cpus);
+            t->on_cpu = CPU_ISSET(0, &cpus);
+        }
+#endif
+    }
+    if (t->len + 2 * len > t->size) return;
+    memcpy(t->out + t->len, iq, 2 * len * sizeof(float));
+    mirisdr_store(&t->len, t->len + 2 * len);
+}
+
+static int test_channel_init(struct test_channel *t, int k)
+{
+    int32_t offset = -600000 + 240000 * k;
+
+    memset(t, 0, sizeof(*t));
+    t->policy = -1;
+    t->size = 2 * (TEST_OUT_RATE * (uint32_t) ((uint64_t) TEST_BLOCKS * TEST_BLOCK / TEST_RATE) + TEST_OUT_RATE);
+    if (!(t->out = malloc(t->size * sizeof(float)))) return -1;
+    return mirisdr_channel_create(&t->c, TEST_RATE, offset, 0, TEST_OUT_RATE, test_cb, t);
+}
+
+/* noise and a tone in every channel */
+static void test_input(void)
+{
+    uint32_t i, seed = 1;
+    double f;
+    int k;
+
+    input = malloc(4 * (size_t) TEST_BLOCK * TEST_BLOCKS);
+    for (i = 0; i < (uint32_t) TEST_BLOCK * TEST_BLOCKS; i++) {
+        double re = 0.0, im = 0.0;
+        for (k = 0; k < TEST_CHANNELS; k++) {
+            f = 2.0 * 3.14159265358979 * (-600000 + 240000 * k + 1000 * (k + 1)) / TEST_RATE * i;
+            re += 3000.0 * cos(f);
+            im += 3000.0 * sin(f);
+        }
+        seed = seed * 1103515245 + 12345;
+        input[2 * i] = (int16_t) (re + ((seed >> 16) & 0x3ff) - 0x200);
+        seed = seed * 1103515245 + 12345;
+        input[2 * i + 1] = (int16_t) (im + ((seed >> 16) & 0x3ff) - 0x200);
+    }
+}
+
+/* output floats of every channel after each block, run directly */
+static uint32_t expected[TEST_BLOCKS][TEST_CHANNELS];
+
+int main(void)
+{
+    mirisdr_dev_t *p;
+    void *saved;
+    int cpu = 0, b, k, done, failed = 0, spins;
+
+    test_input();
+    if (!(p = calloc(1, sizeof(*p)))) return 1;
+
+    for (k = 0; k < TEST_CHANNELS; k++) {
+        if ((test_channel_init(&pooled[k], k) < 0) || (test_channel_init(&direct[k], k) < 0)) {
+            fprintf(stderr, "failed to create the channels\n");
+            return 1;
+        }
+        mirisdr_add_channel(p, pooled[k].c);
+    }
+    for (b = 0; b < TEST_BLOCKS; b++) {
+        for (k = 0; k < TEST_CHANNELS; k++) {
+            mirisdr_channel_process(direct[k].c, input + 2 * (size_t) b * TEST_BLOCK, TEST_BLOCK);
+            expected[b][k] = direct[k].len;
+        }
+    }
+
+    /* like the streaming thread of -X fifo:10 -C 0, realtime needs the rights */
+    mirisdr_set_channel_threads(p, TEST_THREADS);
+    mirisdr_set_realtime(p, MIRISDR_SCHED_FIFO, 10);
+    mirisdr_set_cpu_affinity(p, &cpu, 1);
+    saved = mirisdr_thread_enter(p);
+
+    if (mirisdr_channels_start(p, 4 * TEST_BLOCK) < 0) return 1;
+
+    /* never so far ahead that the pool drops a block */
+    for (b = 0, done = 0; b < TEST_BLOCKS; b++) {
+        for (spins = 0; b - done >= TEST_AHEAD; spins++) {
+            for (k = 0; k < TEST_CHANNELS; k++) {
+                if (mirisdr_load(&pooled[k].len) < expected[done][k]) break;
+            }
+            if (k == TEST_CHANNELS) {
+                done++;
+            } else if (spins > 100000) {
+                fprintf(stderr, "block %d not processed\n", done);
+                return 1;
+            } else {
+                usleep(100);
+            }
+        }
+        mirisdr_channels_feed(p, (const uint8_t *) (input + 2 * (size_t) b * TEST_BLOCK), 4 * TEST_BLOCK, 0);
+    }
+    mirisdr_channels_stop(p);
+    mirisdr_thread_leave(saved);
+
+    for (k = 0; k < TEST_CHANNELS; k++) {
+        if ((pooled[k].len != direct[k].len) ||
+            memcmp(pooled[k].out, direct[k].out, direct[k].len * sizeof(float))) {
+            fprintf(stderr, "channel %d: %u floats through the pool, %u directly\n",
+                    k, pooled[k].len, direct[k].len);
+            failed = 1;
+        }
+        if (pooled[k].policy != SCHED_OTHER) {
+            fprintf(stderr, "channel %d: the worker runs with policy %d\n", k, pooled[k].policy);
+            failed = 1;
+        }
+#if defined(__linux__)
+        if ((pooled[k].cpus != 1) || (!pooled[k].on_cpu)) {
+            fprintf(stderr, "channel %d: the worker is not on cpu 0 alone\n", k);
+            failed = 1;
+        }
+#endif
+    }
+
+    fprintf(stderr, "%d channels, %d blocks through %d workers: %s\n",
+            TEST_CHANNELS, TEST_BLOCKS, TEST_THREADS, failed ? "FAILED" : "ok");
+
+    for (k = 0; k < TEST_CHANNELS; k++) {
+        mirisdr_channel_destroy(pooled[k].c);
+        mirisdr_channel_destroy(direct[k].c);
+        free(pooled[k].out);
+        free(direct[k].out);
+    }
+    free(p->cpus);
+    free(p);
+    free(input);
+    return failed;
+}
@@ -0,0 +1,307 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Polyphase filterbank channelizer
+ *
+ * The band is split into M channels spaced fs / M apart, channel k is
+ * centered at k * fs / M (the upper half are the negative frequencies).
+ * Every D input samples (D = M, or M / 2 when oversampled twice) the last
+ * M * P samples are weighted by the prototype low pass, folded into M
+ * values and one FFT of size M gives one output sample of every channel:
+ *
+ *   v[r]  = sum_p h[p M + r] x[oldest + p M + r]
+ *   Y[k]  = e^(-j 2 pi k / M) FFT(v)[k]
+ *
+ * and with D = M / 2 every other output of the odd channels is negated.
+ * Only the selected channels are handed to the callback.
+ */
+
+#include <math.h>
+
+#include "mirisdr_private.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define CHANNELIZER_BLOCK       4096    /* input samples processed at once */
+#define CHANNELIZER_TAPS        12      /* taps of the prototype per branch */
+#define CHANNELIZER_LANES       8
+#define CHANNELIZER_MAX         4096
+
+struct mirisdr_channelizer {
+    struct mirisdr_consumer consumer;   /* první, ukazatele jsou zaměnitelné */
+    int                 m;
+    int                 log2m;
+    int                 decim;
+    int                 span;           /* M * P */
+    mirisdr_channelizer_cb_t cb;
+    void                *cb_ctx;
+
+    float               *h;             /* prototype, M * P */
+    float               *x_i, *x_q;     /* span - 1 samples of history, then the input */
+    int                 start;          /* newest sample of the next output */
+    uint64_t            count;          /* outputs so far, sign of the odd channels */
+
+    /* FFT */
+    float               *v_i, *v_q;
+    float               *tw_i, *tw_q;   /* e^(-j 2 pi n / M), n < M / 2 */
+    int                 *rev;
+    float               *fix_i, *fix_q; /* e^(-j 2 pi k / M) */
+
+    int                 *selected;
+    int                 *active;        /* selected, as of the start of the block */
+    int                 max_out;
+    float               *out;           /* max_out interleaved samples per channel */
+    int                 out_len;
+};
+
+/*********************************** FFT **************************************/
+
+/* in place, radix 2, the input in bit reversed order */
+static void channelizer_fft (mirisdr_channelizer_t *z, float *re, float *im) {
+    int size, half, step, i, j, k;
+    float t_i, t_q, w_i, w_q;
+
+    for (size = 2; size <= z->m; size *= 2) {
+        half = size / 2;
+        step = z->m / size;
+        for (i = 0; i < z->m; i += size) {
+            for (j = 0, k = 0; j < half; j++, k += step) {
+                w_i = z->tw_i[k];
+                w_q = z->tw_q[k];
+                t_i = w_i * re[i + j + half] - w_q * im[i + j + half];
+                t_q = w_i * im[i + j + half] + w_q * re[i + j + half];
+                re[i + j + half] = re[i + j] - t_i;
+                im[i + j + half] = im[i + j] - t_q;
+                re[i + j] += t_i;
+                im[i + j] += t_q;
+            }
+        }
+    }
+}
+
+/******************************** filterbank **********************************/
+
+/* fold the window into v (bit reversed for the FFT), then one output of every channel */
+static void channelizer_output (mirisdr_channelizer_t *z, int newest) {
+    const float *x_i = z->x_i + newest - z->span + 1;
+    const float *x_q = z->x_q + newest - z->span + 1;
+    float acc_i[CHANNELIZER_LANES], acc_q[CHANNELIZER_LANES];
+    float *out, y_i, y_q, sign;
+    int r, p, l, k;
+
+    for (r = 0; r < z->m; r += CHANNELIZER_LANES) {
+        int lanes = (z->m - r < CHANNELIZER_LANES) ? z->m - r : CHANNELIZER_LANES;
+
+        for (l = 0; l < CHANNELIZER_LANES; l++) acc_i[l] = acc_q[l] = 0.0f;
+
+        for (p = 0; p < z->span; p += z->m) {
+            for (l = 0; l < lanes; l++) {
+                acc_i[l] += z->h[p + r + l] * x_i[p + r + l];
+                acc_q[l] += z->h[p + r + l] * x_q[p + r + l];
+            }
+        }
+
+        for (l = 0; l < lanes; l++) {
+            z->v_i[z->rev[r + l]] = acc_i[l];
+            z->v_q[z->rev[r + l]] = acc_q[l];
+        }
+    }
+
+    channelizer_fft(z, z->v_i, z->v_q);
+
+    /* převzorkování 2x, liché kanály střídají znaménko */
+    for (k = 0; k < z->m; k++) {
+        if (!z->active[k]) continue;
+
+        sign = ((z->decim != z->m) && (k & 1) && (z->count & 1)) ? -1.0f : 1.0f;
+        y_i = z->v_i[k] * z->fix_i[k] - z->v_q[k] * z->fix_q[k];
+        y_q = z->v_i[k] * z->fix_q[k] + z->v_q[k] * z->fix_i[k];
+
+        out = z->out + 2 * ((size_t) k * z->max_out + z->out_len);
+        out[0] = sign * y_i;
+        out[1] = sign * y_q;
+    }
+
+    z->out_len++;
+    z->count++;
+}
+
+static void channelizer_block (mirisdr_channelizer_t *z, const int16_t *iq, int n) {
+    int total = z->span - 1 + n, pos, i, k;
+    float *x_i = z->x_i + z->span - 1, *x_q = z->x_q + z->span - 1;
+
+    for (i = 0; i < n; i++) {
+        x_i[i] = iq[2 * i] * (1.0f / 32768.0f);
+        x_q[i] = iq[2 * i + 1] * (1.0f / 32768.0f);
+    }
+
+    /* a channel switched on mid-block would get outputs never written */
+    for (k = 0; k < z->m; k++) z->active[k] = mirisdr_load(&z->selected[k]);
+
+    z->out_len = 0;
+    for (pos = z->start; pos < total; pos += z->decim) channelizer_output(z, pos);
+    z->start = pos - n;
+
+    memmove(z->x_i, z->x_i + n, (size_t) (z->span - 1) * sizeof(float));
+    memmove(z->x_q, z->x_q + n, (size_t) (z->span - 1) * sizeof(float));
+
+    if (!z->out_len) return;
+
+    for (k = 0; k < z->m; k++) {
+        if (z->active[k])
+            z->cb(k, z->out + 2 * (size_t) k * z->max_out, (uint32_t) z->out_len, z->cb_ctx);
+    }
+}
+
+/********************************** public ************************************/
+
+static int channelizer_consumer_process (struct mirisdr_consumer *c, const int16_t *iq, uint32_t len) {
+    return mirisdr_channelizer_process((mirisdr_channelizer_t *) c, iq, len);
+}
+
+int mirisdr_channelizer_create (mirisdr_channelizer_t **z, uint32_t channels, int oversample,
+                                mirisdr_channelizer_cb_t cb, void *ctx) {
+    mirisdr_channelizer_t *n = NULL;
+    int i, j, r;
+    double x, w, sum = 0.0;
+
+    if ((!z) || (!cb)) goto failed;
+    if ((channels < 2) || (channels > CHANNELIZER_MAX) || (channels & (channels - 1))) {
+        fprintf(stderr, "channelizer needs a power of two channels up to %d\n", CHANNELIZER_MAX);
+        goto failed;
+    }
+
+    if (!(n = calloc(1, sizeof(*n)))) goto failed;
+
+    n->consumer.process = channelizer_consumer_process;
+    n->m = (int) channels;
+    while ((1 << n->log2m) < n->m) n->log2m++;
+    n->decim = oversample ? n->m / 2 : n->m;
+    n->span = n->m * CHANNELIZER_TAPS;
+    n->cb = cb;
+    n->cb_ctx = ctx;
+    n->start = n->span - 1;
+    n->max_out = CHANNELIZER_BLOCK / n->decim + 1;
+
+    n->h = malloc((size_t) n->span * sizeof(float));
+    n->x_i = calloc((size_t) (n->span - 1 + CHANNELIZER_BLOCK), sizeof(float));
+    n->x_q = calloc((size_t) (n->span - 1 + CHANNELIZER_BLOCK), sizeof(float));
+    n->v_i = malloc((size_t) n->m * sizeof(float));
+    n->v_q = malloc((size_t) n->m * sizeof(float));
+    n->tw_i = malloc((size_t) n->m / 2 * sizeof(float));
+    n->tw_q = malloc((size_t) n->m / 2 * sizeof(float));
+    n->fix_i = malloc((size_t) n->m * sizeof(float));
+    n->fix_q = malloc((size_t) n->m * sizeof(float));
+    n->rev = malloc((size_t) n->m * sizeof(int));
+    n->selected = calloc((size_t) n->m, sizeof(int));
+    n->active = calloc((size_t) n->m, sizeof(int));
+    n->out = malloc(2 * (size_t) n->m * n->max_out * sizeof(float));
+    if ((!n->h) || (!n->x_i) || (!n->x_q) || (!n->v_i) || (!n->v_q) || (!n->tw_i) || (!n->tw_q) ||
+        (!n->fix_i) || (!n->fix_q) || (!n->rev) || (!n->selected) || (!n->active) || (!n->out)) goto failed;
+
+    /* prototyp, okno Blackman, mezní kmitočet na hraně kanálu */
+    for (i = 0; i < n->span; i++) {
+        x = i - (n->span - 1) / 2.0;
+        w = 0.42 - 0.5 * cos(2.0 * M_PI * i / (n->span - 1)) + 0.08 * cos(4.0 * M_PI * i / (n->span - 1));
+        n->h[i] = (float) (w * ((x == 0.0) ? 1.0 : sin(M_PI * x / n->m) / (M_PI * x / n->m)));
+        sum += n->h[i];
+    }
+    for (i = 0; i < n->span; i++) n->h[i] = (float) (n->h[i] / sum);
+
+    for (i = 0; i < n->m / 2; i++) {
+        n->tw_i[i] = (float) cos(-2.0 * M_PI * i / n->m);
+        n->tw_q[i] = (float) sin(-2.0 * M_PI * i / n->m);
+    }
+    for (i = 0; i < n->m; i++) {
+        n->fix_i[i] = (float) cos(-2.0 * M_PI * i / n->m);
+        n->fix_q[i] = (float) sin(-2.0 * M_PI * i / n->m);
+        for (j = 0, r = 0; j < n->log2m; j++) r |= ((i >> j) & 1) << (n->log2m - 1 - j);
+        n->rev[i] = r;
+    }
+
+    *z = n;
+    return 0;
+
+failed:
+    if (n) mirisdr_channelizer_destroy(n);
+    return -1;
+}
+
+/* may be called at any time, also from the callback, it counts from the next block on */
+int mirisdr_channelizer_select (mirisdr_channelizer_t *z, int channel, int on) {
+    if ((!z) || (channel < 0) || (channel >= z->m)) goto failed;
+
+    mirisdr_store(&z->selected[channel], on ? 1 : 0);
+
+    return 0;
+
+failed:
+    return -1;
+}
+
+int mirisdr_channelizer_process (mirisdr_channelizer_t *z, const int16_t *iq, uint32_t len) {
+    uint32_t n;
+
+    if ((!z) || (!iq)) goto failed;
+
+    while (len > 0) {
+        n = (len > CHANNELIZER_BLOCK) ? CHANNELIZER_BLOCK : len;
+        channelizer_block(z, iq, (int) n);
+        iq += 2 * n;
+        len -= n;
+    }
+
+    return 0;
+
+failed:
+    return -1;
+}
+
+int mirisdr_channelizer_destroy (mirisdr_channelizer_t *z) {
+    if (!z) goto failed;
+
+    if ((z->consumer.dev) && (mirisdr_consumer_remove(z->consumer.dev, &z->consumer) < 0)) goto failed;
+
+    free(z->h);
+    free(z->x_i);
+    free(z->x_q);
+    free(z->v_i);
+    free(z->v_q);
+    free(z->tw_i);
+    free(z->tw_q);
+    free(z->fix_i);
+    free(z->fix_q);
+    free(z->rev);
+    free(z->selected);
+    free(z->active);
+    free(z->out);
+    free(z);
+
+    return 0;
+
+failed:
+    return -1;
+}
+
+int mirisdr_add_channelizer (mirisdr_dev_t *p, mirisdr_channelizer_t *z) {
+    return z ? mirisdr_consumer_add(p, &z->consumer) : -1;
+}
+
+int mirisdr_remove_channelizer (mirisdr_dev_t *p, mirisdr_channelizer_t *z) {
+    return z ? mirisdr_consumer_remove(p, &z->consumer) : -1;
+}
@@ -333,4 +333,102 @@ int verbose_device_search(char *s)
 	return -1;
 }
 
+int verbose_set_realtime(mirisdr_dev_t *dev, char *s)
+/* fifo[:priority] or rr[:priority] */
+{
+	int r, priority = 50;
+	mirisdr_sched_t policy;
+	char *colon = strchr(s, ':');
+	if (colon) {
+		priority = atoi(colon + 1);}
+	if (strncmp(s, "fifo", 4) == 0) {
+		policy = MIRISDR_SCHED_FIFO;
+	} else if (strncmp(s, "rr", 2) == 0) {
+		policy = MIRISDR_SCHED_RR;
+	} else {
+		fprintf(stderr, "WARNING: Unknown scheduling policy %s, use fifo or rr.\n", s);
+		return -1;
+	}
+	r = mirisdr_set_realtime(dev, policy, priority);
+	if (r < 0) {
+		fprintf(stderr, "WARNING: Failed to set realtime scheduling.\n");
+	} else {
+		fprintf(stderr, "Streaming thread scheduling %s, priority %d.\n",
+			policy == MIRISDR_SCHED_FIFO ? "SCHED_FIFO" : "SCHED_RR", priority);
+	}
+	return r;
+}
+
+int parse_cpu_list(char *s, int *cpus, int max)
+/* 0,2-3 */
+{
+	int n = 0, a, b;
+	char *end;
+	while (*s) {
+		a = (int)strtol(s, &end, 10);
+		if (end == s || a < 0) {
+			return -1;}
+		b = a;
+		s = end;
+		if (*s == '-') {
+			s++;
+			b = (int)strtol(s, &end, 10);
+			if (end == s || b < a) {
+				return -1;}
+			s = end;
+		}
+		for (; a <= b; a++) {
+			if (n >= max) {
+				return -1;}
+			cpus[n++] = a;
+		}
+		if (*s == ',') {
+			s++;
+		} else if (*s) {
+			return -1;
+		}
+	}
+	return n;
+}
+
+int verbose_set_affinity(mirisdr_dev_t *dev, char *s)
+{
+	int cpus[256];
+	int r, n = parse_cpu_list(s, cpus, 256);
+	if (n <= 0) {
+		fprintf(stderr, "WARNING: Invalid cpu list %s.\n", s);
+		return -1;
+	}
+	r = mirisdr_set_cpu_affinity(dev, cpus, n);
+	if (r < 0) {
+		fprintf(stderr, "WARNING: Failed to set cpu affinity.\n");
+	} else {
+		fprintf(stderr, "Streaming thread pinned to cpu(s) %s.\n", s);
+	}
+	return r;
+}
+
+int verbose_set_mlock(mirisdr_dev_t *dev, char *s)
+/* buffers or all */
+{
+	int r;
+	mirisdr_mlock_t mode;
+	if (strcmp(s, "buffers") == 0 || strcmp(s, "1") == 0) {
+		mode = MIRISDR_MLOCK_BUFFERS;
+	} else if (strcmp(s, "all") == 0 || strcmp(s, "2") == 0) {
+		mode = MIRISDR_MLOCK_ALL;
+	} else {
+		fprintf(stderr, "WARNING: Unknown memory lock mode %s, use buffers or all.\n", s);
+		return -1;
+	}
+	r = mirisdr_set_mlock(dev, mode);
+	if (r < 0) {
+		fprintf(stderr, "WARNING: Failed to set memory locking.\n");
+	} else {
+		fprintf(stderr, "Locking %s in memory.\n",
+			mode == MIRISDR_MLOCK_ALL ? "the whole process" : "the sample buffers");
+	}
+	return r;
+}
+
 // vim: tabstop=8:softtabstop=8:shiftwidth=8:noexpandtab
@@ -141,3 +141,44 @@ int verbose_reset_buffer(mirisdr_dev_t *dev);
 int verbose_device_search(char *s);
 
 int verbose_ppm_eeprom(mirisdr_dev_t *dev, int *ppm_error);
+
+/*!
+ * Request realtime scheduling of the streaming thread and report status on stderr.
+ *
+ * \param dev the device handle given by mirisdr_open()
+ * \param s policy and priority, "fifo[:priority]" or "rr[:priority]"
+ * \return 0 on success
+ */
+
+int verbose_set_realtime(mirisdr_dev_t *dev, char *s);
+
+/*!
+ * Parse a list of cpus like "0,2-3"
+ *
+ * \param s a string to be parsed
+ * \param cpus output array
+ * \param max size of the output array
+ * \return number of cpus, -1 on error
+ */
+
+int parse_cpu_list(char *s, int *cpus, int max);
+
+/*!
+ * Pin the streaming thread to cpus and report status on stderr.
+ *
+ * \param dev the device handle given by mirisdr_open()
+ * \param s list of cpus, see parse_cpu_list()
+ * \return 0 on success
+ */
+
+int verbose_set_affinity(mirisdr_dev_t *dev, char *s);
+
+/*!
+ * Lock memory and report status on stderr.
+ *
+ * \param dev the device handle given by mirisdr_open()
+ * \param s "buffers" for the sample buffers, "all" for mlockall()
+ * \return 0 on success
+ */
+
+int verbose_set_mlock(mirisdr_dev_t *dev, char *s);
@@ -0,0 +1,615 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* lossless compressed IQ recordings, see iqz.h for the layout */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "iqz.h"
+
+#define IQZ_BLOCK		64
+#define IQZ_MODE_RICE		0x80
+#define IQZ_MODE_DELTA		0x40
+#define IQZ_MODE_PARAM		0x1f
+/* a longer unary run can only come from corrupted data */
+#define IQZ_MAX_QUOTIENT	(1 << 20)
+
+static const uint8_t iqz_magic[4] = {'I', 'Q', 'Z', '1'};
+
+struct bit_writer
+{
+	uint8_t  *p;
+	uint64_t acc;
+	int      cnt;
+};
+
+struct bit_reader
+{
+	const uint8_t *p;
+	uint64_t acc;
+	int      cnt;
+};
+
+static inline int bit_length(uint32_t v)
+{
+#ifdef __GNUC__
+	return v ? 32 - __builtin_clz(v) : 0;
+#else
+	int n = 0;
+	while (v) {
+		n++;
+		v >>= 1;
+	}
+	return n;
+#endif
+}
+
+static inline int trailing_zeros(uint64_t v)
+{
+#ifdef __GNUC__
+	return __builtin_ctzll(v);
+#else
+	int n = 0;
+	while (!(v & 1)) {
+		n++;
+		v >>= 1;
+	}
+	return n;
+#endif
+}
+
+static inline uint32_t zigzag(int32_t v)
+{
+	return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t u)
+{
+	return (int32_t)(u >> 1) ^ -(int32_t)(u & 1);
+}
+
+static inline void put_bits(struct bit_writer *w, uint32_t v, int n)
+/* n <= 32 */
+{
+	w->acc |= (uint64_t)v << w->cnt;
+	w->cnt += n;
+	while (w->cnt >= 8) {
+		*w->p++ = (uint8_t)w->acc;
+		w->acc >>= 8;
+		w->cnt -= 8;
+	}
+}
+
+static inline void put_unary(struct bit_writer *w, uint32_t q)
+{
+	while (q >= 24) {
+		put_bits(w, 0, 24);
+		q -= 24;
+	}
+	put_bits(w, 1u << q, q + 1);
+}
+
+static void flush_bits(struct bit_writer *w)
+{
+	if (w->cnt > 0) {
+		*w->p++ = (uint8_t)w->acc;
+	}
+	w->acc = 0;
+	w->cnt = 0;
+}
+
+static inline void refill(struct bit_reader *r)
+/* may read up to 8 bytes past the payload, callers pad */
+{
+	while (r->cnt <= 56) {
+		r->acc |= (uint64_t)(*r->p++) << r->cnt;
+		r->cnt += 8;
+	}
+}
+
+static inline uint32_t get_bits(struct bit_reader *r, int n)
+{
+	uint32_t v;
+	if (n == 0) {
+		return 0;}
+	refill(r);
+	v = (uint32_t)(r->acc & ((1ULL << n) - 1));
+	r->acc >>= n;
+	r->cnt -= n;
+	return v;
+}
+
+static inline int get_unary(struct bit_reader *r, uint32_t *q)
+{
+	int tz;
+	*q = 0;
+	while (1) {
+		refill(r);
+		if (r->acc == 0) {
+			*q += r->cnt;
+			r->cnt = 0;
+			if (*q > IQZ_MAX_QUOTIENT) {
+				return -1;}
+			continue;
+		}
+		tz = trailing_zeros(r->acc);
+		*q += tz;
+		/* tz may be 63, shifting by 64 at once is undefined */
+		r->acc = (r->acc >> tz) >> 1;
+		r->cnt -= tz + 1;
+		return 0;
+	}
+}
+
+static uint32_t rice_cost(const uint32_t *v, int n, int k)
+{
+	int i;
+	uint32_t cost = n * (k + 1);
+	for (i=0; i<n; i++) {
+		cost += v[i] >> k;}
+	return cost;
+}
+
+static void encode_block(struct bit_writer *w, const int32_t *x, int n,
+	int32_t prev, int flags)
+{
+	uint32_t raw[IQZ_BLOCK], delta[IQZ_BLOCK];
+	uint32_t or_raw = 0, or_delta = 0, sum_raw = 0, sum_delta = 0;
+	uint32_t cost, best_cost, *v;
+	int i, k, mode, wr, wd;
+
+	for (i=0; i<n; i++) {
+		raw[i] = zigzag(x[i]);
+		delta[i] = zigzag(x[i] - prev);
+		prev = x[i];
+		or_raw |= raw[i];
+		or_delta |= delta[i];
+		sum_raw += raw[i];
+		sum_delta += delta[i];
+	}
+
+	/* plain bit packing */
+	wr = bit_length(or_raw);
+	wd = bit_length(or_delta);
+	if (wd < wr) {
+		mode = IQZ_MODE_DELTA | wd;
+		best_cost = n * wd;
+	} else {
+		mode = wr;
+		best_cost = n * wr;
+	}
+
+	/* Rice codes, k estimated from the mean magnitude */
+	if (flags & IQZ_FLAG_ENTROPY) {
+		k = bit_length(sum_raw / n);
+		k = k > 0 ? k - 1 : 0;
+		cost = rice_cost(raw, n, k);
+		if (cost < best_cost) {
+			mode = IQZ_MODE_RICE | k;
+			best_cost = cost;
+		}
+		k = bit_length(sum_delta / n);
+		k = k > 0 ? k - 1 : 0;
+		cost = rice_cost(delta, n, k);
+		if (cost < best_cost) {
+			mode = IQZ_MODE_RICE | IQZ_MODE_DELTA | k;
+			best_cost = cost;
+		}
+	}
+
+	put_bits(w, mode, 8);
+	v = (mode & IQZ_MODE_DELTA) ? delta : raw;
+	k = mode & IQZ_MODE_PARAM;
+	if (mode & IQZ_MODE_RICE) {
+		for (i=0; i<n; i++) {
+			put_unary(w, v[i] >> k);
+			put_bits(w, v[i] & ((1u << k) - 1), k);
+		}
+	} else {
+		for (i=0; i<n; i++) {
+			put_bits(w, v[i], k);}
+	}
+}
+
+static int decode_block(struct bit_reader *r, int32_t *x, int n, int32_t prev)
+{
+	uint32_t q, v;
+	int i, mode, k;
+
+	mode = (int)get_bits(r, 8);
+	k = mode & IQZ_MODE_PARAM;
+	if (k > 17) {
+		return -1;}
+	for (i=0; i<n; i++) {
+		if (mode & IQZ_MODE_RICE) {
+			if (get_unary(r, &q) < 0) {
+				return -1;}
+			v = (q << k) | get_bits(r, k);
+		} else {
+			v = get_bits(r, k);
+		}
+		if (mode & IQZ_MODE_DELTA) {
+			prev += unzigzag(v);
+			x[i] = prev;
+		} else {
+			x[i] = unzigzag(v);
+			prev = x[i];
+		}
+	}
+	return 0;
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+	p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+size_t iqz_chunk_bound(uint32_t samples)
+{
+	size_t blocks = (samples + IQZ_BLOCK - 1) / IQZ_BLOCK;
+	/* two channels, mode byte and at most 17 bits per value */
+	return IQZ_HEADER_SIZE + 2 * blocks * (1 + (IQZ_BLOCK * 17 + 7) / 8) + 8;
+}
+
+size_t iqz_encode_chunk(const void *in, uint32_t samples, int width,
+	uint64_t index, int flags, uint8_t *out)
+{
+	int32_t x[IQZ_BLOCK];
+	const int16_t *in16 = in;
+	const int8_t *in8 = in;
+	struct bit_writer w = {out + IQZ_HEADER_SIZE, 0, 0};
+	uint32_t i, j, n, all = 0;
+	int c, shift = 0;
+	int32_t prev;
+
+	/* low bits left empty by the unpackers, e.g. << 2 for 14 bit */
+	for (i=0; i<2*samples; i++) {
+		all |= (width == 2) ? (uint16_t)in16[i] : (uint8_t)in8[i];}
+	if (all) {
+		shift = trailing_zeros(all);}
+
+	for (c=0; c<2; c++) {
+		prev = 0;
+		for (i=0; i<samples; i+=IQZ_BLOCK) {
+			n = samples - i < IQZ_BLOCK ? samples - i : IQZ_BLOCK;
+			for (j=0; j<n; j++) {
+				x[j] = (width == 2) ? in16[2*(i+j)+c] : in8[2*(i+j)+c];
+				x[j] >>= shift;
+			}
+			encode_block(&w, x, n, prev, flags);
+			prev = x[n-1];
+		}
+	}
+	flush_bits(&w);
+
+	memcpy(out, iqz_magic, 4);
+	put_le32(out + 4, (uint32_t)(w.p - out - IQZ_HEADER_SIZE));
+	put_le32(out + 8, (uint32_t)index);
+	put_le32(out + 12, (uint32_t)(index >> 32));
+	put_le32(out + 16, samples);
+	out[20] = (uint8_t)width;
+	out[21] = (uint8_t)shift;
+	out[22] = (uint8_t)flags;
+	out[23] = 0;
+	put_le32(out + 24, 0);
+	put_le32(out + 28, 0);
+
+	return w.p - out;
+}
+
+int iqz_read_header(const uint8_t *in, struct iqz_header *h)
+{
+	if (memcmp(in, iqz_magic, 4)) {
+		return -1;}
+	h->payload = get_le32(in + 4);
+	h->index = get_le32(in + 8) | (uint64_t)get_le32(in + 12) << 32;
+	h->samples = get_le32(in + 16);
+	h->width = in[20];
+	h->shift = in[21];
+	h->flags = in[22];
+	if (h->width != 1 && h->width != 2) {
+		return -1;}
+	if (h->samples > IQZ_CHUNK_SAMPLES || h->shift > 8 * h->width) {
+		return -1;}
+	if (h->payload > iqz_chunk_bound(h->samples)) {
+		return -1;}
+	return 0;
+}
+
+int iqz_decode_chunk(const struct iqz_header *h, const uint8_t *in, void *out)
+{
+	int32_t x[IQZ_BLOCK];
+	int16_t *out16 = out;
+	int8_t *out8 = out;
+	struct bit_reader r = {in, 0, 0};
+	uint32_t i, j, n;
+	int c;
+	int32_t prev;
+
+	for (c=0; c<2; c++) {
+		prev = 0;
+		for (i=0; i<h->samples; i+=IQZ_BLOCK) {
+			n = h->samples - i < IQZ_BLOCK ? h->samples - i : IQZ_BLOCK;
+			if (decode_block(&r, x, n, prev) < 0) {
+				return -1;}
+			prev = x[n-1];
+			for (j=0; j<n; j++) {
+				if (h->width == 2) {
+					out16[2*(i+j)+c] = (int16_t)(x[j] * (1 << h->shift));
+				} else {
+					out8[2*(i+j)+c] = (int8_t)(x[j] * (1 << h->shift));
+				}
+			}
+		}
+	}
+
+	/* consumed bits must lie within the payload */
+	if ((size_t)(r.p - in) * 8 - r.cnt > (size_t)h->payload * 8) {
+		return -1;}
+	return 0;
+}
+
+/* worker pool */
+
+enum slot_state {SLOT_FREE, SLOT_FILLED, SLOT_BUSY, SLOT_DONE};
+
+struct iqz_slot
+{
+	enum slot_state state;
+	uint8_t  *raw;
+	uint32_t samples;
+	uint64_t index;
+	uint8_t  *out;
+	size_t   out_len;
+};
+
+struct iqz_encoder
+{
+	FILE     *file;
+	int      width;
+	int      flags;
+	int      threads;
+	pthread_t *workers;
+	pthread_t writer;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct iqz_slot *slots;
+	int      slot_count;
+	uint64_t next_fill;
+	uint64_t next_write;
+	uint64_t expected_index;
+	int      exit_flag;
+	int      failed;
+};
+
+static void *iqz_worker_fn(void *arg)
+{
+	iqz_encoder_t *e = arg;
+	struct iqz_slot *s;
+	int i;
+
+	pthread_mutex_lock(&e->lock);
+	while (1) {
+		s = NULL;
+		for (i=0; i<e->slot_count; i++) {
+			if (e->slots[i].state == SLOT_FILLED) {
+				s = &e->slots[i];
+				break;
+			}
+		}
+		if (!s) {
+			if (e->exit_flag) {
+				break;}
+			pthread_cond_wait(&e->cond, &e->lock);
+			continue;
+		}
+		s->state = SLOT_BUSY;
+		pthread_mutex_unlock(&e->lock);
+
+		s->out_len = iqz_encode_chunk(s->raw, s->samples, e->width,
+			s->index, e->flags, s->out);
+
+		pthread_mutex_lock(&e->lock);
+		s->state = SLOT_DONE;
+		pthread_cond_broadcast(&e->cond);
+	}
+	pthread_mutex_unlock(&e->lock);
+	return 0;
+}
+
+static void *iqz_writer_fn(void *arg)
+/* chunks finish out of order, write them in sequence */
+{
+	iqz_encoder_t *e = arg;
+	struct iqz_slot *s;
+
+	pthread_mutex_lock(&e->lock);
+	while (1) {
+		s = &e->slots[e->next_write % e->slot_count];
+		if (e->next_write == e->next_fill || s->state != SLOT_DONE) {
+			if (e->exit_flag && e->next_write == e->next_fill) {
+				break;}
+			pthread_cond_wait(&e->cond, &e->lock);
+			continue;
+		}
+		pthread_mutex_unlock(&e->lock);
+
+		if (!e->failed && fwrite(s->out, 1, s->out_len, e->file) != s->out_len) {
+			fprintf(stderr, "Short write, compressed chunk lost!\n");
+			e->failed = 1;
+		}
+
+		pthread_mutex_lock(&e->lock);
+		s->state = SLOT_FREE;
+		s->samples = 0;
+		e->next_write++;
+		pthread_cond_broadcast(&e->cond);
+	}
+	pthread_mutex_unlock(&e->lock);
+	return 0;
+}
+
+static void iqz_encoder_stop(iqz_encoder_t *e, int workers, int writer)
+/* the threads that were started finish what is queued and exit */
+{
+	int i;
+
+	pthread_mutex_lock(&e->lock);
+	e->exit_flag = 1;
+	pthread_cond_broadcast(&e->cond);
+	pthread_mutex_unlock(&e->lock);
+
+	for (i=0; i<workers; i++) {
+		pthread_join(e->workers[i], NULL);}
+	if (writer) {
+		pthread_join(e->writer, NULL);}
+	pthread_mutex_destroy(&e->lock);
+	pthread_cond_destroy(&e->cond);
+}
+
+static void iqz_encoder_free(iqz_encoder_t *e)
+{
+	int i;
+
+	if (e->slots) {
+		for (i=0; i<e->slot_count; i++) {
+			free(e->slots[i].raw);
+			free(e->slots[i].out);
+		}
+	}
+	free(e->slots);
+	free(e->workers);
+	free(e);
+}
+
+iqz_encoder_t *iqz_encoder_open(FILE *file, int threads, int width, int flags)
+{
+	iqz_encoder_t *e;
+	int i, r;
+
+	if (threads < 1) {
+		threads = 1;}
+	e = calloc(1, sizeof(*e));
+	if (!e) {
+		return NULL;}
+	e->file = file;
+	e->width = width;
+	e->flags = flags;
+	e->threads = threads;
+	e->slot_count = 2 * threads + 2;
+	e->slots = calloc(e->slot_count, sizeof(*e->slots));
+	e->workers = calloc(threads, sizeof(*e->workers));
+	if (!e->slots || !e->workers) {
+		goto failed;}
+	for (i=0; i<e->slot_count; i++) {
+		e->slots[i].raw = malloc(IQZ_CHUNK_SAMPLES * 2 * width);
+		e->slots[i].out = malloc(iqz_chunk_bound(IQZ_CHUNK_SAMPLES));
+		if (!e->slots[i].raw || !e->slots[i].out) {
+			goto failed;}
+	}
+	pthread_mutex_init(&e->lock, NULL);
+	pthread_cond_init(&e->cond, NULL);
+	for (i=0; i<threads; i++) {
+		r = pthread_create(&e->workers[i], NULL, iqz_worker_fn, e);
+		if (r) {
+			fprintf(stderr, "Failed to start a compressing thread: %s\n", strerror(r));
+			iqz_encoder_stop(e, i, 0);
+			goto failed;
+		}
+	}
+	r = pthread_create(&e->writer, NULL, iqz_writer_fn, e);
+	if (r) {
+		fprintf(stderr, "Failed to start the writing thread: %s\n", strerror(r));
+		iqz_encoder_stop(e, threads, 0);
+		goto failed;
+	}
+	return e;
+
+failed:
+	iqz_encoder_free(e);
+	return NULL;
+}
+
+static void iqz_submit(iqz_encoder_t *e, struct iqz_slot *s)
+/* called with the lock held */
+{
+	s->state = SLOT_FILLED;
+	e->next_fill++;
+	pthread_cond_broadcast(&e->cond);
+}
+
+int iqz_encoder_write(iqz_encoder_t *e, const void *buf, uint32_t len, uint64_t index)
+{
+	const uint8_t *src = buf;
+	uint32_t pair = 2 * e->width;
+	uint32_t n, samples = len / pair;
+	struct iqz_slot *s;
+
+	pthread_mutex_lock(&e->lock);
+	while (samples > 0) {
+		s = &e->slots[e->next_fill % e->slot_count];
+		while (s->state != SLOT_FREE) {
+			pthread_cond_wait(&e->cond, &e->lock);}
+		/* a chunk covers only consecutive samples */
+		if (s->samples > 0 && index != e->expected_index) {
+			iqz_submit(e, s);
+			continue;
+		}
+		if (s->samples == 0) {
+			s->index = index;}
+		pthread_mutex_unlock(&e->lock);
+
+		n = IQZ_CHUNK_SAMPLES - s->samples;
+		if (n > samples) {
+			n = samples;}
+		memcpy(s->raw + s->samples * pair, src, n * pair);
+		s->samples += n;
+		src += n * pair;
+		samples -= n;
+		index += n;
+		e->expected_index = index;
+
+		pthread_mutex_lock(&e->lock);
+		if (s->samples == IQZ_CHUNK_SAMPLES) {
+			iqz_submit(e, s);}
+	}
+	pthread_mutex_unlock(&e->lock);
+	return e->failed ? -1 : 0;
+}
+
+int iqz_encoder_close(iqz_encoder_t *e)
+{
+	struct iqz_slot *s;
+	int r;
+
+	pthread_mutex_lock(&e->lock);
+	s = &e->slots[e->next_fill % e->slot_count];
+	if (s->state == SLOT_FREE && s->samples > 0) {
+		iqz_submit(e, s);}
+	pthread_mutex_unlock(&e->lock);
+
+	iqz_encoder_stop(e, e->threads, 1);
+	r = e->failed ? -1 : 0;
+	iqz_encoder_free(e);
+	return r;
+}
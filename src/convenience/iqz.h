@@ -0,0 +1,132 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* lossless compressed IQ recordings
+ *
+ * A file is a plain sequence of independent chunks, each one starting
+ * with a 32 byte little endian header:
+ *
+ *   0  magic "IQZ1"
+ *   4  payload size in bytes
+ *   8  hardware index of the first sample (64 bit)
+ *  16  number of I/Q pairs
+ *  20  sample width in bytes (1 or 2)
+ *  21  shift, low bits that are zero in every sample of the chunk
+ *  22  flags (IQZ_FLAG_ENTROPY)
+ *  23  reserved
+ *  24  reserved
+ *
+ * I and Q are coded separately in blocks of 64 values.  Every block has
+ * a mode byte choosing raw or delta prediction and either plain bit
+ * packing of the zigzagged values or Rice codes, whichever is smaller.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#define IQZ_HEADER_SIZE		32
+#define IQZ_CHUNK_SAMPLES	65536
+#define IQZ_FLAG_ENTROPY	0x01
+
+struct iqz_header
+{
+	uint32_t payload;
+	uint64_t index;
+	uint32_t samples;
+	int      width;
+	int      shift;
+	int      flags;
+};
+
+typedef struct iqz_encoder iqz_encoder_t;
+
+/*!
+ * Worst case size of an encoded chunk
+ *
+ * \param samples number of I/Q pairs
+ * \return bytes including the header
+ */
+
+size_t iqz_chunk_bound(uint32_t samples);
+
+/*!
+ * Encode one chunk
+ *
+ * \param in interleaved I/Q samples, int8 or int16
+ * \param samples number of I/Q pairs, at most IQZ_CHUNK_SAMPLES
+ * \param width sample width in bytes, 1 or 2
+ * \param index hardware index of the first sample
+ * \param flags IQZ_FLAG_ENTROPY enables the Rice stage
+ * \param out at least iqz_chunk_bound(samples) bytes
+ * \return encoded size including the header
+ */
+
+size_t iqz_encode_chunk(const void *in, uint32_t samples, int width,
+	uint64_t index, int flags, uint8_t *out);
+
+/*!
+ * Parse a chunk header
+ *
+ * \param in IQZ_HEADER_SIZE bytes
+ * \param h parsed header
+ * \return 0 on success, -1 if this is not a valid header
+ */
+
+int iqz_read_header(const uint8_t *in, struct iqz_header *h);
+
+/*!
+ * Decode the payload of one chunk
+ *
+ * \param h header of the chunk
+ * \param in payload followed by 8 readable padding bytes
+ * \param out room for h->samples I/Q pairs of h->width bytes each
+ * \return 0 on success, -1 on corrupted data
+ */
+
+int iqz_decode_chunk(const struct iqz_header *h, const uint8_t *in, void *out);
+
+/*!
+ * Start a compressing writer with a pool of worker threads
+ *
+ * \param file output, chunks are written in order
+ * \param threads number of compressing threads
+ * \param width sample width in bytes, 1 or 2
+ * \param flags chunk flags, see iqz_encode_chunk()
+ * \return encoder or NULL
+ */
+
+iqz_encoder_t *iqz_encoder_open(FILE *file, int threads, int width, int flags);
+
+/*!
+ * Queue samples, blocks only when all workers are busy
+ *
+ * \param e the encoder
+ * \param buf interleaved I/Q samples
+ * \param len length in bytes
+ * \param index hardware index of the first sample, a jump starts a new chunk
+ * \return 0 on success, -1 after a write error
+ */
+
+int iqz_encoder_write(iqz_encoder_t *e, const void *buf, uint32_t len, uint64_t index);
+
+/*!
+ * Flush the pending chunk, stop the workers and free the encoder
+ *
+ * \param e the encoder
+ * \return 0 on success, -1 if anything failed to write
+ */
+
+int iqz_encoder_close(iqz_encoder_t *e);
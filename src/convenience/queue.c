@@ -0,0 +1,115 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* bounded SPSC queue, see queue.h */
+
+#include <stdlib.h>
+
+#include "queue.h"
+
+#if defined(__GNUC__)
+#define queue_load(x)		__atomic_load_n((x), __ATOMIC_ACQUIRE)
+#define queue_store(x, v)	__atomic_store_n((x), (v), __ATOMIC_RELEASE)
+/* the sleeping flag and the indexes need a full barrier, else a wakeup is lost */
+#define queue_fence()		__atomic_thread_fence(__ATOMIC_SEQ_CST)
+#else
+#include <windows.h>
+#define queue_load(x)		(*(volatile long *)(x))
+#define queue_store(x, v)	(*(volatile long *)(x) = (long)(v))
+#define queue_fence()		MemoryBarrier()
+#endif
+
+int queue_init(struct spsc_queue *q, uint32_t size)
+{
+	uint32_t n = 1;
+	while (n < size) {
+		n <<= 1;}
+	q->slot = calloc(n, sizeof(void *));
+	if (!q->slot) {
+		return -1;}
+	q->mask = n - 1;
+	q->head = 0;
+	q->tail = 0;
+	q->closed = 0;
+	q->sleeping = 0;
+	pthread_mutex_init(&q->m, NULL);
+	pthread_cond_init(&q->c, NULL);
+	return 0;
+}
+
+void queue_free(struct spsc_queue *q)
+{
+	free(q->slot);
+	q->slot = NULL;
+	pthread_mutex_destroy(&q->m);
+	pthread_cond_destroy(&q->c);
+}
+
+static void queue_wake(struct spsc_queue *q)
+{
+	pthread_mutex_lock(&q->m);
+	pthread_cond_signal(&q->c);
+	pthread_mutex_unlock(&q->m);
+}
+
+int queue_push(struct spsc_queue *q, void *p)
+{
+	uint32_t head = q->head;
+	if (head - queue_load(&q->tail) > q->mask) {
+		return -1;}
+	q->slot[head & q->mask] = p;
+	queue_store(&q->head, head + 1);
+	queue_fence();
+	if (queue_load(&q->sleeping)) {
+		queue_wake(q);}
+	return 0;
+}
+
+void *queue_pop(struct spsc_queue *q)
+{
+	uint32_t tail = q->tail;
+	void *p;
+	if (queue_load(&q->head) == tail) {
+		return NULL;}
+	p = q->slot[tail & q->mask];
+	queue_store(&q->tail, tail + 1);
+	return p;
+}
+
+void *queue_pop_wait(struct spsc_queue *q)
+{
+	void *p;
+	while (!(p = queue_pop(q))) {
+		pthread_mutex_lock(&q->m);
+		queue_store(&q->sleeping, 1);
+		queue_fence();
+		/* checked again under the mutex, a push in between signals us */
+		if (queue_load(&q->head) == q->tail && !queue_load(&q->closed)) {
+			pthread_cond_wait(&q->c, &q->m);}
+		queue_store(&q->sleeping, 0);
+		pthread_mutex_unlock(&q->m);
+		if (queue_load(&q->closed) && queue_load(&q->head) == q->tail) {
+			return NULL;}
+	}
+	return p;
+}
+
+void queue_close(struct spsc_queue *q)
+{
+	pthread_mutex_lock(&q->m);
+	queue_store(&q->closed, 1);
+	pthread_cond_signal(&q->c);
+	pthread_mutex_unlock(&q->m);
+}
@@ -0,0 +1,90 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* bounded single producer, single consumer queue of pointers
+ *
+ * Push and pop are lock free, only a consumer that found the queue empty
+ * takes the mutex to sleep, and the producer only signals when somebody
+ * sleeps.  The pointers usually are buffers of a pool: one queue carries
+ * the full buffers downstream, a second one returns the empty ones, so
+ * the data is never copied and a slow consumer can't overwrite anything.
+ */
+
+#ifndef __CONVENIENCE_QUEUE_H
+#define __CONVENIENCE_QUEUE_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#define QUEUE_CACHE_LINE	64
+
+struct spsc_queue
+{
+	void     **slot;
+	uint32_t mask;
+	int      closed;
+	char     pad0[QUEUE_CACHE_LINE];
+	uint32_t head;          /* written by the producer only */
+	char     pad1[QUEUE_CACHE_LINE];
+	uint32_t tail;          /* written by the consumer only */
+	int      sleeping;
+	char     pad2[QUEUE_CACHE_LINE];
+	pthread_mutex_t m;
+	pthread_cond_t c;
+};
+
+/*!
+ * Allocate the slots
+ *
+ * \param q the queue
+ * \param size capacity, rounded up to a power of two
+ * \return 0 on success
+ */
+
+int queue_init(struct spsc_queue *q, uint32_t size);
+
+void queue_free(struct spsc_queue *q);
+
+/*!
+ * Producer side, never blocks
+ *
+ * \return 0 on success, -1 when the queue is full
+ */
+
+int queue_push(struct spsc_queue *q, void *p);
+
+/*!
+ * Consumer side, never blocks
+ *
+ * \return the oldest pointer or NULL when the queue is empty
+ */
+
+void *queue_pop(struct spsc_queue *q);
+
+/*!
+ * Consumer side, sleeps until something arrives
+ *
+ * \return the oldest pointer or NULL once the queue is closed and empty
+ */
+
+void *queue_pop_wait(struct spsc_queue *q);
+
+/*!
+ * Wake the consumer for good, may be called from any thread
+ */
+
+void queue_close(struct spsc_queue *q);
+
+#endif
@@ -0,0 +1,203 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Narrowband front end of the async path
+ *
+ * Every 1024 byte block of a transfer is unpacked into a small buffer which
+ * stays in L1, rotated by fs/4 and fed to a third order CIC decimator.  Only
+ * the decimated samples are written out, so the full rate data never goes
+ * through memory.  The output is always interleaved 16 bit I/Q with the gain
+ * of the CIC normalized, the rotation moves a signal at -fs/4 to DC (tune
+ * fs/4 above it, like rotate_90 in miri_fm).
+ */
+
+#include "mirisdr_private.h"
+
+#define FRONTEND_MAX_DECIMATION     256
+#define FRONTEND_ORDER              3
+
+struct mirisdr_frontend {
+    int                 rotate;
+    uint32_t            decim;
+    int                 shift;          /* log2(decim^order) */
+    uint32_t            phase;          /* vstupní vzorky od posledního výstupu */
+
+    /* integrátory a hřebeny, modulo aritmetika */
+    uint64_t            integ[FRONTEND_ORDER][2];
+    uint64_t            comb[FRONTEND_ORDER][2];
+
+    int16_t             block[1008];    /* jeden rozbalený blok, zůstává v L1 */
+};
+
+int mirisdr_set_frontend (mirisdr_dev_t *p, int rotate, uint32_t decimation) {
+    struct mirisdr_frontend *s;
+    int log2d = 0;
+
+    if (!p) goto failed;
+
+    /* nelze měnit za běhu */
+    if (mirisdr_async_get(p) != MIRISDR_ASYNC_INACTIVE) goto failed;
+
+    if (decimation == 0) decimation = 1;
+    if ((decimation > FRONTEND_MAX_DECIMATION) || (decimation & (decimation - 1))) {
+        fprintf(stderr, "front end decimation must be a power of two up to %d\n", FRONTEND_MAX_DECIMATION);
+        goto failed;
+    }
+    while ((1U << log2d) < decimation) log2d++;
+
+    /* vypnutí */
+    if ((!rotate) && (decimation == 1)) {
+        free(p->frontend);
+        p->frontend = NULL;
+        return 0;
+    }
+
+    if (!p->frontend) {
+        if (!(s = malloc(sizeof(*s)))) goto failed;
+        p->frontend = s;
+    }
+
+    s = p->frontend;
+    memset(s, 0, sizeof(*s));
+    s->rotate = rotate;
+    s->decim = decimation;
+    s->shift = FRONTEND_ORDER * log2d;
+
+    return 0;
+
+failed:
+    return -1;
+}
+
+/* new stream, forget the history */
+void mirisdr_frontend_reset (mirisdr_dev_t *p) {
+    struct mirisdr_frontend *s = p->frontend;
+
+    if (!s) return;
+
+    memset(s->integ, 0, sizeof(s->integ));
+    memset(s->comb, 0, sizeof(s->comb));
+    s->phase = 0;
+}
+
+/* input samples until the next output, the index of the first output of a transfer */
+uint32_t mirisdr_frontend_delay (mirisdr_dev_t *p) {
+    struct mirisdr_frontend *s = p->frontend;
+
+    return s->decim - 1 - s->phase;
+}
+
+uint32_t mirisdr_frontend_decimation (mirisdr_dev_t *p) {
+    return p->frontend ? p->frontend->decim : 1;
+}
+
+/* one I/Q pair into the integrators, a comb output every decim pairs */
+#define FRONTEND_STEP(x, y) \
+    do { \
+        s->integ[0][0] += (uint64_t) (int64_t) (x); \
+        s->integ[0][1] += (uint64_t) (int64_t) (y); \
+        s->integ[1][0] += s->integ[0][0]; \
+        s->integ[1][1] += s->integ[0][1]; \
+        s->integ[2][0] += s->integ[1][0]; \
+        s->integ[2][1] += s->integ[1][1]; \
+        if (++s->phase == s->decim) { \
+            s->phase = 0; \
+            dst[n++] = frontend_comb(s, 0); \
+            dst[n++] = frontend_comb(s, 1); \
+        } \
+    } while (0)
+
+static inline int16_t frontend_comb (struct mirisdr_frontend *s, int c) {
+    uint64_t v = s->integ[2][c], t;
+    int64_t out;
+    int k;
+
+    for (k = 0; k < FRONTEND_ORDER; k++) {
+        t = v - s->comb[k][c];
+        s->comb[k][c] = v;
+        v = t;
+    }
+
+    out = (int64_t) v >> s->shift;
+
+    /* -32768 otočené na 32768 */
+    return (int16_t) ((out > 32767) ? 32767 : (out < -32768) ? -32768 : out);
+}
+
+/* pairs is a multiple of 4 for every format, the rotation phase restarts with every block */
+static int frontend_block (struct mirisdr_frontend *s, const int16_t *src, int pairs, int16_t *dst) {
+    int i, n = 0;
+
+    if (s->decim == 1) {
+        /* 90 rotation is 1+0j, 0+1j, -1+0j, 0-1j */
+        for (i = 0; i < 2 * pairs; i += 8) {
+            dst[i + 0] = src[i + 0];
+            dst[i + 1] = src[i + 1];
+            dst[i + 2] = -src[i + 3];
+            dst[i + 3] = src[i + 2];
+            dst[i + 4] = -src[i + 4];
+            dst[i + 5] = -src[i + 5];
+            dst[i + 6] = src[i + 7];
+            dst[i + 7] = -src[i + 6];
+        }
+        return 2 * pairs;
+    }
+
+    if (s->rotate) {
+        for (i = 0; i < 2 * pairs; i += 8) {
+            FRONTEND_STEP(src[i + 0], src[i + 1]);
+            FRONTEND_STEP(-src[i + 3], src[i + 2]);
+            FRONTEND_STEP(-src[i + 4], -src[i + 5]);
+            FRONTEND_STEP(src[i + 7], -src[i + 6]);
+        }
+    } else {
+        for (i = 0; i < 2 * pairs; i += 2) {
+            FRONTEND_STEP(src[i + 0], src[i + 1]);
+        }
+    }
+
+    return n;
+}
+
+/* unpack, rotate and decimate cnt bytes of 1024 byte blocks, returns output bytes */
+int mirisdr_frontend_run (mirisdr_dev_t *p, unsigned char *buf, uint8_t *dst8, int cnt) {
+    struct mirisdr_frontend *s = p->frontend;
+    int16_t *dst = (int16_t *) dst8;
+    int i, bytes = 0, n = 0;
+
+    for (i = 0; i + 1024 <= cnt; i += 1024) {
+        switch (p->stream_format) {
+        case MIRISDR_FORMAT_252_S16:
+            bytes = mirisdr_samples_convert_252_s16(p, buf + i, (uint8_t *) s->block, 1024);
+            break;
+        case MIRISDR_FORMAT_336_S16:
+            bytes = mirisdr_samples_convert_336_s16(p, buf + i, (uint8_t *) s->block, 1024);
+            break;
+        case MIRISDR_FORMAT_384_S16:
+            bytes = mirisdr_samples_convert_384_s16(p, buf + i, (uint8_t *) s->block, 1024);
+            break;
+        /* 8 bitový formát rozšíříme, výstup je vždy 16 bitový */
+        case MIRISDR_FORMAT_504_S16:
+        case MIRISDR_FORMAT_504_S8:
+            bytes = mirisdr_samples_convert_504_s16(p, buf + i, (uint8_t *) s->block, 1024);
+            break;
+        }
+
+        n += frontend_block(s, s->block, bytes / 4, dst + n);
+    }
+
+    return n * 2;
+}
@@ -17,7 +17,7 @@
 
 #include "mirisdr_private.h"
 
-int mirisdr_set_gain(mirisdr_dev_t *p)
+static int mirisdr_set_gain_locked(mirisdr_dev_t *p)
 {
     uint32_t reg1 = 1, reg6 = 6;
 #if MIRISDR_DEBUG >= 1
@@ -90,6 +90,17 @@ int mirisdr_set_gain(mirisdr_dev_t *p)
     return 0;
 }
 
+int mirisdr_set_gain(mirisdr_dev_t *p)
+{
+    int r;
+
+    pthread_mutex_lock(&p->ctrl_lock);
+    r = mirisdr_set_gain_locked(p);
+    pthread_mutex_unlock(&p->ctrl_lock);
+
+    return r;
+}
+
 int mirisdr_get_tuner_gains(mirisdr_dev_t *dev, int *gains)
 {
     int i;
@@ -108,6 +119,9 @@ int mirisdr_get_tuner_gains(mirisdr_dev_t *dev, int *gains)
 
 int mirisdr_set_tuner_gain(mirisdr_dev_t *p, int gain)
 {
+    int r;
+
+    pthread_mutex_lock(&p->ctrl_lock);
     p->gain = gain;
     /*
      * Pro VHF režim je lna zapnutý +24dB, mixer +19dB a baseband
@@ -123,6 +137,7 @@ int mirisdr_set_tuner_gain(mirisdr_dev_t *p, int gain)
     }
     else if (p->gain < 0)
     {
+        pthread_mutex_unlock(&p->ctrl_lock);
         return mirisdr_set_tuner_gain_mode(p, 0);
     }
 
@@ -150,7 +165,10 @@ int mirisdr_set_tuner_gain(mirisdr_dev_t *p, int gain)
         p->gain_reduction_baseband = 59 - p->gain;
     }
 
-    return mirisdr_set_gain(p);
+    r = mirisdr_set_gain(p);
+    pthread_mutex_unlock(&p->ctrl_lock);
+
+    return r;
 }
 
 int mirisdr_get_tuner_gain(mirisdr_dev_t *p)
@@ -220,30 +238,50 @@ int mirisdr_get_tuner_gain_mode(mirisdr_dev_t *p)
  */
 int mirisdr_set_mixer_gain(mirisdr_dev_t *p, int gain)
 {
+    int r;
+
+    pthread_mutex_lock(&p->ctrl_lock);
     p->gain_reduction_mixer = gain ? 0 : 1;
+    r = mirisdr_set_gain(p);
+    pthread_mutex_unlock(&p->ctrl_lock);
 
-    return mirisdr_set_gain(p);
+    return r;
 }
 
 int mirisdr_set_mixbuffer_gain(mirisdr_dev_t *p, int gain)
 {
+    int r;
+
+    pthread_mutex_lock(&p->ctrl_lock);
     p->gain_reduction_mixbuffer = (3 - gain / 6) & 0x03;
+    r = mirisdr_set_gain(p);
+    pthread_mutex_unlock(&p->ctrl_lock);
 
-    return mirisdr_set_gain(p);
+    return r;
 }
 
 int mirisdr_set_lna_gain(mirisdr_dev_t *p, int gain)
 {
+    int r;
+
+    pthread_mutex_lock(&p->ctrl_lock);
     p->gain_reduction_lna = gain ? 0 : 1;
+    r = mirisdr_set_gain(p);
+    pthread_mutex_unlock(&p->ctrl_lock);
 
-    return mirisdr_set_gain(p);
+    return r;
 }
 
 int mirisdr_set_baseband_gain(mirisdr_dev_t *p, int gain)
 {
+    int r;
+
+    pthread_mutex_lock(&p->ctrl_lock);
     p->gain_reduction_baseband = 59 - gain;
+    r = mirisdr_set_gain(p);
+    pthread_mutex_unlock(&p->ctrl_lock);
 
-    return mirisdr_set_gain(p);
+    return r;
 }
 
 int mirisdr_get_mixer_gain(mirisdr_dev_t *p)
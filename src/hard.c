@@ -19,15 +19,15 @@
 
 /* nastavení parametrů které vyžadují restart */
 /* parameters that require restart */
-int mirisdr_set_hard(mirisdr_dev_t *p)
+static int mirisdr_set_hard_locked(mirisdr_dev_t *p)
 {
 	int streaming = 0;
-	uint32_t reg3 = 0, reg4 = 0;
+	uint32_t reg3 = 0, reg4 = 0, addr = 0;
 	uint64_t i, vco, n, fract;
 
 	/* při změně registrů musíme zastavit streamování */
 	/* at a register change we must stop streaming */
-	if (p->async_status == MIRISDR_ASYNC_RUNNING)
+	if (mirisdr_async_get(p) == MIRISDR_ASYNC_RUNNING)
 	{
 		streaming = 1;
 
@@ -74,7 +74,7 @@ int mirisdr_set_hard(mirisdr_dev_t *p)
 		fprintf( stderr, "format: 252\n");
 #endif
 		mirisdr_write_reg(p, 0x07, 0x000094);
-		p->addr = 252 + 2;
+		addr = 252 + 2;
 		break;
 	case MIRISDR_FORMAT_336_S16:
 		/* maximum rate 8.064 Msps | 24.576 MB/s | 196.608 Mbit/s */
@@ -82,7 +82,7 @@ int mirisdr_set_hard(mirisdr_dev_t *p)
 		fprintf( stderr, "format: 336\n");
 #endif
 		mirisdr_write_reg(p, 0x07, 0x000085);
-		p->addr = 336 + 2;
+		addr = 336 + 2;
 		break;
 	case MIRISDR_FORMAT_384_S16:
 		/* maximum rate 9.216 Msps | 24.576 MB/s | 196.608 Mbit/s */
@@ -90,7 +90,7 @@ int mirisdr_set_hard(mirisdr_dev_t *p)
 		fprintf( stderr, "format: 384\n");
 #endif
 		mirisdr_write_reg(p, 0x07, 0x0000a5);
-		p->addr = 384 + 2;
+		addr = 384 + 2;
 		break;
 	case MIRISDR_FORMAT_504_S16:
 	case MIRISDR_FORMAT_504_S8:
@@ -99,7 +99,7 @@ int mirisdr_set_hard(mirisdr_dev_t *p)
 		fprintf( stderr, "format: 504\n");
 #endif
 		mirisdr_write_reg(p, 0x07, 0x000c94);
-		p->addr = 504 + 2;
+		addr = 504 + 2;
 		break;
 	}
 
@@ -172,6 +172,11 @@ int mirisdr_set_hard(mirisdr_dev_t *p)
 	mirisdr_write_reg(p, 0x04, reg4);
 	mirisdr_write_reg(p, 0x03, reg3);
 
+	/* nový formát převezme vlákno událostí až na hranici přenosu */
+	/* the event thread takes the new format at a transfer boundary */
+	p->params_gen++;
+	mirisdr_store(&p->params, MIRISDR_PARAMS(p->params_gen, p->format, addr));
+
 	/* opětovné spuštění streamu */
 	/* restart stream */
 	if ((streaming) && (mirisdr_start_async(p) < 0)) {
@@ -183,11 +188,28 @@ int mirisdr_set_hard(mirisdr_dev_t *p)
 	failed: return -1;
 }
 
+/* register sequences of concurrent control threads must not interleave */
+int mirisdr_set_hard(mirisdr_dev_t *p)
+{
+	int r;
+
+	pthread_mutex_lock(&p->ctrl_lock);
+	r = mirisdr_set_hard_locked(p);
+	pthread_mutex_unlock(&p->ctrl_lock);
+
+	return r;
+}
+
 int mirisdr_set_sample_rate(mirisdr_dev_t *p, uint32_t rate)
 {
+	int r;
+
+	pthread_mutex_lock(&p->ctrl_lock);
 	p->rate = rate;
+	r = mirisdr_set_hard(p);
+	pthread_mutex_unlock(&p->ctrl_lock);
 
-	return mirisdr_set_hard(p);
+	return r;
 }
 
 uint32_t mirisdr_get_sample_rate(mirisdr_dev_t *p)
@@ -197,6 +219,10 @@ uint32_t mirisdr_get_sample_rate(mirisdr_dev_t *p)
 
 int mirisdr_set_sample_format(mirisdr_dev_t *p, const char *v)
 {
+	int r;
+
+	pthread_mutex_lock(&p->ctrl_lock);
+
 	if (!strcmp(v, "AUTO"))
 	{
 		p->format_auto = MIRISDR_FORMAT_AUTO_ON;
@@ -220,9 +246,14 @@ int mirisdr_set_sample_format(mirisdr_dev_t *p, const char *v)
 		}
 	}
 
-	return mirisdr_set_hard(p);
+	r = mirisdr_set_hard(p);
+	pthread_mutex_unlock(&p->ctrl_lock);
 
-	failed: return -1;
+	return r;
+
+	failed:
+	pthread_mutex_unlock(&p->ctrl_lock);
+	return -1;
 }
 
 const char *mirisdr_get_sample_format(mirisdr_dev_t *p)
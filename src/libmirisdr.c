@@ -24,6 +24,15 @@
 
 int mirisdr_setup (mirisdr_dev_t **out_dev, mirisdr_dev_t *dev) {
     int r;
+    pthread_mutexattr_t attr;
+
+    pthread_mutex_init(&dev->async_lock, NULL);
+    pthread_cond_init(&dev->async_done, NULL);
+    /* setters take it around their appliers, which take it again */
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&dev->ctrl_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
 
     /* reset je potřeba, jinak občas zařízení odmítá komunikovat */
     mirisdr_reset(dev);
@@ -101,6 +110,9 @@ failed:
             libusb_close(dev->dh);
         }
         if (dev->ctx) libusb_exit(dev->ctx);
+        pthread_cond_destroy(&dev->async_done);
+        pthread_mutex_destroy(&dev->async_lock);
+        pthread_mutex_destroy(&dev->ctrl_lock);
         free(dev);
     }
 
@@ -220,6 +232,12 @@ int mirisdr_close (mirisdr_dev_t *p) {
             usleep(1000);
 #endif
 
+    /* pool přenosů, dev_mem buffery potřebují ještě otevřené zařízení */
+    mirisdr_async_free(p);
+
+    /* kanály patří aplikaci, jen je odpojíme */
+    mirisdr_channels_detach(p);
+
     /* deinicializace tuneru */
     if (p->dh)
     {
@@ -233,14 +251,27 @@ int mirisdr_close (mirisdr_dev_t *p) {
                 fprintf(stderr, "Reattaching kernel driver failed!\n");
         }
 #endif
-        if (p->async_status != MIRISDR_ASYNC_FAILED) {
+        if (mirisdr_async_get(p) != MIRISDR_ASYNC_FAILED) {
             libusb_close(p->dh);
         }
     }
 
     if (p->ctx) libusb_exit(p->ctx);
 
-    if (p->samples) free(p->samples);
+    if ((p->samples) && (!p->samples_arena)) {
+        mirisdr_buffer_unlock(p, p->samples, p->samples_size);
+        free(p->samples);
+    }
+
+    if (p->cpus) free(p->cpus);
+
+    if (p->frontend) free(p->frontend);
+
+    mirisdr_trace_free(p);
+
+    pthread_cond_destroy(&p->async_done);
+    pthread_mutex_destroy(&p->async_lock);
+    pthread_mutex_destroy(&p->ctrl_lock);
 
     free(p);
 
@@ -0,0 +1,287 @@
+/*
+ * MiriSDR
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * throughput benchmark of the digital down converter channels,
+ * how many channels one core keeps up with at a given input rate,
+ * and of the polyphase channelizer which covers the whole band
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#else
+#include <windows.h>
+#include "getopt/getopt.h"
+#endif
+
+#include <pthread.h>
+
+#include "mirisdr.h"
+#include "convenience/convenience.h"
+
+#define DEFAULT_IN_RATE           2000000
+#define DEFAULT_OUT_RATE          25000
+#define DEFAULT_CHANNELS          8
+#define DEFAULT_THREADS           4
+#define MAXIMAL_THREADS           64
+#define MAXIMAL_CHANNELS          256
+
+struct bench_job
+{
+    pthread_t thread;
+    mirisdr_channel_t *channels[MAXIMAL_CHANNELS];
+    int     count;
+    uint64_t samples;
+};
+
+static int16_t *input;
+static uint32_t input_len, in_rate, out_rate, bandwidth;
+static double seconds = 2.0;
+
+void usage(void)
+{
+    fprintf(stderr,
+        "miri_ddc, benchmark of the digital down converter channels\n\n"
+        "Usage:\t miri_ddc [-options]\n"
+        "\t[-s input sample rate (default: 2M)]\n"
+        "\t[-r channel output rate (default: 25k)]\n"
+        "\t[-w channel bandwidth (default: 0, 80%% of the output rate)]\n"
+        "\t[-n channels per thread (default: 8)]\n"
+        "\t[-j maximal number of threads (default: 4)]\n"
+        "\t[-t seconds per measurement (default: 2)]\n"
+        "\t[-M channels of the polyphase channelizer to compare (default: 0, off)]\n"
+        "\t[-O oversample the channelizer twice]\n\n");
+    exit(1);
+}
+
+static double now(void)
+{
+#if !defined (_WIN32) || defined(__MINGW32__)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#else
+    return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+/* the output is thrown away */
+static void channel_cb(const float *iq, uint32_t len, void *ctx)
+{
+    (void)iq;
+    (void)len;
+    (void)ctx;
+}
+
+static void channelizer_cb(int channel, const float *iq, uint32_t len, void *ctx)
+{
+    (void)channel;
+    (void)iq;
+    (void)len;
+    (void)ctx;
+}
+
+/* every channel of the filterbank selected, one thread */
+static int channelizer_bench(int m, int oversample)
+{
+    mirisdr_channelizer_t *z;
+    uint32_t n, step = 16128;
+    uint64_t total = 0;
+    double t0;
+    int i;
+
+    if (mirisdr_channelizer_create(&z, (uint32_t)m, oversample, channelizer_cb, NULL) < 0)
+        return -1;
+    for (i = 0; i < m; i++)
+        mirisdr_channelizer_select(z, i, 1);
+
+    t0 = now();
+    while (now() - t0 < seconds) {
+        for (n = 0; n + step <= input_len; n += step) {
+            mirisdr_channelizer_process(z, input + 2 * n, step);
+            total += step;
+        }
+    }
+    fprintf(stderr, "channelizer: %d channels of %u Hz%s, %.1f Msps per core, %.1f cores at %u Hz\n",
+        m, in_rate / m, oversample ? " (2x oversampled)" : "",
+        total / (now() - t0) / 1e6, in_rate / (total / (now() - t0)), in_rate);
+    mirisdr_channelizer_destroy(z);
+    return 0;
+}
+
+/* plain noise, the content doesn't change the cost */
+static void make_input(void)
+{
+    uint32_t i, seed = 1;
+    input_len = in_rate / 10;
+    input = malloc(4 * (size_t)input_len);
+    for (i = 0; i < 2 * input_len; i++) {
+        seed = seed * 1103515245 + 12345;
+        input[i] = (int16_t)((seed >> 16) & 0x3fff) - 0x2000;
+    }
+}
+
+static int job_init(struct bench_job *j, int count)
+{
+    int i;
+    int32_t offset, span = (int32_t)(in_rate - bandwidth - out_rate) / 2;
+    memset(j, 0, sizeof(*j));
+    for (i = 0; i < count; i++) {
+        /* channels spread over the band */
+        offset = -span + (int32_t)((int64_t)2 * span * i / (count > 1 ? count - 1 : 1));
+        if (mirisdr_channel_create(&j->channels[i], in_rate, offset,
+            bandwidth, out_rate, channel_cb, j) < 0) {
+            fprintf(stderr, "Failed to create channel at %d Hz\n", offset);
+            return -1;
+        }
+        j->count++;
+    }
+    return 0;
+}
+
+static void job_free(struct bench_job *j)
+{
+    int i;
+    for (i = 0; i < j->count; i++)
+        mirisdr_channel_destroy(j->channels[i]);
+}
+
+/* runs the channels over the input for the given time, returns input samples */
+static void *job_run(void *arg)
+{
+    struct bench_job *j = arg;
+    double t0 = now();
+    uint64_t total = 0;
+    uint32_t n, step = 16128;   /* one bulk transfer of 504_S16 */
+    int i;
+    while (now() - t0 < seconds) {
+        for (n = 0; n + step <= input_len; n += step) {
+            for (i = 0; i < j->count; i++)
+                mirisdr_channel_process(j->channels[i], input + 2 * n, step);
+            total += step;
+        }
+    }
+    j->samples = total;
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    int opt, i, t;
+    int channels = DEFAULT_CHANNELS, threads = DEFAULT_THREADS;
+    int m = 0, oversample = 0;
+    struct bench_job *jobs;
+    double t0, t1, per_core;
+    uint64_t samples;
+    uint32_t rate;
+
+    in_rate = DEFAULT_IN_RATE;
+    out_rate = DEFAULT_OUT_RATE;
+    bandwidth = 0;
+
+    while ((opt = getopt(argc, argv, "s:r:w:n:j:t:M:Oh")) != -1) {
+        switch (opt) {
+        case 's':
+            in_rate = (uint32_t)atofs(optarg);
+            break;
+        case 'r':
+            out_rate = (uint32_t)atofs(optarg);
+            break;
+        case 'w':
+            bandwidth = (uint32_t)atofs(optarg);
+            break;
+        case 'n':
+            channels = atoi(optarg);
+            break;
+        case 'j':
+            threads = atoi(optarg);
+            break;
+        case 't':
+            seconds = atof(optarg);
+            break;
+        case 'M':
+            m = atoi(optarg);
+            break;
+        case 'O':
+            oversample = 1;
+            break;
+        case 'h':
+        default:
+            usage();
+            break;
+        }
+    }
+
+    if (channels < 1 || channels > MAXIMAL_CHANNELS || threads < 1 || threads > MAXIMAL_THREADS ||
+        !out_rate || out_rate > in_rate)
+        usage();
+    if (!bandwidth)
+        bandwidth = out_rate * 8 / 10;
+
+    make_input();
+    jobs = calloc((size_t)threads, sizeof(*jobs));
+
+    /* one thread, the cost of a single channel */
+    if (job_init(&jobs[0], 1) < 0)
+        return 1;
+    rate = mirisdr_channel_get_rate(jobs[0].channels[0]);
+    t0 = now();
+    job_run(&jobs[0]);
+    t1 = now();
+    samples = jobs[0].samples;
+    job_free(&jobs[0]);
+    per_core = samples / (t1 - t0);
+
+    fprintf(stderr, "input %u Hz, channels of %u Hz at %u Hz\n", in_rate, bandwidth, rate);
+    fprintf(stderr, "one channel:  %.1f Msps per core, %.1f channels per core\n",
+        per_core / 1e6, per_core / in_rate);
+
+    /* the same number of channels on every thread */
+    for (t = 1; t <= threads; t *= 2) {
+        for (i = 0; i < t; i++) {
+            if (job_init(&jobs[i], channels) < 0)
+                return 1;
+        }
+        t0 = now();
+        for (i = 0; i < t; i++)
+            pthread_create(&jobs[i].thread, NULL, job_run, &jobs[i]);
+        samples = 0;
+        for (i = 0; i < t; i++) {
+            pthread_join(jobs[i].thread, NULL);
+            samples += jobs[i].samples * (uint64_t)channels;
+        }
+        t1 = now();
+        for (i = 0; i < t; i++)
+            job_free(&jobs[i]);
+        fprintf(stderr, "%2d threads, %3d channels: %.1f channels per core, %.1f in real time\n",
+            t, t * channels, samples / (t1 - t0) / in_rate / t, samples / (t1 - t0) / in_rate);
+    }
+
+    if (m && channelizer_bench(m, oversample) < 0) {
+        fprintf(stderr, "Failed to create the channelizer\n");
+        return 1;
+    }
+
+    free(jobs);
+    free(input);
+    return 0;
+}
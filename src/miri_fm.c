@@ -39,8 +39,6 @@
  *       peak detector to tune onto stronger signals
  *       fifo for active hop frequency
  *       clips
- *       noise squelch
- *       merge stereo patch
  *       merge soft agc patch
  *       merge udp patch
  *       testmode to detect overruns
@@ -52,6 +50,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 
 #if !defined (_WIN32) || defined(__MINGW32__)
 #include <unistd.h>
@@ -59,6 +58,7 @@
 #include <windows.h>
 #include <fcntl.h>
 #include <io.h>
+#include <malloc.h>
 #include "getopt/getopt.h"
 #define usleep(x) Sleep(x/1000)
 #ifdef _MSC_VER
@@ -70,19 +70,61 @@
 #include <math.h>
 #include <pthread.h>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 #include "mirisdr.h"
 
 #include "convenience/convenience.h"
+#include "convenience/queue.h"
 
 #define DEFAULT_SAMPLE_RATE		24000
 #define DEFAULT_ASYNC_BUF_NUMBER	32
 #define DEFAULT_BUF_LENGTH		(1 * 16384)
 #define MAXIMUM_OVERSAMPLE		16
-#define MAXIMUM_BUF_LENGTH		(MAXIMUM_OVERSAMPLE * DEFAULT_BUF_LENGTH)
+#define TRANSFER_MAX_BYTES		48384	/* the largest transfer handed over, 504_S16 isochronous */
+#define CACHE_LINE			64
 #define AUTO_GAIN			-100
 #define BUFFER_DUMP			4096
+#define PIPE_BUFFERS			8
+#define DECIMATOR_STAGES		10
+#define DECIMATOR_BLOCK			4096	/* input pairs per round */
+#define DECIMATOR_MAX_TAPS		255
+#define DECIMATOR_DEFAULT_TAPS		31
+#define DECIMATOR_LANES			256	/* outputs filtered together */
+#define DECIMATOR_REJECTION		66.0	/* dB, per half band */
+#define RESAMPLE_POLY			0
+#define RESAMPLE_FARROW			1
+#define RESAMPLE_BOXCAR			2
+#define RESAMPLE_ZEROS			32	/* taps per phase without decimation */
+#define RESAMPLE_MAX_TAPS		512
+#define RESAMPLE_MAX_PHASES		1024
+#define RESAMPLE_LANES			8
+#define SQUELCH_LANES			8
+#define NOISE_BLOCK			256	/* samples to float at a time for the noise squelch */
+#define DEEMPH_LANES			8	/* outputs of the IIR at once */
+#define STEREO_BLOCK			32	/* samples per update of the pilot PLL */
+#define STEREO_MIN_RATE			120000	/* the composite up to RDS at 59.4 kHz */
+#define PILOT_HZ			19000.0
+#define PILOT_LOCK_HZ			2000.0	/* pilot deviation, 6750 Hz on air */
+#define PILOT_LOSE_HZ			1000.0
+#define RDS_CUTOFF			3200.0	/* Hz, the filter around 57 kHz */
+#define RDS_LOST			20	/* bad blocks in a row */
+#define NOISE_SQUELCH_REF		2.5	/* dB, no signal at all */
+#define BENCH_LEN			(2 * DEFAULT_BUF_LENGTH)	/* int16 or floats, I/Q */
+#define BENCH_CHUNKS			64	/* of BENCH_LEN in a generated capture */
+#define BENCH_ROUNDS			10	/* timed, the fastest counts */
 
 #define FREQUENCIES_LIMIT		1000
+#define CHANNELS_LIMIT			64
+#define MINIMUM_CAPTURE_RATE		2000000
+#define MAXIMUM_CAPTURE_RATE		10000000
+#define INPUT_CS16			0
+#define INPUT_CU8			1
+#define INPUT_CF32			2
 
 static volatile int do_exit = 0;
 static int lcm_post[17] = {1,1,1,3,1,5,3,7,1,9,5,11,3,13,7,15,1};
@@ -92,6 +134,24 @@ static int *atan_lut = NULL;
 static int atan_lut_size = 131072; /* 512 KB */
 static int atan_lut_coef = 8;
 
+struct pipe_buffer
+{
+	int      len;
+	int16_t  *data;
+	float    *f;            /* for the float path, else NULL */
+};
+
+/* the full buffers go downstream, the empty ones come back, nothing is copied */
+struct pipe
+{
+	struct spsc_queue full;
+	struct spsc_queue empty;
+	struct pipe_buffer *pool[PIPE_BUFFERS];
+	int      size;          /* values every buffer holds */
+	uint32_t overruns;      /* the producer found no empty buffer */
+	int      wait;          /* the producer waits for an empty buffer instead */
+};
+
 struct dongle_state
 {
 	int      exit_flag;
@@ -101,7 +161,6 @@ struct dongle_state
 	uint32_t freq;
 	uint32_t rate;
 	int      gain;
-	uint16_t buf16[MAXIMUM_BUF_LENGTH];
 	uint32_t buf_len;
 	int      ppm_error;
 	int      offset_tuning;
@@ -111,24 +170,92 @@ struct dongle_state
 	int      bw;
 	int      if_mode;
 	int      mute;
+	int      frontend;
+	int      fe_decim;      /* decimation done by the library */
+	int      full_scale;    /* S16 as it comes, for the scan */
 	struct demod_state *demod_target;
 };
 
+/* decimation by two split into even and odd samples, the dot products stay contiguous */
+struct dec2_stage
+{
+	int      n0, n1, off1;  /* taps on the even samples, on the odd ones from pair off1 */
+	float    h0[DECIMATOR_MAX_TAPS / 2 + 1];
+	float    h1[DECIMATOR_MAX_TAPS / 2 + 1];
+	int      span;          /* pairs under the filter */
+	int      binomial;      /* (1 + z^-1)^4, its taps are constants */
+	int      len;           /* complete pairs buffered */
+	int      odd;           /* the even sample of pair len is there */
+	float    e[2][DECIMATOR_BLOCK + DECIMATOR_MAX_TAPS];
+	float    o[2][DECIMATOR_BLOCK + DECIMATOR_MAX_TAPS];
+	float    y[2][DECIMATOR_BLOCK + DECIMATOR_MAX_TAPS];
+};
+
+/* rational L/M polyphase or Farrow, both on one float history */
+struct resampler
+{
+	int      mode;
+	int      up, down;      /* L and M */
+	int      taps;          /* per phase, a multiple of RESAMPLE_LANES */
+	int      phase;         /* of the next output, in 1/up input samples */
+	double   step, mu;      /* farrow: input samples per output and the fraction */
+	float   *bank;          /* up phases of taps each, or the 4 farrow rows */
+	float   *x;             /* taps - 1 samples of history, then the input */
+	int      pos;           /* window start of the next output */
+};
+
+/* the composite of wbfm: pilot PLL, L-R at 38 kHz and RDS at 57 kHz */
+struct stereo
+{
+	double   phase;         /* of the pilot at the next sample, [0, 2 pi) */
+	double   freq, freq0;   /* radians per sample */
+	double   kp, ki;        /* of the loop filter */
+	float    diff_gain;     /* 4, over the boxcar of post_downsample at 38 kHz */
+	float    pilot_i, pilot_q, pilot_mag;  /* smoothed, pilot_i is its amplitude when locked */
+	float    lock_level, lose_level;
+	int      locked;
+	float    c[STEREO_BLOCK], s[STEREO_BLOCK];  /* the pilot of one block */
+	struct resampler *left, *right;
+	float    *l, *r;        /* the matrixed composite */
+	float    deemph_r;      /* the left one keeps deemph_avg */
+	/* RDS, one sample per pilot cycle, 16 per bit */
+	FILE     *rds;
+	int      rds_taps;
+	float    *rds_h;
+	float    *rds_i, *rds_q;   /* taps - 1 samples of history, then the buffer */
+	int      *cycles;       /* where a pilot cycle ends */
+	double   bound;         /* phase of the next cycle end */
+	float    carrier_i, carrier_q;  /* smoothed square of the BPSK */
+	float    chips[16], energy[16];
+	int      count, timing, sign;
+	uint32_t reg;           /* the last 26 bits */
+	int      bits, synced, expect, last_type, bad;
+	uint16_t group[4];
+	int      good[4];
+	uint64_t groups;
+};
+
 struct demod_state
 {
 	int      exit_flag;
 	pthread_t thread;
-	int16_t  lowpassed[MAXIMUM_BUF_LENGTH];
+	int16_t  *lowpassed;    /* the buffer being demodulated */
 	int      lp_len;
 	int16_t  lp_i_hist[10][6];
 	int16_t  lp_q_hist[10][6];
-	int16_t  result[MAXIMUM_BUF_LENGTH];
+	int16_t  *result;
 	int16_t  droop_i_hist[9];
 	int16_t  droop_q_hist[9];
 	int      result_len;
+	int      result_size;   /* what result holds, the resampler stops there */
 	int      rate_in;
 	int      rate_out;
 	int      rate_out2;
+	int      resample_mode;
+	struct resampler *resampler;
+	int      stereo;        /* -E stereo, wbfm */
+	char     *rds_filename; /* -R, wbfm */
+	struct stereo *mpx;     /* for either, else NULL */
 	int      now_r, now_j;
 	int      pre_r, pre_j;
 	int      prev_index;
@@ -136,17 +263,33 @@ struct demod_state
 	int      post_downsample;
 	int      output_scale;
 	int      squelch_level, conseq_squelch, squelch_hits, terminate_on_squelch;
+	int      sq_n;          /* the power squelch sums, filled while decimating */
+	double   sq_sum, sq_power;
+	int      noise_squelch; /* FM, the noise above the voice band */
+	float    noise_level;   /* dB against no signal at all */
+	float    noise_hist[2];
 	int      downsample_passes;
 	int      comp_fir_size;
+	int      channel_taps;  /* half band cascade and this long channel FIR, 0 off */
+	struct dec2_stage *stages[DECIMATOR_STAGES];
+	int      stage_count;
 	int      custom_atan;
-	int      deemph, deemph_a;
+	int      deemph;
+	float    deemph_alpha, deemph_avg;  /* both paths, in full scale of the path */
+	float    deemph_pw[DEEMPH_LANES];
 	int      now_lpr;
 	int      prev_lpr_index;
 	int      dc_block, dc_avg;
 	void     (*mode_demod)(struct demod_state*);
-	pthread_rwlock_t rw;
-	pthread_cond_t ready;
-	pthread_mutex_t ready_m;
+	/* the float path, full scale is 1.0 */
+	int      use_float;
+	float    *lowpassed_f;
+	float    *result_f;
+	float    level_f;       /* what the int path's -l sees for a full scale sample */
+	float    now_rf, now_jf;
+	float    pre_rf, pre_jf;
+	float    dc_avg_f;
+	struct pipe in;
 	struct output_state *output_target;
 };
 
@@ -156,12 +299,26 @@ struct output_state
 	pthread_t thread;
 	FILE     *file;
 	char     *filename;
-	int16_t  result[MAXIMUM_BUF_LENGTH];
-	int      result_len;
 	int      rate;
-	pthread_rwlock_t rw;
-	pthread_cond_t ready;
-	pthread_mutex_t ready_m;
+	int      f32;           /* write float samples, else S16 */
+	struct pipe in;
+};
+
+/* a recording instead of the dongle, read as fast as demod takes it */
+struct input_state
+{
+	pthread_t thread;
+	char     *filename;
+	int      format;
+	uint32_t rate;
+	FILE     *file;
+	unsigned char *map;     /* the whole file when it could be mapped */
+	size_t   map_len, pos;
+	unsigned char *raw;     /* else read into this */
+	int16_t  *iq;           /* CU8 and CF32 converted for the channels */
+	int      eof;
+	uint64_t samples;
+	double   start;
 };
 
 struct controller_state
@@ -177,11 +334,52 @@ struct controller_state
 	pthread_mutex_t hop_m;
 };
 
+/* one of many demodulators fed from the same capture */
+struct channel_state
+{
+	uint32_t freq;
+	char     *spec;
+	char     *filename;
+	FILE     *file;
+	struct demod_state *demod;
+	mirisdr_channel_t *ddc;
+	int      lp_scale;      /* float to the level of the boxcar sums */
+	int      chunk;         /* lowpassed values per demod pass */
+};
+
+/* the frequencies in windows of -W, the squelch of all in a window at once */
+struct scan_state
+{
+	uint32_t rate;          /* of the window */
+	int      windows;
+	int      window;        /* tuned */
+	uint32_t center[FREQUENCIES_LIMIT];
+	int      first[FREQUENCIES_LIMIT + 1];  /* frequency index, the window's first */
+	int      bin[FREQUENCIES_LIMIT];        /* of the channelizer, nearest */
+	volatile int pending;   /* the controller is moving the window */
+	int      settle;        /* drain what was queued, then let the filters forget */
+	mirisdr_channelizer_t *z;
+	int      m;
+	double   *power;        /* per bin since the last look */
+	uint32_t *count;
+	int      scale;         /* to the squelch levels of low_pass */
+	int      locked;        /* the frequency being demodulated, -1 none */
+	int      quiet;         /* looks below the squelch */
+	struct channel_state chan;
+	uint64_t moves;
+	double   start;
+};
+
 // multiple of these, eventually
 struct dongle_state dongle;
 struct demod_state demod;
 struct output_state output;
 struct controller_state controller;
+struct input_state input;
+struct channel_state channels[CHANNELS_LIMIT];
+struct scan_state scan;
+int channel_count = 0;
+int channel_threads = 0;
 
 void usage(void)
 {
@@ -228,6 +426,8 @@ void usage(void)
 		"\t    7000000: 7MHz\n"
 		"\t    8000000: 8MHz\n"
 		"\t[-l squelch_level (default: 0/off)]\n"
+		"\t[-n noise_squelch FM, open when the noise above the voice band is\n"
+		"\t    that many dB below no signal at all, e.g. -n -6 (default: off)]\n"
 		//"\t    for fm squelch is inverted\n"
 		"\t[-o oversampling (default: 1, 4 recommended)]\n"
 		"\t[-p ppm_error (default: 0)]\n"
@@ -238,17 +438,40 @@ void usage(void)
 		"\t    deemp:  enable de-emphasis filter\n"
 		"\t    direct: enable direct sampling\n"
 		"\t    offset: enable offset tuning\n"
+		"\t    frontend: rotate and decimate in the library\n"
+		"\t    stereo: wbfm stereo from the 19 kHz pilot, needs -r,\n"
+		"\t            the output is L R interleaved, e.g. play -c 2\n"
 		"\t[-T enable bias-T]\n"
+		"\t[-c freq,filename[,modulation[,squelch_level]] demodulate another channel]\n"
+		"\t    use multiple -c to demodulate many channels at once,\n"
+		"\t    -f is then the capture center (default: the middle)\n"
+		"\t    and -M, -l, -s, -o, -r, -E deemp/dc apply to every channel\n"
+		"\t[-j worker threads for -c (default: 0, one per core)]\n"
+		"\t[-W window scan that wide a band at once and only retune to move it,\n"
+		"\t    the loudest open channel is demodulated, e.g. -W 2M (default: off)]\n"
+		"\t[-X fifo[:prio]|rr[:prio] realtime scheduling of the streaming thread]\n"
+		"\t[-C cpu_list pin the streaming thread, e.g. 2 or 0,2-3]\n"
+		"\t[-L buffers|all lock the sample buffers or the whole process in RAM]\n"
+		"\t[-R filename write the RDS groups of wbfm as hex, '-' means stderr]\n"
+		"\t[-I filename,rate[,cs16|cu8|cf32] demodulate a recording instead (default: cs16)]\n"
+		"\t    as fast as it goes, '-' reads stdin, the recording is centered\n"
+		"\t    on the signal, or on -f for -c\n"
 		"\tfilename ('-' means stdout)\n"
 		"\t    omitting the filename also uses stdout\n\n"
 		"Experimental options:\n"
-		"\t[-r resample_rate (default: none / same as -s)]\n"
+		"\t[-r resample_rate[,poly|farrow|boxcar] (default: none / same as -s)]\n"
+		"\t    poly: L/M polyphase, farrow: any ratio, boxcar: the old one\n"
 		"\t[-t squelch_delay (default: 10)]\n"
 		"\t    +values will mute/scan, -values will exit\n"
 		"\t[-F fir_size (default: off)]\n"
 		"\t    enables low-leakage downsample filter\n"
 		"\t    size can be 0 or 9.  0 has bad roll off\n"
-		"\t[-A std/fast/lut choose atan math (default: std)]\n"
+		"\t[-H channel_taps (default: off, 31 recommended)]\n"
+		"\t    half band cascade and a channel FIR of that many taps\n"
+		"\t[-P int|float the int16 or the float32 DSP chain (default: int)]\n"
+		"\t[-O s16|f32 output samples, f32 needs -P float (default: s16)]\n"
+		"\t[-A std/fast/lut/simd choose atan math (default: std)]\n"
+		"\t[-B benchmark the atan math, decimators, resamplers, int vs float, squelch, stereo and exit]\n"
 		//"\t[-C clip_path (default: off)\n"
 		//"\t (create time stamped raw clips, requires squelch)\n"
 		//"\t (path must have '\%s' and will expand to date_time_freq)\n"
@@ -259,7 +482,8 @@ void usage(void)
 		"\tmiri_fm ... | play -t raw -r 24k -es -b 16 -c 1 -V1 -\n"
 		"\t           | aplay -r 24k -f S16_LE -t raw -c 1\n"
 		"\t  -M wbfm  | play -r 32k ... \n"
-		"\t  -s 22050 | multimon -t raw /dev/stdin\n\n");
+		"\t  -s 22050 | multimon -t raw /dev/stdin\n"
+		"\tmiri_fm -M am -s 12k -l 60 -c 118.1M,twr.raw -c 118.7M,app.raw -c 121.5M,gnd.raw,fm\n\n");
 	exit(1);
 }
 
@@ -285,6 +509,37 @@ static void sighandler(int signum)
 }
 #endif
 
+static double now(void)
+{
+#if !defined (_WIN32) || defined(__MINGW32__)
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#else
+	return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+static void *buf_alloc(size_t size)
+/* cache line aligned, freed by buf_free */
+{
+#if defined(_WIN32)
+	return _aligned_malloc(size, CACHE_LINE);
+#else
+	void *p;
+	return posix_memalign(&p, CACHE_LINE, size) ? NULL : p;
+#endif
+}
+
+static void buf_free(void *p)
+{
+#if defined(_WIN32)
+	_aligned_free(p);
+#else
+	free(p);
+#endif
+}
+
 /* more cond dumbness */
 #define safe_cond_signal(n, m) pthread_mutex_lock(m); pthread_cond_signal(n); pthread_mutex_unlock(m)
 #define safe_cond_wait(n, m) pthread_mutex_lock(m); pthread_cond_wait(n, m); pthread_mutex_unlock(m)
@@ -353,6 +608,7 @@ void low_pass(struct demod_state *d)
 /* simple square window FIR */
 {
 	int i=0, i2=0;
+	long t = 0L, p = 0L;
 	while (i < d->lp_len) {
 		d->now_r += d->lowpassed[i];
 		d->now_j += d->lowpassed[i+1];
@@ -363,12 +619,18 @@ void low_pass(struct demod_state *d)
 		}
 		d->lowpassed[i2]   = d->now_r; // * d->output_scale;
 		d->lowpassed[i2+1] = d->now_j; // * d->output_scale;
+		/* the power squelch rides along */
+		t += d->lowpassed[i2] + d->lowpassed[i2+1];
+		p += (long)d->lowpassed[i2] * d->lowpassed[i2] + (long)d->lowpassed[i2+1] * d->lowpassed[i2+1];
 		d->prev_index = 0;
 		d->now_r = 0;
 		d->now_j = 0;
 		i2 += 2;
 	}
 	d->lp_len = i2;
+	d->sq_sum += (double)t;
+	d->sq_power += (double)p;
+	d->sq_n += i2;
 }
 
 int low_pass_simple(int16_t *signal2, int len, int step)
@@ -465,6 +727,397 @@ void generic_fir(int16_t *data, int length, int *fir, int16_t *hist)
 	}
 }
 
+/* a gain of 2 per stage, the same levels as the fifth order passes */
+static void dec2_quantize(struct dec2_stage *st, double *h, int n, int halfband)
+{
+	int t;
+	double sum = 0.0;
+	for (t = 0; t < n; t++) {
+		sum += h[t];}
+	st->n0 = (n + 1) / 2;
+	for (t = 0; t < n; t += 2) {
+		st->h0[t / 2] = (float)(h[t] / sum * 2.0);}
+	if (halfband) {
+		/* every other tap is zero, only the center is left on the odd side */
+		st->n1 = 1;
+		st->off1 = n / 2 / 2;
+		st->h1[0] = (float)(h[n / 2] / sum * 2.0);
+	} else {
+		st->n1 = n / 2;
+		st->off1 = 0;
+		for (t = 1; t < n; t += 2) {
+			st->h1[t / 2] = (float)(h[t] / sum * 2.0);}
+	}
+	st->span = st->n0 > st->off1 + st->n1 ? st->n0 : st->off1 + st->n1;
+	st->len = 0;
+	st->odd = 0;
+}
+
+/* without the zero end points, they would be wasted taps */
+static double blackman(int t, int n)
+{
+	return 0.42 - 0.5 * cos(2.0 * M_PI * (t + 1) / (n + 1)) + 0.08 * cos(4.0 * M_PI * (t + 1) / (n + 1));
+}
+
+/* fc in cycles per input sample, returns the worst attenuation above stop in dB */
+static double dec2_design(struct dec2_stage *st, int n, double fc, int halfband, double stop)
+{
+	double h[DECIMATOR_MAX_TAPS];
+	double x, f, r, sum = 0.0, worst = 0.0;
+	int t;
+	for (t = 0; t < n; t++) {
+		x = t - (n - 1) / 2.0;
+		h[t] = blackman(t, n) * (x == 0.0 ? 2.0 * fc : sin(2.0 * M_PI * fc * x) / (M_PI * x));
+		if (halfband && x != 0.0 && ((int)fabs(x) % 2) == 0) {
+			h[t] = 0.0;}
+		sum += h[t];
+	}
+	for (f = stop; f <= 0.5; f += 0.001) {
+		r = 0.0;
+		for (t = 0; t < n; t++) {
+			r += h[t] * cos(2.0 * M_PI * f * (t - (n - 1) / 2.0));}
+		if (fabs(r / sum) > worst) {
+			worst = fabs(r / sum);}
+	}
+	dec2_quantize(st, h, n, halfband);
+	st->binomial = 0;
+	return -20.0 * log10(worst + 1e-12);
+}
+
+/* the same for (1 + z^-1)^4, a CIC of one stage of two: at high rates the
+   band is narrow, its zero at half the rate is enough and the taps are constants */
+static double dec2_binomial(struct dec2_stage *st, double stop)
+{
+	double h[5] = {1.0, 4.0, 6.0, 4.0, 1.0};
+	dec2_quantize(st, h, 5, 0);
+	st->binomial = 1;
+	return -80.0 * log10(cos(M_PI * stop));
+}
+
+/* passes stages of two, binomial while they alias little enough, half bands
+   down to twice rate_in, then the channel filter */
+static int decimator_init(struct demod_state *d, int passes)
+{
+	int i, k;
+	double fs;
+	if (passes > DECIMATOR_STAGES) {
+		return -1;}
+	for (i = 0; i < passes; i++) {
+		if (!d->stages[i]) {
+			d->stages[i] = malloc(sizeof(struct dec2_stage));}
+		if (!d->stages[i]) {
+			return -1;}
+		fs = (double)(1 << (passes - i));   /* in units of rate_in */
+		if (i == passes - 1) {
+			dec2_design(d->stages[i], d->channel_taps | 1, 0.225, 0, 0.5);
+		} else if (dec2_binomial(d->stages[i], 0.5 - 0.5 / fs) < DECIMATOR_REJECTION) {
+			/* the shortest 4k+3 half band that keeps the aliases off the output band,
+			   the early ones have a wide transition and get away with few taps */
+			for (k = 1; 4 * k + 3 < DECIMATOR_MAX_TAPS; k++) {
+				if (dec2_design(d->stages[i], 4 * k + 3, 0.25, 1, 0.5 - 0.5 / fs) >= DECIMATOR_REJECTION) {
+					break;}
+			}
+		}
+	}
+	d->stage_count = passes;
+	return 0;
+}
+
+/* bit level selects, a compare and branch would keep the loop scalar */
+static inline int32_t float_bits(float f)
+{
+	int32_t i;
+	memcpy(&i, &f, sizeof(i));
+	return i;
+}
+
+static inline float bits_float(int32_t i)
+{
+	float f;
+	memcpy(&f, &i, sizeof(f));
+	return f;
+}
+
+static inline float select_float(int32_t mask, float a, float b)
+/* mask of all ones picks a */
+{
+	return bits_float((float_bits(a) & mask) | (float_bits(b) & ~mask));
+}
+
+static inline int16_t round16(float f)
+/* lrintf is a call, adding 1.5 * 2^23 leaves the rounded value in the mantissa */
+{
+	int32_t v = float_bits(f + 12582912.0f) - 0x4b400000;
+	return (int16_t)(v > 32767 ? 32767 : v < -32768 ? -32768 : v);
+}
+
+/* one tap pair at a time over DECIMATOR_LANES outputs, few enough to stay in L1,
+   the loop over the outputs is the one that vectorizes */
+static inline void dec2_taps(float *acc, const float *x, const float *h, int taps, int n)
+{
+	const float *a, *b;
+	float w;
+	int u, k;
+	/* the taps are symmetric, one multiply per pair */
+	for (u = 0; u < taps / 2; u++) {
+		a = x + u;
+		b = x + taps - 1 - u;
+		w = h[u];
+		for (k = 0; k < n; k++) {
+			acc[k] += w * (a[k] + b[k]);}
+	}
+	if (taps & 1) {
+		a = x + taps / 2;
+		w = h[taps / 2];
+		for (k = 0; k < n; k++) {
+			acc[k] += w * a[k];}
+	}
+}
+
+static void dec2_fir(float *y, const float *e, const float *o, const struct dec2_stage *st, int m)
+{
+	float acc[DECIMATOR_LANES];
+	int j, k, n;
+	for (j = 0; j < m; j += n) {
+		n = m - j < DECIMATOR_LANES ? m - j : DECIMATOR_LANES;
+		for (k = 0; k < n; k++) {
+			acc[k] = 0.0f;}
+		if (n == DECIMATOR_LANES) {
+			dec2_taps(acc, e + j, st->h0, st->n0, DECIMATOR_LANES);
+			dec2_taps(acc, o + j + st->off1, st->h1, st->n1, DECIMATOR_LANES);
+		} else {
+			dec2_taps(acc, e + j, st->h0, st->n0, n);
+			dec2_taps(acc, o + j + st->off1, st->h1, st->n1, n);
+		}
+		for (k = 0; k < n; k++) {
+			y[j + k] = acc[k];}
+	}
+}
+
+static void dec2_cic(float *y, const float *e, const float *o, int m)
+/* 1 4 6 4 1 over 8, the gain of 2 per stage, one pass and no lanes to keep */
+{
+	int j;
+	for (j = 0; j < m; j++) {
+		y[j] = 0.125f * (e[j] + e[j+2]) + 0.75f * e[j+1] + 0.5f * (o[j] + o[j+1]);}
+}
+
+/* n complex samples into the even and odd planes after the history */
+static void dec2_split16(struct dec2_stage *st, const int16_t *x, int n)
+{
+	float *e0 = st->e[0] + st->len, *e1 = st->e[1] + st->len;
+	float *o0 = st->o[0] + st->len, *o1 = st->o[1] + st->len;
+	int j, p;
+	if (st->odd && n > 0) {
+		*o0++ = x[0];
+		*o1++ = x[1];
+		e0++;
+		e1++;
+		st->len++;
+		st->odd = 0;
+		x += 2;
+		n--;
+	}
+	p = n / 2;
+	for (j = 0; j < p; j++) {
+		e0[j] = x[4*j];
+		e1[j] = x[4*j+1];
+		o0[j] = x[4*j+2];
+		o1[j] = x[4*j+3];
+	}
+	st->len += p;
+	if (n & 1) {
+		e0[p] = x[4*p];
+		e1[p] = x[4*p+1];
+		st->odd = 1;
+	}
+}
+
+/* the same from the planes of the previous stage; the planes are set after
+   the odd sample, moved pointers would keep the loop from vectorizing */
+static void dec2_split(struct dec2_stage *st, const float *xi, const float *xq, int n)
+{
+	float *e0, *e1, *o0, *o1;
+	int j, p, k = 0;
+	if (st->odd && n > 0) {
+		st->o[0][st->len] = xi[0];
+		st->o[1][st->len] = xq[0];
+		st->len++;
+		st->odd = 0;
+		k = 1;
+	}
+	e0 = st->e[0] + st->len;
+	e1 = st->e[1] + st->len;
+	o0 = st->o[0] + st->len;
+	o1 = st->o[1] + st->len;
+	p = (n - k) / 2;
+	for (j = 0; j < p; j++) {
+		e0[j] = xi[k + 2*j];
+		e1[j] = xq[k + 2*j];
+		o0[j] = xi[k + 2*j+1];
+		o1[j] = xq[k + 2*j+1];
+	}
+	st->len += p;
+	if ((n - k) & 1) {
+		e0[p] = xi[k + 2*p];
+		e1[p] = xq[k + 2*p];
+		st->odd = 1;
+	}
+}
+
+/* every complete output into y, returns their count */
+static int dec2_filter(struct dec2_stage *st)
+{
+	int m = st->len - st->span + 1;
+	int c;
+	if (m <= 0) {
+		return 0;}
+	for (c = 0; c < 2; c++) {
+		if (st->binomial) {
+			dec2_cic(st->y[c], st->e[c], st->o[c], m);
+		} else {
+			dec2_fir(st->y[c], st->e[c], st->o[c], st, m);}
+		memmove(st->e[c], st->e[c] + m, (st->span - 1 + st->odd) * sizeof(float));
+		memmove(st->o[c], st->o[c] + m, (st->span - 1) * sizeof(float));
+	}
+	st->len -= m;
+	return m;
+}
+
+/* the power squelch sums on the samples as they come out of the decimation,
+   in float lanes so it vectorizes, every decimator feeds them */
+static void squelch_sums(struct demod_state *d, const float *x, int n, float gain)
+{
+	float t[SQUELCH_LANES] = {0}, p[SQUELCH_LANES] = {0};
+	double ts = 0.0, ps = 0.0;
+	int i, l;
+	for (i = 0; i + SQUELCH_LANES <= n; i += SQUELCH_LANES) {
+		for (l = 0; l < SQUELCH_LANES; l++) {
+			t[l] += x[i+l];
+			p[l] += x[i+l] * x[i+l];
+		}
+	}
+	for (; i < n; i++) {
+		ts += x[i];
+		ps += x[i] * x[i];
+	}
+	for (l = 0; l < SQUELCH_LANES; l++) {
+		ts += t[l];
+		ps += p[l];
+	}
+	d->sq_sum += ts * gain;
+	d->sq_power += ps * gain * gain;
+	d->sq_n += n;
+}
+
+static void squelch_sums16(struct demod_state *d, const int16_t *x, int n)
+/* the int16 samples vectorize as they are, in 64 bit lanes */
+{
+	long t = 0L, p = 0L;
+	int i;
+	for (i = 0; i < n; i++) {
+		t += x[i];
+		p += (long)x[i] * x[i];
+	}
+	d->sq_sum += (double)t;
+	d->sq_power += (double)p;
+	d->sq_n += n;
+}
+
+/* in place, interleaved I/Q, any length, returns the output length;
+   the stages pass floats, only the last one rounds back to int16 */
+static int decimator_run(struct demod_state *d, int16_t *data, int len)
+{
+	struct dec2_stage *st;
+	int pos, n, m, i, j, out = 0;
+	for (pos = 0; pos < len / 2; pos += n) {
+		n = len / 2 - pos;
+		if (n > 2 * DECIMATOR_BLOCK) {
+			n = 2 * DECIMATOR_BLOCK;}
+		st = d->stages[0];
+		dec2_split16(st, data + 2 * pos, n);
+		m = dec2_filter(st);
+		for (i = 1; i < d->stage_count && m; i++) {
+			dec2_split(d->stages[i], st->y[0], st->y[1], m);
+			st = d->stages[i];
+			m = dec2_filter(st);
+		}
+		/* never overtakes the input, the chunk was all copied */
+		for (j = 0; j < m; j++) {
+			data[out + 2*j]   = round16(st->y[0][j]);
+			data[out + 2*j+1] = round16(st->y[1][j]);
+		}
+		if (d->squelch_level) {
+			squelch_sums(d, st->y[0], m, 1.0f);
+			squelch_sums(d, st->y[1], m, 1.0f);
+		}
+		out += 2 * m;
+	}
+	return out;
+}
+
+/* interleaved CF32 into the planes, for the float path */
+static void dec2_split_f(struct dec2_stage *st, const float *x, int n)
+{
+	float *e0 = st->e[0] + st->len, *e1 = st->e[1] + st->len;
+	float *o0 = st->o[0] + st->len, *o1 = st->o[1] + st->len;
+	int j, p;
+	if (st->odd && n > 0) {
+		*o0++ = x[0];
+		*o1++ = x[1];
+		e0++;
+		e1++;
+		st->len++;
+		st->odd = 0;
+		x += 2;
+		n--;
+	}
+	p = n / 2;
+	for (j = 0; j < p; j++) {
+		e0[j] = x[4*j];
+		e1[j] = x[4*j+1];
+		o0[j] = x[4*j+2];
+		o1[j] = x[4*j+3];
+	}
+	st->len += p;
+	if (n & 1) {
+		e0[p] = x[4*p];
+		e1[p] = x[4*p+1];
+		st->odd = 1;
+	}
+}
+
+/* the same cascade in place on CF32, without the gain of 2 per stage */
+static int decimator_run_f(struct demod_state *d, float *data, int len)
+{
+	struct dec2_stage *st;
+	float gain = 1.0f / (float)(1 << d->stage_count);
+	int pos, n, m, i, j, out = 0;
+	for (pos = 0; pos < len / 2; pos += n) {
+		n = len / 2 - pos;
+		if (n > 2 * DECIMATOR_BLOCK) {
+			n = 2 * DECIMATOR_BLOCK;}
+		st = d->stages[0];
+		dec2_split_f(st, data + 2 * pos, n);
+		m = dec2_filter(st);
+		for (i = 1; i < d->stage_count && m; i++) {
+			dec2_split(d->stages[i], st->y[0], st->y[1], m);
+			st = d->stages[i];
+			m = dec2_filter(st);
+		}
+		for (j = 0; j < m; j++) {
+			data[out + 2*j]   = st->y[0][j] * gain;
+			data[out + 2*j+1] = st->y[1][j] * gain;
+		}
+		if (d->squelch_level) {
+			squelch_sums(d, st->y[0], m, gain);
+			squelch_sums(d, st->y[1], m, gain);
+		}
+		out += 2 * m;
+	}
+	return out;
+}
+
 /* define our own complex math ops
    because ARMv5 has no hardware float */
 
@@ -564,29 +1217,88 @@ int polar_disc_lut(int ar, int aj, int br, int bj)
 	return 0;
 }
 
+static inline float atan2_poly(float y, float x)
+/* branch free, max error 1e-5 rad */
+{
+	float ax = fabsf(x), ay = fabsf(y);
+	int32_t swap = -(float_bits(ay) > float_bits(ax));
+	float mn = select_float(swap, ax, ay);
+	float mx = select_float(swap, ay, ax);
+	float a = mn / (mx + 1e-30f);
+	float s = a * a;
+	float r = ((-0.0464964749f * s + 0.15931422f) * s - 0.327622764f) * s * a + a;
+	r = select_float(swap, 1.57079637f - r, r);
+	r = select_float(float_bits(x) >> 31, 3.14159274f - r, r);
+	return bits_float(float_bits(r) ^ (float_bits(y) & (int32_t)0x80000000));
+}
+
+static inline float sin_poly(float x)
+/* |x| up to pi / 2, max error 1e-7 */
+{
+	float s = x * x;
+	return ((((-2.50521084e-8f * s + 2.75573192e-6f) * s - 1.98412698e-4f) * s
+		+ 8.33333333e-3f) * s - 0.166666667f) * s * x + x;
+}
+
+static inline void sincos_poly(float p, float *s, float *c)
+/* branch free, p within [-pi, pi]: cos p = sin(pi/2 - |p|), sin p = sin(pi - |p|) */
+{
+	float a = fabsf(p);
+	float t = select_float(-(a > 1.57079637f), 3.14159274f - a, a);
+	*s = bits_float(float_bits(sin_poly(t)) ^ (float_bits(p) & (int32_t)0x80000000));
+	*c = sin_poly(1.57079637f - a);
+}
+
+int polar_disc_simd(int ar, int aj, int br, int bj)
+{
+	float cr = (float)ar * br + (float)aj * bj;
+	float cj = (float)aj * br - (float)ar * bj;
+	return (int)(atan2_poly(cj, cr) * (float)((1<<14) / M_PI));
+}
+
+void fm_demod_simd(struct demod_state *fm)
+/* no calls and no branches inside, vectorized 8 or 16 samples wide */
+{
+	int i, n = fm->lp_len / 2;
+	const int16_t *lp = fm->lowpassed;
+	int16_t *r = fm->result;
+	const float scale = (float)((1<<14) / M_PI);
+	float cr, cj;
+	r[0] = (int16_t)polar_disc_simd(lp[0], lp[1], fm->pre_r, fm->pre_j);
+	for (i = 1; i < n; i++) {
+		cr = (float)lp[2*i] * lp[2*i-2] + (float)lp[2*i+1] * lp[2*i-1];
+		cj = (float)lp[2*i+1] * lp[2*i-2] - (float)lp[2*i] * lp[2*i-1];
+		r[i] = (int16_t)(atan2_poly(cj, cr) * scale);
+	}
+}
+
 void fm_demod(struct demod_state *fm)
 {
 	int i, pcm;
 	int16_t *lp = fm->lowpassed;
-	pcm = polar_discriminant(lp[0], lp[1],
-		fm->pre_r, fm->pre_j);
-	fm->result[0] = (int16_t)pcm;
-	for (i = 2; i < (fm->lp_len-1); i += 2) {
-		switch (fm->custom_atan) {
-		case 0:
-			pcm = polar_discriminant(lp[i], lp[i+1],
-				lp[i-2], lp[i-1]);
-			break;
-		case 1:
-			pcm = polar_disc_fast(lp[i], lp[i+1],
-				lp[i-2], lp[i-1]);
-			break;
-		case 2:
-			pcm = polar_disc_lut(lp[i], lp[i+1],
+	int (*disc)(int, int, int, int) = polar_discriminant;
+	/* chosen once per buffer, not per sample */
+	switch (fm->custom_atan) {
+	case 1:
+		disc = polar_disc_fast;
+		break;
+	case 2:
+		disc = polar_disc_lut;
+		break;
+	case 3:
+		disc = NULL;
+		fm_demod_simd(fm);
+		break;
+	}
+	if (disc) {
+		pcm = disc(lp[0], lp[1],
+			fm->pre_r, fm->pre_j);
+		fm->result[0] = (int16_t)pcm;
+		for (i = 2; i < (fm->lp_len-1); i += 2) {
+			pcm = disc(lp[i], lp[i+1],
 				lp[i-2], lp[i-1]);
-			break;
+			fm->result[i/2] = (int16_t)pcm;
 		}
-		fm->result[i/2] = (int16_t)pcm;
 	}
 	fm->pre_r = lp[fm->lp_len - 2];
 	fm->pre_j = lp[fm->lp_len - 1];
@@ -643,36 +1355,59 @@ void raw_demod(struct demod_state *fm)
 	fm->result_len = fm->lp_len;
 }
 
+/* de-emphasis, avg += alpha * (x - avg), in blocks of DEEMPH_LANES:
+   y[k] = beta^(k+1) avg + z[k], beta = 1 - alpha, z the filter over the
+   block from rest, the blocks overlap and only the carry is serial */
+
+void deemph_init(struct demod_state *d, double alpha)
+{
+	int k;
+	d->deemph_alpha = (float)alpha;
+	for (k = 0; k < DEEMPH_LANES; k++) {
+		d->deemph_pw[k] = (float)pow(1.0 - alpha, k + 1);}
+}
+
+static inline float deemph_lanes(const struct demod_state *d, const float *x, float *y, float avg)
+{
+	float z[DEEMPH_LANES];
+	int k;
+	z[0] = d->deemph_alpha * x[0];
+	for (k = 1; k < DEEMPH_LANES; k++) {
+		z[k] = d->deemph_pw[0] * z[k-1] + d->deemph_alpha * x[k];}
+	/* the carry last, a block waits on one multiply and add of the one before */
+	for (k = 0; k < DEEMPH_LANES; k++) {
+		y[k] = z[k] + d->deemph_pw[k] * avg;}
+	return y[DEEMPH_LANES - 1];
+}
+
 void deemph_filter(struct demod_state *fm)
 {
-	static int avg;  // cheating...
-	int i, d;
-	// de-emph IIR
-	// avg = avg * (1 - alpha) + sample * alpha;
-	for (i = 0; i < fm->result_len; i++) {
-		d = fm->result[i] - avg;
-		if (d > 0) {
-			avg += (d + fm->deemph_a/2) / fm->deemph_a;
-		} else {
-			avg += (d - fm->deemph_a/2) / fm->deemph_a;
-		}
-		fm->result[i] = (int16_t)avg;
+	float x[DEEMPH_LANES], avg = fm->deemph_avg;
+	int i, k, n = fm->result_len & ~(DEEMPH_LANES - 1);
+	for (i = 0; i < n; i += DEEMPH_LANES) {
+		for (k = 0; k < DEEMPH_LANES; k++) {
+			x[k] = (float)fm->result[i + k];}
+		avg = deemph_lanes(fm, x, x, avg);
+		for (k = 0; k < DEEMPH_LANES; k++) {
+			fm->result[i + k] = round16(x[k]);}
+	}
+	for (; i < fm->result_len; i++) {
+		avg += fm->deemph_alpha * ((float)fm->result[i] - avg);
+		fm->result[i] = round16(avg);
 	}
+	fm->deemph_avg = avg;
 }
 
 void dc_block_filter(struct demod_state *fm)
+/* one pass, the average of the buffers so far is taken off while this one is summed */
 {
-	int i, avg;
+	int i, avg = fm->dc_avg;
 	int64_t sum = 0;
-	for (i=0; i < fm->result_len; i++) {
+	for (i = 0; i < fm->result_len; i++) {
 		sum += fm->result[i];
+		fm->result[i] -= (int16_t)avg;
 	}
-	avg = sum / fm->result_len;
-	avg = (avg + fm->dc_avg * 9) / 10;
-	for (i=0; i < fm->result_len; i++) {
-		fm->result[i] -= avg;
-	}
-	fm->dc_avg = avg;
+	fm->dc_avg = (int)(sum / fm->result_len + avg * 9) / 10;
 }
 
 int mad(int16_t *samples, int len, int step)
@@ -777,12 +1512,227 @@ void arbitrary_resample(int16_t *buf1, int16_t *buf2, int len1, int len2)
 	}
 }
 
-void full_demod(struct demod_state *d)
+static int gcd(int a, int b)
+{
+	int t;
+	while (b) {
+		t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+static double resample_tap(double t, double fc, int taps)
+/* the low pass t input samples away from the output, Blackman over the taps */
+{
+	double w;
+	if (fabs(t) >= taps / 2.0) {
+		return 0.0;}
+	w = 0.42 + 0.5 * cos(2.0 * M_PI * t / taps) + 0.08 * cos(4.0 * M_PI * t / taps);
+	return w * (t == 0.0 ? 2.0 * fc : sin(2.0 * M_PI * fc * t) / (M_PI * t));
+}
+
+static void resample_phase(double *h, double frac, double fc, int taps)
+/* the output frac after sample taps/2 - 1 of the window, unity gain */
+{
+	double sum = 0.0;
+	int k;
+	for (k = 0; k < taps; k++) {
+		h[k] = resample_tap(taps / 2 - 1 + frac - k, fc, taps);
+		sum += h[k];
+	}
+	for (k = 0; k < taps; k++) {
+		h[k] /= sum;}
+}
+
+static void resampler_free(struct resampler *r)
+{
+	if (!r) {
+		return;}
+	free(r->bank);
+	free(r->x);
+	free(r);
+}
+
+static struct resampler *resampler_new(int rate_in, int rate_out, int mode, double stop, int size)
+/* rate_in -> rate_out, up to size inputs at once, stop is where the audio
+   must be gone, 0 for the Nyquist of the lower rate */
+{
+	struct resampler *r;
+	double h[4][RESAMPLE_MAX_TAPS];
+	double ratio, fc, d1, d2, d3;
+	int g, k, p, taps;
+	r = calloc(1, sizeof(struct resampler));
+	if (!r) {
+		return NULL;}
+	g = gcd(rate_in, rate_out);
+	r->up = rate_out / g;
+	r->down = rate_in / g;
+	r->mode = mode;
+	if (r->mode == RESAMPLE_POLY && r->up > RESAMPLE_MAX_PHASES) {
+		fprintf(stderr, "%i/%i would need too many phases, resampling with farrow.\n", r->up, r->down);
+		r->mode = RESAMPLE_FARROW;
+	}
+	/* more taps when decimating, the cutoff follows the lower rate */
+	ratio = (double)rate_in / rate_out;
+	r->taps = (int)ceil(RESAMPLE_ZEROS * (ratio > 1.0 ? ratio : 1.0));
+	fc = 0.45 * (ratio > 1.0 ? 1.0 / ratio : 1.0);
+	if (stop > 0.0 && stop < rate_out) {
+		/* 4 kHz from 15 kHz of audio to the pilot */
+		taps = (int)ceil(5.5 * rate_in / 4000.0);
+		if (taps > r->taps) {
+			r->taps = taps;}
+		if ((stop - 2000.0) / rate_in < fc) {
+			fc = (stop - 2000.0) / rate_in;}
+	}
+	r->taps = (r->taps + RESAMPLE_LANES - 1) / RESAMPLE_LANES * RESAMPLE_LANES;
+	if (r->taps > RESAMPLE_MAX_TAPS) {
+		r->taps = RESAMPLE_MAX_TAPS;}
+	r->step = ratio;
+	r->x = calloc((size_t)(r->taps - 1 + size), sizeof(float));
+	r->bank = malloc((size_t)(r->mode == RESAMPLE_POLY ? r->up : 4) * r->taps * sizeof(float));
+	if (!r->x || !r->bank) {
+		resampler_free(r);
+		return NULL;
+	}
+	if (r->mode == RESAMPLE_POLY) {
+		for (p = 0; p < r->up; p++) {
+			resample_phase(h[0], (double)p / r->up, fc, r->taps);
+			for (k = 0; k < r->taps; k++) {
+				r->bank[p * r->taps + k] = (float)h[0][k];}
+		}
+	} else {
+		/* every tap a cubic in mu through the exact taps at mu = 0, 1/3, 2/3, 1 */
+		for (p = 0; p < 4; p++) {
+			resample_phase(h[p], p / 3.0, fc, r->taps);}
+		for (k = 0; k < r->taps; k++) {
+			d1 = h[1][k] - h[0][k];
+			d2 = h[2][k] - 2.0 * h[1][k] + h[0][k];
+			d3 = h[3][k] - 3.0 * h[2][k] + 3.0 * h[1][k] - h[0][k];
+			r->bank[k]               = (float)h[0][k];
+			r->bank[r->taps + k]     = (float)(3.0 * (d1 - d2 / 2.0 + d3 / 3.0));
+			r->bank[2 * r->taps + k] = (float)(9.0 * (d2 - d3) / 2.0);
+			r->bank[3 * r->taps + k] = (float)(27.0 * d3 / 6.0);
+		}
+	}
+	return r;
+}
+
+int resampler_init(struct demod_state *d)
+/* rate_out -> rate_out2, nothing to do for boxcar */
+{
+	d->resampler = NULL;
+	if (d->rate_out2 <= 0 || d->resample_mode == RESAMPLE_BOXCAR) {
+		return 0;}
+	d->resampler = resampler_new(d->rate_out, d->rate_out2, d->resample_mode, 0.0, d->result_size);
+	return d->resampler ? 0 : -1;
+}
+
+static inline float resample_dot(const float *h, const float *x, int taps)
+/* RESAMPLE_LANES partial sums, one float sum would stay scalar */
+{
+	float acc[RESAMPLE_LANES] = {0.0f};
+	float sum = 0.0f;
+	int k, l;
+	for (k = 0; k < taps; k += RESAMPLE_LANES) {
+		for (l = 0; l < RESAMPLE_LANES; l++) {
+			acc[l] += h[k + l] * x[k + l];}
+	}
+	for (l = 0; l < RESAMPLE_LANES; l++) {
+		sum += acc[l];}
+	return sum;
+}
+
+static inline float resample_step(struct resampler *r)
+/* the output at pos, then the time base moves on */
+{
+	const float *x = r->x + r->pos;
+	float y, v0, v1, v2, v3;
+	int adv;
+	if (r->mode == RESAMPLE_POLY) {
+		y = resample_dot(r->bank + r->phase * r->taps, x, r->taps);
+		r->phase += r->down;
+		r->pos += r->phase / r->up;
+		r->phase %= r->up;
+	} else {
+		v0 = resample_dot(r->bank, x, r->taps);
+		v1 = resample_dot(r->bank + r->taps, x, r->taps);
+		v2 = resample_dot(r->bank + 2 * r->taps, x, r->taps);
+		v3 = resample_dot(r->bank + 3 * r->taps, x, r->taps);
+		y = ((v3 * (float)r->mu + v2) * (float)r->mu + v1) * (float)r->mu + v0;
+		r->mu += r->step;
+		adv = (int)r->mu;
+		r->pos += adv;
+		r->mu -= adv;
+	}
+	return y;
+}
+
+static void resample_shift(struct resampler *r, int len)
+/* keep the history for the next buffer */
+{
+	memmove(r->x, r->x + len, (r->taps - 1) * sizeof(float));
+	r->pos -= len;
+}
+
+int resample_size(struct demod_state *d, int len)
+/* what the result of len lowpassed values can take, it only grows when resampled up */
+{
+	int up = 1;
+	if (d->rate_out2 > d->rate_out && d->resample_mode != RESAMPLE_BOXCAR) {
+		up = (d->rate_out2 + d->rate_out - 1) / d->rate_out;}
+	/* L and R, interleaved */
+	return d->stereo ? 2 * (len * up + 1) : len * up + 1;
+}
+
+void resample(struct demod_state *d)
+/* result at rate_out -> result at rate_out2 */
+{
+	struct resampler *r = d->resampler;
+	float *x = r->x + r->taps - 1;
+	float y;
+	int i, n = 0, total = r->taps - 1 + d->result_len;
+	for (i = 0; i < d->result_len; i++) {
+		x[i] = d->result[i];}
+	while (r->pos + r->taps <= total) {
+		y = resample_step(r);
+		/* the buffer was sized for the ratio, this is a safety net */
+		if (n < d->result_size) {
+			d->result[n++] = round16(y);}
+	}
+	resample_shift(r, d->result_len);
+	d->result_len = n;
+}
+
+static int resample_block(struct resampler *r, const float *in, int len, float *out, int stride, int size)
+/* every stride-th of out, at most size, in and out may be the same */
+{
+	int n = 0, total = r->taps - 1 + len;
+	float y;
+	memcpy(r->x + r->taps - 1, in, len * sizeof(float));
+	while (r->pos + r->taps <= total) {
+		y = resample_step(r);
+		if (n < size) {
+			out[stride * n++] = y;}
+	}
+	resample_shift(r, len);
+	return n;
+}
+
+void resample_f(struct demod_state *d)
+{
+	d->result_len = resample_block(d->resampler, d->result_f, d->result_len, d->result_f, 1, d->result_size);
+}
+
+void decimate(struct demod_state *d)
+/* capture rate -> rate_in, in place */
 {
 	int i, ds_p;
-	int sr = 0;
 	ds_p = d->downsample_passes;
-	if (ds_p) {
+	if (d->stage_count) {
+		d->lp_len = decimator_run(d, d->lowpassed, d->lp_len);
+	} else if (ds_p) {
 		for (i=0; i < ds_p; i++) {
 			fifth_order(d->lowpassed,   (d->lp_len >> i), d->lp_i_hist[i]);
 			fifth_order(d->lowpassed+1, (d->lp_len >> i) - 1, d->lp_q_hist[i]);
@@ -798,22 +1748,114 @@ void full_demod(struct demod_state *d)
 	} else {
 		low_pass(d);
 	}
-	/* power squelch */
-	if (d->squelch_level) {
-		sr = rms(d->lowpassed, d->lp_len, 1);
-		if (sr < d->squelch_level) {
-			d->squelch_hits++;
-			for (i=0; i<d->lp_len; i++) {
-				d->lowpassed[i] = 0;
-			}
-		} else {
-			d->squelch_hits = 0;}
-	}
-	d->mode_demod(d);  /* lowpassed -> result */
-	if (d->mode_demod == &raw_demod) {
-		return;
-	}
-	/* todo, fm noise squelch */
+}
+
+static int squelch_rms(struct demod_state *d)
+/* rms() of the lowpassed samples from the sums of the decimation */
+{
+	double v;
+	if (!d->sq_n) {
+		return 0;}
+	v = (d->sq_power - d->sq_sum * d->sq_sum / d->sq_n) / d->sq_n;
+	return (int)sqrt(v > 0.0 ? v : 0.0);
+}
+
+static double noise_db(double power)
+{
+	return 10.0 * log10(power + 1e-20) - NOISE_SQUELCH_REF;
+}
+
+static double noise_lanes(const float *t, int n)
+/* the second difference squared and summed over n samples after the two of t,
+   a block of differences first, then squared and summed in lanes like squelch_sums */
+{
+	float e[NOISE_BLOCK], acc[SQUELCH_LANES] = {0};
+	double sum = 0.0;
+	int b, j, l, m;
+	for (b = 0; b < n; b += m) {
+		m = n - b < NOISE_BLOCK ? n - b : NOISE_BLOCK;
+		for (j = 0; j < m; j++) {
+			e[j] = t[b+j+2] - 2.0f * t[b+j+1] + t[b+j];}
+		for (j = 0; j + SQUELCH_LANES <= m; j += SQUELCH_LANES) {
+			for (l = 0; l < SQUELCH_LANES; l++) {
+				acc[l] += e[j+l] * e[j+l];}
+		}
+		for (; j < m; j++) {
+			sum += e[j] * e[j];}
+	}
+	for (l = 0; l < SQUELCH_LANES; l++) {
+		sum += acc[l];}
+	return sum;
+}
+
+static double noise_power(struct demod_state *d)
+/* mean square of the second difference of the discriminator, mostly what is
+   above the voice band; a block at a time to float, then the float lanes */
+{
+	const int16_t *x = d->result;
+	float t[NOISE_BLOCK + 2];
+	double sum = 0.0;
+	int i, j, m, n = d->result_len;
+	if (n < 2) {
+		return 0.0;}
+	t[0] = d->noise_hist[0];
+	t[1] = d->noise_hist[1];
+	for (i = 0; i < n; i += m) {
+		m = n - i < NOISE_BLOCK ? n - i : NOISE_BLOCK;
+		for (j = 0; j < m; j++) {
+			t[j+2] = x[i+j];}
+		sum += noise_lanes(t, m);
+		t[0] = t[m];
+		t[1] = t[m+1];
+	}
+	d->noise_hist[0] = t[0];
+	d->noise_hist[1] = t[1];
+	/* pi is 1<<14 */
+	return sum / n / ((double)(1<<14) * (1<<14));
+}
+
+static int squelch_closed(struct demod_state *d)
+/* silence instead of demodulating, 1 when nothing is left to do */
+{
+	int raw = d->mode_demod == &raw_demod;
+	d->squelch_hits++;
+	if (d->squelch_hits > d->conseq_squelch) {
+		/* muted or hopping, nobody takes the result */
+		d->result_len = 0;
+		return 1;
+	}
+	d->result_len = raw ? d->lp_len : d->lp_len / 2;
+	if (d->use_float) {
+		memset(d->result_f, 0, (size_t)d->result_len * sizeof(float));
+	} else {
+		memset(d->result, 0, (size_t)d->result_len * sizeof(int16_t));}
+	return raw;
+}
+
+void full_demod(struct demod_state *d)
+{
+	d->sq_n = 0;
+	d->sq_sum = d->sq_power = 0.0;
+	decimate(d);
+	/* power squelch, the sums came with the decimation unless it was -F */
+	if (d->squelch_level && !d->sq_n) {
+		squelch_sums16(d, d->lowpassed, d->lp_len);}
+	if (d->squelch_level && squelch_rms(d) < d->squelch_level) {
+		if (squelch_closed(d)) {
+			return;}
+	} else {
+		d->mode_demod(d);  /* lowpassed -> result */
+		if (d->mode_demod == &raw_demod) {
+			return;
+		}
+		/* noise squelch, before the post filters smooth it away */
+		if (d->noise_squelch && d->mode_demod == &fm_demod &&
+		    noise_db(noise_power(d)) > d->noise_level) {
+			if (squelch_closed(d)) {
+				return;}
+		} else {
+			d->squelch_hits = 0;}
+	}
 	// use nicer filter here too?
 	if (d->post_downsample > 1) {
 		d->result_len = low_pass_simple(d->result, d->result_len, d->post_downsample);}
@@ -821,24 +1863,557 @@ void full_demod(struct demod_state *d)
 		deemph_filter(d);}
 	if (d->dc_block) {
 		dc_block_filter(d);}
-	if (d->rate_out2 > 0) {
+	if (d->resampler) {
+		resample(d);
+	} else if (d->rate_out2 > 0) {
 		low_pass_real(d);
-		//arbitrary_resample(d->result, d->result, d->result_len, d->result_len * d->rate_out2 / d->rate_out);
 	}
 }
 
+/* the float path, the same stages on CF32 with full scale 1.0;
+   no per stage scaling, the levels stay put */
+
+void low_pass_f(struct demod_state *d)
+/* the boxcar, averaged */
+{
+	int i = 0, i2 = 0;
+	float scale = 1.0f / d->downsample;
+	double t = 0.0, p = 0.0;
+	while (i < d->lp_len) {
+		d->now_rf += d->lowpassed_f[i];
+		d->now_jf += d->lowpassed_f[i+1];
+		i += 2;
+		d->prev_index++;
+		if (d->prev_index < d->downsample) {
+			continue;
+		}
+		d->lowpassed_f[i2]   = d->now_rf * scale;
+		d->lowpassed_f[i2+1] = d->now_jf * scale;
+		t += d->lowpassed_f[i2] + d->lowpassed_f[i2+1];
+		p += d->lowpassed_f[i2] * d->lowpassed_f[i2] + d->lowpassed_f[i2+1] * d->lowpassed_f[i2+1];
+		d->prev_index = 0;
+		d->now_rf = 0.0f;
+		d->now_jf = 0.0f;
+		i2 += 2;
+	}
+	d->lp_len = i2;
+	d->sq_sum += t;
+	d->sq_power += p;
+	d->sq_n += i2;
+}
+
+int low_pass_simple_f(float *signal, int len, int step)
+{
+	int i, i2;
+	float sum;
+	for (i = 0; i + step <= len; i += step) {
+		sum = 0.0f;
+		for (i2 = 0; i2 < step; i2++) {
+			sum += signal[i + i2];}
+		signal[i / step] = sum / step;
+	}
+	return len / step;
+}
+
+void fm_demod_f(struct demod_state *fm)
+/* radians / pi, std takes the libm atan2, the others the polynomial */
+{
+	int i, n = fm->lp_len / 2;
+	const float *lp = fm->lowpassed_f;
+	float *r = fm->result_f;
+	float cr, cj;
+	if (!n) {
+		return;}
+	cr = lp[0] * fm->pre_rf + lp[1] * fm->pre_jf;
+	cj = lp[1] * fm->pre_rf - lp[0] * fm->pre_jf;
+	r[0] = atan2_poly(cj, cr) * (float)(1.0 / M_PI);
+	if (fm->custom_atan == 0) {
+		for (i = 1; i < n; i++) {
+			cr = lp[2*i] * lp[2*i-2] + lp[2*i+1] * lp[2*i-1];
+			cj = lp[2*i+1] * lp[2*i-2] - lp[2*i] * lp[2*i-1];
+			r[i] = atan2f(cj, cr) * (float)(1.0 / M_PI);
+		}
+	} else {
+		for (i = 1; i < n; i++) {
+			cr = lp[2*i] * lp[2*i-2] + lp[2*i+1] * lp[2*i-1];
+			cj = lp[2*i+1] * lp[2*i-2] - lp[2*i] * lp[2*i-1];
+			r[i] = atan2_poly(cj, cr) * (float)(1.0 / M_PI);
+		}
+	}
+	fm->pre_rf = lp[2*n-2];
+	fm->pre_jf = lp[2*n-1];
+	fm->result_len = n;
+}
+
+void am_demod_f(struct demod_state *fm)
+{
+	int i;
+	const float *lp = fm->lowpassed_f;
+	for (i = 0; i < fm->lp_len / 2; i++) {
+		fm->result_f[i] = sqrtf(lp[2*i] * lp[2*i] + lp[2*i+1] * lp[2*i+1]);}
+	fm->result_len = fm->lp_len / 2;
+}
+
+void ssb_demod_f(struct demod_state *fm, float sign)
+{
+	int i;
+	const float *lp = fm->lowpassed_f;
+	for (i = 0; i < fm->lp_len / 2; i++) {
+		fm->result_f[i] = lp[2*i] + sign * lp[2*i+1];}
+	fm->result_len = fm->lp_len / 2;
+}
+
+void raw_demod_f(struct demod_state *fm)
+{
+	memcpy(fm->result_f, fm->lowpassed_f, fm->lp_len * sizeof(float));
+	fm->result_len = fm->lp_len;
+}
+
+static float deemph_run(struct demod_state *d, float *x, int len, float avg)
+/* in place, returns the new state */
+{
+	int i, n = len & ~(DEEMPH_LANES - 1);
+	for (i = 0; i < n; i += DEEMPH_LANES) {
+		avg = deemph_lanes(d, x + i, x + i, avg);}
+	for (; i < len; i++) {
+		avg += d->deemph_alpha * (x[i] - avg);
+		x[i] = avg;
+	}
+	return avg;
+}
+
+void deemph_filter_f(struct demod_state *fm)
+{
+	fm->deemph_avg = deemph_run(fm, fm->result_f, fm->result_len, fm->deemph_avg);
+}
+
+void dc_block_filter_f(struct demod_state *fm)
+{
+	float sum[SQUELCH_LANES] = {0.0f}, avg = fm->dc_avg_f;
+	int i, k, n = fm->result_len & ~(SQUELCH_LANES - 1);
+	for (i = 0; i < n; i += SQUELCH_LANES) {
+		for (k = 0; k < SQUELCH_LANES; k++) {
+			sum[k] += fm->result_f[i + k];
+			fm->result_f[i + k] -= avg;
+		}
+	}
+	for (; i < fm->result_len; i++) {
+		sum[0] += fm->result_f[i];
+		fm->result_f[i] -= avg;
+	}
+	for (k = 1; k < SQUELCH_LANES; k++) {
+		sum[0] += sum[k];}
+	fm->dc_avg_f = (sum[0] / fm->result_len + avg * 9.0f) / 10.0f;
+}
+
+/* wbfm stereo and RDS, on the composite after post_downsample
+ *
+ * The PLL is updated once per STEREO_BLOCK samples, within a block the
+ * pilot runs at a fixed frequency, so its sine and cosine vectorize.
+ * With the pilot at cos p the subcarriers are -sin 2p for L-R and
+ * cos 3p or sin 3p for RDS; RDS bits last 16 pilot cycles. */
+
+static int stereo_init(struct demod_state *d)
+{
+	struct stereo *st;
+	double h[RESAMPLE_MAX_TAPS], wn, f;
+	int rate = d->rate_out, k;
+	st = calloc(1, sizeof(struct stereo));
+	d->mpx = st;
+	if (!st) {
+		return -1;}
+	st->freq0 = st->freq = 2.0 * M_PI * PILOT_HZ / rate;
+	st->bound = 2.0 * M_PI;
+	/* the demodulator gives radians / pi per sample at rate_in */
+	st->lock_level = (float)(2.0 * PILOT_LOCK_HZ / d->rate_in);
+	st->lose_level = (float)(2.0 * PILOT_LOSE_HZ / d->rate_in);
+	st->last_type = -1;
+	/* 20 Hz loop, damping 0.707 */
+	wn = 2.0 * M_PI * 20.0 * STEREO_BLOCK / rate;
+	st->kp = 1.414 * wn;
+	st->ki = wn * wn / STEREO_BLOCK;
+	/* low_pass_simple_f loses 0.7 dB at 38 kHz for -o 4, only 28 dB separation left */
+	f = M_PI * 2.0 * PILOT_HZ / d->rate_in;
+	st->diff_gain = (float)(4.0 * d->post_downsample * sin(f) / sin(f * d->post_downsample));
+	if (d->stereo) {
+		st->left = resampler_new(rate, d->rate_out2, d->resample_mode, PILOT_HZ, d->result_size);
+		st->right = resampler_new(rate, d->rate_out2, d->resample_mode, PILOT_HZ, d->result_size);
+		st->l = buf_alloc((size_t)d->result_size * sizeof(float));
+		st->r = buf_alloc((size_t)d->result_size * sizeof(float));
+		if (!st->left || !st->right || !st->l || !st->r) {
+			return -1;}
+	}
+	if (!d->rds_filename) {
+		return 0;}
+	st->rds = strcmp(d->rds_filename, "-") == 0 ? stderr : fopen(d->rds_filename, "w");
+	if (!st->rds) {
+		fprintf(stderr, "Failed to open %s\n", d->rds_filename);
+		return -1;
+	}
+	st->rds_taps = (int)ceil(5.5 * rate / RDS_CUTOFF);
+	st->rds_taps = (st->rds_taps + RESAMPLE_LANES - 1) / RESAMPLE_LANES * RESAMPLE_LANES;
+	if (st->rds_taps > RESAMPLE_MAX_TAPS) {
+		st->rds_taps = RESAMPLE_MAX_TAPS;}
+	st->rds_h = buf_alloc((size_t)st->rds_taps * sizeof(float));
+	st->rds_i = buf_alloc((size_t)(st->rds_taps - 1 + d->result_size) * sizeof(float));
+	st->rds_q = buf_alloc((size_t)(st->rds_taps - 1 + d->result_size) * sizeof(float));
+	st->cycles = malloc((size_t)d->result_size * sizeof(int));
+	if (!st->rds_h || !st->rds_i || !st->rds_q || !st->cycles) {
+		return -1;}
+	resample_phase(h, 0.0, RDS_CUTOFF / rate, st->rds_taps);
+	for (k = 0; k < st->rds_taps; k++) {
+		st->rds_h[k] = (float)h[k];}
+	memset(st->rds_i, 0, (size_t)(st->rds_taps - 1) * sizeof(float));
+	memset(st->rds_q, 0, (size_t)(st->rds_taps - 1) * sizeof(float));
+	return 0;
+}
+
+static void stereo_free(struct demod_state *d)
+{
+	struct stereo *st = d->mpx;
+	if (!st) {
+		return;}
+	resampler_free(st->left);
+	resampler_free(st->right);
+	buf_free(st->l);
+	buf_free(st->r);
+	if (st->rds && st->rds != stderr) {
+		fclose(st->rds);}
+	buf_free(st->rds_h);
+	buf_free(st->rds_i);
+	buf_free(st->rds_q);
+	free(st->cycles);
+	free(st);
+	d->mpx = NULL;
+}
+
+static int rds_block(int syndrome)
+/* the offset word, C' counts as C */
+{
+	switch (syndrome) {
+	case 0x0fc:
+		return 0;
+	case 0x198:
+		return 1;
+	case 0x168:
+	case 0x350:
+		return 2;
+	case 0x1b4:
+		return 3;
+	default:
+		return -1;
+	}
+}
+
+static int rds_syndrome(uint32_t w)
+/* the 26 bits modulo x^10 + x^8 + x^7 + x^5 + x^4 + x^3 + 1, the offset word when intact */
+{
+	int i;
+	for (i = 25; i >= 10; i--) {
+		if (w & (1u << i)) {
+			w ^= 0x5b9u << (i - 10);}
+	}
+	return (int)(w & 0x3ff);
+}
+
+static void rds_group(struct stereo *st)
+/* hex, ---- for a block that failed its check */
+{
+	int i;
+	if (!st->good[0] && !st->good[1] && !st->good[2] && !st->good[3]) {
+		return;}
+	for (i = 0; i < 4; i++) {
+		if (st->good[i]) {
+			fprintf(st->rds, "%04X", st->group[i]);
+		} else {
+			fprintf(st->rds, "----");}
+		fputc(i < 3 ? ' ' : '\n', st->rds);
+		st->good[i] = 0;
+	}
+	fflush(st->rds);
+	st->groups++;
+}
+
+static void rds_bit(struct stereo *st, int bit)
+{
+	int type;
+	st->reg = ((st->reg << 1) | (uint32_t)bit) & 0x3ffffff;
+	st->bits++;
+	if (!st->synced) {
+		/* two blocks in a row, 26 bits apart */
+		type = rds_block(rds_syndrome(st->reg));
+		if (type < 0) {
+			return;}
+		if (st->last_type < 0 || st->bits != 26 || type != ((st->last_type + 1) & 3)) {
+			st->last_type = type;
+			st->bits = 0;
+			return;
+		}
+		st->synced = 1;
+		st->expect = type;
+		st->bad = 0;
+	} else if (st->bits < 26) {
+		return;
+	} else {
+		type = rds_block(rds_syndrome(st->reg));}
+	st->bits = 0;
+	st->group[st->expect] = (uint16_t)(st->reg >> 10);
+	st->good[st->expect] = type == st->expect;
+	st->bad = type == st->expect ? 0 : st->bad + 1;
+	if (st->expect == 3) {
+		rds_group(st);}
+	st->expect = (st->expect + 1) & 3;
+	if (st->bad > RDS_LOST) {
+		st->synced = 0;
+		st->last_type = -1;
+	}
+}
+
+static void rds_sample(struct stereo *st, float zi, float zq)
+/* one per pilot cycle: BPSK carrier from its square, biphase bits of 16 samples */
+{
+	float a, v, sum = 0.0f;
+	int j, o;
+	st->carrier_i += (zi * zi - zq * zq - st->carrier_i) * (1.0f / 256.0f);
+	st->carrier_q += (2.0f * zi * zq - st->carrier_q) * (1.0f / 256.0f);
+	a = 0.5f * atan2f(st->carrier_q, st->carrier_i);
+	v = zi * cosf(a) + zq * sinf(a);
+	st->chips[st->count & 15] = v;
+	st->count++;
+	/* the first half of the bit against the second */
+	for (j = 0; j < 16; j++) {
+		v = st->chips[(st->count + j) & 15];
+		sum += j < 8 ? v : -v;
+	}
+	o = st->count & 15;
+	st->energy[o] += (sum * sum - st->energy[o]) * (1.0f / 64.0f);
+	if (o != st->timing) {
+		return;}
+	j = sum > 0.0f;
+	rds_bit(st, j ^ st->sign);
+	st->sign = j;
+	/* the bit edge where the halves differ most */
+	for (j = 0; j < 16; j++) {
+		if (st->energy[j] > 1.2f * st->energy[st->timing]) {
+			st->timing = j;}
+	}
+}
+
+static void stereo_f(struct demod_state *d)
+/* the PLL and RDS on the composite, for stereo the audio is replaced by L R */
+{
+	struct stereo *st = d->mpx;
+	float *x = d->result_f;
+	float ai[8], aq[8], p, p0, w, e, g, m, c3, s3, mag;
+	int n = d->result_len, b, k, l, len, cycles = 0, taps = st->rds_taps;
+	for (b = 0; b < n; b += STEREO_BLOCK) {
+		len = n - b < STEREO_BLOCK ? n - b : STEREO_BLOCK;
+		p0 = (float)st->phase;
+		w = (float)st->freq;
+		for (k = 0; k < len; k++) {
+			p = p0 + k * w;
+			/* to [-pi, pi], rounded like round16 */
+			p -= 6.28318531f * ((p * 0.159154943f + 12582912.0f) - 12582912.0f);
+			sincos_poly(p, &st->s[k], &st->c[k]);
+		}
+		for (l = 0; l < 8; l++) {
+			ai[l] = aq[l] = 0.0f;}
+		for (k = 0; k + 8 <= len; k += 8) {
+			for (l = 0; l < 8; l++) {
+				ai[l] += x[b + k + l] * st->c[k + l];
+				aq[l] += x[b + k + l] * st->s[k + l];
+			}
+		}
+		for (; k < len; k++) {
+			ai[0] += x[b + k] * st->c[k];
+			aq[0] += x[b + k] * st->s[k];
+		}
+		if (d->stereo) {
+			/* L = sum + diff and R = sum - diff, 2L and 2R like mono's L + R */
+			g = st->locked ? st->diff_gain : 0.0f;
+			for (k = 0; k < len; k++) {
+				m = g * st->s[k] * st->c[k];
+				st->l[b + k] = x[b + k] * (1.0f - m);
+				st->r[b + k] = x[b + k] * (1.0f + m);
+			}
+		}
+		if (st->rds) {
+			/* shifted by pi / 4, the phase from the square never wraps */
+			for (k = 0; k < len; k++) {
+				c3 = st->c[k] * (4.0f * st->c[k] * st->c[k] - 3.0f);
+				s3 = st->s[k] * (3.0f - 4.0f * st->s[k] * st->s[k]);
+				st->rds_i[taps - 1 + b + k] = x[b + k] * (c3 - s3) * 0.707106781f;
+				st->rds_q[taps - 1 + b + k] = -x[b + k] * (s3 + c3) * 0.707106781f;
+			}
+			for (k = 0; k < len; k++) {
+				if (st->phase + k * st->freq >= st->bound) {
+					st->cycles[cycles++] = b + k;
+					st->bound += 2.0 * M_PI;
+				}
+			}
+		}
+		/* the pilot A cos(q): I = A cos(q - p), Q = -A sin(q - p) */
+		for (l = 1; l < 8; l++) {
+			ai[0] += ai[l];
+			aq[0] += aq[l];
+		}
+		ai[0] *= 2.0f / len;
+		aq[0] *= 2.0f / len;
+		st->pilot_i += (ai[0] - st->pilot_i) * 0.01f;
+		st->pilot_q += (aq[0] - st->pilot_q) * 0.01f;
+		mag = sqrtf(ai[0] * ai[0] + aq[0] * aq[0]);
+		st->pilot_mag += (mag - st->pilot_mag) * 0.01f;
+		e = st->pilot_mag > 0.0f ? -aq[0] / st->pilot_mag : 0.0f;
+		e = e > 1.0f ? 1.0f : e < -1.0f ? -1.0f : e;
+		st->phase += len * st->freq + st->kp * e;
+		st->freq += st->ki * e;
+		if (fabs(st->freq - st->freq0) > st->freq0 * 0.01) {
+			st->freq = st->freq0;}
+		while (st->phase >= 2.0 * M_PI) {
+			st->phase -= 2.0 * M_PI;
+			st->bound -= 2.0 * M_PI;
+		}
+		while (st->phase < 0.0) {
+			st->phase += 2.0 * M_PI;
+			st->bound += 2.0 * M_PI;
+		}
+		if (!st->locked && st->pilot_i > st->lock_level && fabsf(st->pilot_q) < 0.3f * st->pilot_i) {
+			st->locked = 1;
+			fprintf(stderr, "Stereo pilot locked.\n");
+		} else if (st->locked && (st->pilot_i < st->lose_level || fabsf(st->pilot_q) > 0.5f * st->pilot_i)) {
+			st->locked = 0;
+			fprintf(stderr, "Stereo pilot lost.\n");
+		}
+	}
+	if (st->rds) {
+		/* each cycle end is the newest sample of the RDS filter */
+		for (k = 0; k < cycles; k++) {
+			if (st->locked) {
+				rds_sample(st, resample_dot(st->rds_h, st->rds_i + st->cycles[k], taps),
+					resample_dot(st->rds_h, st->rds_q + st->cycles[k], taps));}
+		}
+		memmove(st->rds_i, st->rds_i + n, (size_t)(taps - 1) * sizeof(float));
+		memmove(st->rds_q, st->rds_q + n, (size_t)(taps - 1) * sizeof(float));
+	}
+	if (!d->stereo) {
+		return;}
+	if (d->deemph) {
+		d->deemph_avg = deemph_run(d, st->l, n, d->deemph_avg);
+		st->deemph_r = deemph_run(d, st->r, n, st->deemph_r);
+	}
+	k = resample_block(st->left, st->l, n, x, 2, d->result_size / 2);
+	resample_block(st->right, st->r, n, x + 1, 2, d->result_size / 2);
+	d->result_len = 2 * k;
+}
+
+static double noise_power_f(struct demod_state *d)
+/* noise_power() on the float result, pi is 1.0 */
+{
+	const float *x = d->result_f;
+	float e;
+	double sum = 0.0;
+	int n = d->result_len;
+	if (n < 2) {
+		return 0.0;}
+	e = x[0] - 2.0f * d->noise_hist[1] + d->noise_hist[0];
+	sum += e * e;
+	e = x[1] - 2.0f * x[0] + d->noise_hist[1];
+	sum += e * e;
+	/* the history is in the result itself from there on */
+	sum += noise_lanes(x, n - 2);
+	d->noise_hist[0] = x[n-2];
+	d->noise_hist[1] = x[n-1];
+	return sum / n;
+}
+
+void full_demod_f(struct demod_state *d)
+{
+	double v = 0.0;
+	d->sq_n = 0;
+	d->sq_sum = d->sq_power = 0.0;
+	if (d->stage_count) {
+		d->lp_len = decimator_run_f(d, d->lowpassed_f, d->lp_len);
+	} else {
+		low_pass_f(d);
+	}
+	if (d->squelch_level) {
+		/* in the units of the int path, so -l means the same */
+		v = d->sq_n ? (d->sq_power - d->sq_sum * d->sq_sum / d->sq_n) / d->sq_n : 0.0;
+		v = sqrt(v > 0.0 ? v : 0.0) * d->level_f;
+	}
+	if (d->squelch_level && v < d->squelch_level) {
+		if (squelch_closed(d)) {
+			return;}
+	} else {
+		if (d->mode_demod == &fm_demod) {
+			fm_demod_f(d);
+		} else if (d->mode_demod == &am_demod) {
+			am_demod_f(d);
+		} else if (d->mode_demod == &usb_demod) {
+			ssb_demod_f(d, 1.0f);
+		} else if (d->mode_demod == &lsb_demod) {
+			ssb_demod_f(d, -1.0f);
+		} else {
+			raw_demod_f(d);
+			return;
+		}
+		if (d->noise_squelch && d->mode_demod == &fm_demod &&
+		    noise_db(noise_power_f(d)) > d->noise_level) {
+			if (squelch_closed(d)) {
+				return;}
+		} else {
+			d->squelch_hits = 0;}
+	}
+	if (d->post_downsample > 1) {
+		d->result_len = low_pass_simple_f(d->result_f, d->result_len, d->post_downsample);}
+	if (d->mpx) {
+		stereo_f(d);
+		if (d->stereo) {
+			return;}
+	}
+	if (d->deemph) {
+		deemph_filter_f(d);}
+	if (d->dc_block) {
+		dc_block_filter_f(d);}
+	if (d->resampler) {
+		resample_f(d);}
+}
+
+void result_to_s16(struct demod_state *d)
+{
+	int i;
+	for (i = 0; i < d->result_len; i++) {
+		d->result[i] = round16(d->result_f[i] * 32767.0f);}
+}
+
 static void mirisdr_callback(unsigned char *buf, uint32_t len, void *ctx)
 {
 	int i;
 	struct dongle_state *s = ctx;
 	char *buf8 = (char*) buf;
+	int16_t *buf16 = (int16_t*) buf;
+	struct pipe_buffer *b;
+	/* the front end always hands over 16 bit samples */
+	int s8 = dongle.format == 1 && !s->fe_decim;
 	if (do_exit) {
 		return;}
 	if (!ctx) {
 		return;}
 	struct demod_state *d = s->demod_target;
+	if (len > (uint32_t)(s8 ? d->in.size : 2 * d->in.size)) {
+		/* bigger than any transfer the buffers were sized for, checked before
+		   the pop: only the demod thread may push to the empty queue */
+		d->in.overruns++;
+		return;
+	}
+	b = queue_pop(&d->in.empty);
+	if (!b) {
+		/* demod is behind, drop this one rather than overwrite */
+		d->in.overruns++;
+		return;
+	}
 	if (s->mute) {
-		if (dongle.format == 1) {
+		if (s8) {
 			for (i=0; i<s->mute; i++) {
 				buf[i] = 0;}
 		} else {
@@ -847,62 +2422,280 @@ static void mirisdr_callback(unsigned char *buf, uint32_t len, void *ctx)
 		}
 		s->mute = 0;
 	}
-	if (!s->offset_tuning) {
-		if (dongle.format == 1) {
+	if (!s->offset_tuning && !s->fe_decim && !s->full_scale) {
+		if (s8) {
 			rotate_90_s8((char*) buf, len);
 		} else {
 			rotate_90_s16((short*) buf, len >> 1);
 		}
 	}
-	if (dongle.format == 1) {
+	/* straight into the buffer handed to demod */
+	if (s->full_scale) {
+		if (s8) {
+			for (i=0; i<(int)len; i++) {
+				b->data[i] = (int16_t)(buf8[i] * 256);}
+		} else {
+			len>>= 1;
+			memcpy(b->data, buf16, len * sizeof(int16_t));
+		}
+	} else if (d->use_float) {
+		if (s8) {
+			for (i=0; i<(int)len; i++) {
+				b->f[i] = buf8[i] * (1.0f / 128.0f);}
+		} else {
+			len>>= 1;
+			for (i=0; i<(int)len; i++) {
+				b->f[i] = buf16[i] * (1.0f / 32768.0f);}
+		}
+	} else if (s8) {
 		for (i=0; i<(int)len; i++) {
-			s->buf16[i] = (int16_t)buf8[i];
+			b->data[i] = (int16_t)buf8[i];
 		}
-	} else {
-		memcpy(s->buf16, buf, len);
+	} else if (!s->fe_decim) {
 		len>>= 1;
 		for (i = 0; i<(int)len; i++) {
 			/* other parts doesn't expect full short range */
-			s->buf16[i] = (int16_t)s->buf16[i] / 128;
+			b->data[i] = buf16[i] / 128;
+		}
+	} else {
+		/* keep the level of the boxcar sums in low_pass */
+		len>>= 1;
+		for (i = 0; i<(int)len; i++) {
+			b->data[i] = buf16[i] / (128 / s->fe_decim);
 		}
 	}
-	pthread_rwlock_wrlock(&d->rw);
-	memcpy(d->lowpassed, s->buf16, 2*len);
-	d->lp_len = len;
-	pthread_rwlock_unlock(&d->rw);
-	safe_cond_signal(&d->ready, &d->ready_m);
+	b->len = (int)len;
+	queue_push(&d->in.full, b);
 }
 
 static void *dongle_thread_fn(void *arg)
 {
 	struct dongle_state *s = arg;
-	mirisdr_read_async(s->dev, mirisdr_callback, s,
+	/* the channels are fed by the library, no callback needed */
+	mirisdr_read_async(s->dev, channel_count ? NULL : mirisdr_callback, s,
 		DEFAULT_ASYNC_BUF_NUMBER, s->buf_len);
 	return 0;
 }
 
+static int input_sample_size(int format)
+/* bytes per I/Q pair */
+{
+	switch (format) {
+	case INPUT_CU8:
+		return 2;
+	case INPUT_CF32:
+		return 8;
+	default:
+		return 4;
+	}
+}
+
+static int input_open(struct input_state *s)
+{
+#ifndef _WIN32
+	struct stat st;
+	int fd;
+#endif
+	s->map = NULL;
+	s->raw = NULL;
+	s->file = NULL;
+	s->pos = 0;
+	s->iq = NULL;
+	if (channel_count) {
+		s->iq = buf_alloc((size_t)ACTUAL_BUF_LENGTH * sizeof(int16_t));
+		if (!s->iq) {
+			return -1;}
+	}
+	if (strcmp(s->filename, "-") == 0) {
+		s->file = stdin;
+#if defined (_WIN32) && !defined(__MINGW32__)
+		_setmode(_fileno(s->file), _O_BINARY);
+#endif
+	} else {
+#ifndef _WIN32
+		/* a regular file is mapped, the page cache is read in place */
+		fd = open(s->filename, O_RDONLY);
+		if (fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+			s->map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (s->map == MAP_FAILED) {
+				s->map = NULL;
+			} else {
+				s->map_len = (size_t)st.st_size;
+				madvise(s->map, s->map_len, MADV_SEQUENTIAL);
+			}
+		}
+		if (fd >= 0) {
+			close(fd);}
+		if (s->map) {
+			return 0;}
+#endif
+		s->file = fopen(s->filename, "rb");
+	}
+	if (!s->file) {
+		fprintf(stderr, "Failed to open %s\n", s->filename);
+		return -1;
+	}
+	s->raw = buf_alloc((size_t)ACTUAL_BUF_LENGTH / 2 * (size_t)input_sample_size(s->format));
+	return s->raw ? 0 : -1;
+}
+
+static void input_close(struct input_state *s)
+{
+#ifndef _WIN32
+	if (s->map) {
+		munmap(s->map, s->map_len);}
+#endif
+	if (s->file && s->file != stdin) {
+		fclose(s->file);}
+	buf_free(s->raw);
+	buf_free(s->iq);
+}
+
+static int input_read(struct input_state *s, int len, unsigned char **raw)
+/* up to len values, I and Q counted separately */
+{
+	size_t size = (size_t)input_sample_size(s->format);
+	size_t want = (size_t)len / 2;
+	if (s->map) {
+		if (want > (s->map_len - s->pos) / size) {
+			want = (s->map_len - s->pos) / size;}
+		*raw = s->map + s->pos;
+		s->pos += want * size;
+		return (int)want * 2;
+	}
+	*raw = s->raw;
+	return (int)fread(s->raw, size, want, s->file) * 2;
+}
+
+static void input_convert(struct input_state *s, const unsigned char *raw, int len,
+	struct pipe_buffer *b, int use_float)
+/* the same levels as mirisdr_callback, 1/128 of full scale for int */
+{
+	const int16_t *cs16 = (const int16_t *)raw;
+	const float *cf32 = (const float *)raw;
+	int i;
+	switch (s->format) {
+	case INPUT_CU8:
+		if (use_float) {
+			for (i = 0; i < len; i++) {
+				b->f[i] = (raw[i] - 127.5f) * (1.0f / 128.0f);}
+		} else {
+			for (i = 0; i < len; i++) {
+				b->data[i] = (int16_t)(raw[i] - 128);}
+		}
+		break;
+	case INPUT_CF32:
+		if (use_float) {
+			memcpy(b->f, cf32, (size_t)len * sizeof(float));
+		} else {
+			for (i = 0; i < len; i++) {
+				b->data[i] = round16(cf32[i] * 256.0f);}
+		}
+		break;
+	default:
+		if (use_float) {
+			for (i = 0; i < len; i++) {
+				b->f[i] = cs16[i] * (1.0f / 32768.0f);}
+		} else {
+			for (i = 0; i < len; i++) {
+				b->data[i] = cs16[i] / 128;}
+		}
+		break;
+	}
+}
+
+static const int16_t *input_cs16(struct input_state *s, const unsigned char *raw, int len)
+/* the down converters take CS16 */
+{
+	const float *cf32 = (const float *)raw;
+	int i;
+	switch (s->format) {
+	case INPUT_CU8:
+		for (i = 0; i < len; i++) {
+			s->iq[i] = (int16_t)((raw[i] - 128) * 256);}
+		return s->iq;
+	case INPUT_CF32:
+		for (i = 0; i < len; i++) {
+			s->iq[i] = round16(cf32[i] * 32767.0f);}
+		return s->iq;
+	default:
+		return (const int16_t *)raw;
+	}
+}
+
+static void *input_thread_fn(void *arg)
+{
+	struct input_state *s = arg;
+	struct demod_state *d = &demod;
+	struct pipe_buffer *b;
+	unsigned char *raw;
+	const int16_t *iq;
+	int i, len;
+	s->start = now();
+	while (!do_exit) {
+		len = input_read(s, ACTUAL_BUF_LENGTH, &raw);
+		if (len <= 0) {
+			break;}
+		s->samples += (uint64_t)len / 2;
+		if (channel_count) {
+			/* on this thread, one channel after the other */
+			iq = input_cs16(s, raw, len);
+			for (i = 0; i < channel_count; i++) {
+				mirisdr_channel_process(channels[i].ddc, iq, (uint32_t)len / 2);}
+			continue;
+		}
+		/* nothing is dropped, wait for demod */
+		b = queue_pop_wait(&d->in.empty);
+		if (!b) {
+			break;}
+		input_convert(s, raw, len, b, d->use_float);
+		b->len = len;
+		queue_push(&d->in.full, b);
+	}
+	s->eof = !do_exit;
+	do_exit = 1;
+	return 0;
+}
+
 static void *demod_thread_fn(void *arg)
 {
 	struct demod_state *d = arg;
 	struct output_state *o = d->output_target;
-	while (!do_exit) {
-		safe_cond_wait(&d->ready, &d->ready_m);
-		pthread_rwlock_wrlock(&d->rw);
-		full_demod(d);
-		pthread_rwlock_unlock(&d->rw);
+	struct pipe_buffer *in, *out = NULL;
+	/* runs until the dongle is gone and everything queued is done */
+	while ((in = queue_pop_wait(&d->in.full)) != NULL) {
+		/* a squelched result buffer is kept for the next round */
+		if (!out) {
+			out = o->in.wait ? queue_pop_wait(&o->in.empty) : queue_pop(&o->in.empty);}
+		if (!out) {
+			o->in.overruns++;
+			queue_push(&d->in.empty, in);
+			continue;
+		}
+		d->lowpassed = in->data;
+		d->lowpassed_f = in->f;
+		d->lp_len = in->len;
+		d->result = out->data;
+		d->result_f = out->f;
+		if (d->use_float) {
+			full_demod_f(d);
+			if (!o->f32) {
+				result_to_s16(d);}
+		} else {
+			full_demod(d);
+		}
+		queue_push(&d->in.empty, in);
 		if (d->exit_flag) {
 			do_exit = 1;
 		}
-		if (d->squelch_level && d->squelch_hits > d->conseq_squelch) {
+		if ((d->squelch_level || d->noise_squelch) && d->squelch_hits > d->conseq_squelch) {
 			d->squelch_hits = d->conseq_squelch + 1;  /* hair trigger */
 			safe_cond_signal(&controller.hop, &controller.hop_m);
 			continue;
 		}
-		pthread_rwlock_wrlock(&o->rw);
-		memcpy(o->result, d->result, 2*d->result_len);
-		o->result_len = d->result_len;
-		pthread_rwlock_unlock(&o->rw);
-		safe_cond_signal(&o->ready, &o->ready_m);
+		out->len = d->result_len;
+		queue_push(&o->in.full, out);
+		out = NULL;
 	}
 	return 0;
 }
@@ -910,12 +2703,471 @@ static void *demod_thread_fn(void *arg)
 static void *output_thread_fn(void *arg)
 {
 	struct output_state *s = arg;
-	while (!do_exit) {
-		// use timedwait and pad out under runs
-		safe_cond_wait(&s->ready, &s->ready_m);
-		pthread_rwlock_rdlock(&s->rw);
-		fwrite(s->result, 2, s->result_len, s->file);
-		pthread_rwlock_unlock(&s->rw);
+	struct pipe_buffer *b;
+	// pad out under runs
+	while ((b = queue_pop_wait(&s->in.full)) != NULL) {
+		if (s->f32) {
+			fwrite(b->f, 4, b->len, s->file);
+		} else {
+			fwrite(b->data, 2, b->len, s->file);}
+		queue_push(&s->in.empty, b);
+	}
+	return 0;
+}
+
+static int demod_mode(struct demod_state *d, char *mode)
+{
+	if (strcmp("fm",  mode) == 0) {
+		d->mode_demod = &fm_demod;}
+	else if (strcmp("raw",  mode) == 0) {
+		d->mode_demod = &raw_demod;}
+	else if (strcmp("am",  mode) == 0) {
+		d->mode_demod = &am_demod;}
+	else if (strcmp("usb", mode) == 0) {
+		d->mode_demod = &usb_demod;}
+	else if (strcmp("lsb", mode) == 0) {
+		d->mode_demod = &lsb_demod;}
+	else {
+		return -1;}
+	return 0;
+}
+
+static void channel_demod(struct channel_state *c)
+{
+	struct demod_state *d = c->demod;
+	if (d->use_float) {
+		full_demod_f(d);
+	} else {
+		full_demod(d);}
+	d->lp_len = 0;
+	if ((d->squelch_level || d->noise_squelch) && d->squelch_hits > d->conseq_squelch) {
+		d->squelch_hits = d->conseq_squelch + 1;  /* muted */
+		return;
+	}
+	if (output.f32) {
+		fwrite(d->result_f, 4, d->result_len, c->file);
+		return;
+	}
+	if (d->use_float) {
+		result_to_s16(d);}
+	fwrite(d->result, 2, d->result_len, c->file);
+}
+
+/* runs on a worker thread of the library, one channel is never run twice at once */
+static void channel_callback(const float *iq, uint32_t len, void *ctx)
+{
+	struct channel_state *c = ctx;
+	struct demod_state *d = c->demod;
+	uint32_t i;
+	float v;
+	if (do_exit) {
+		return;}
+	if (d->use_float) {
+		for (i = 0; i < 2 * len; i++) {
+			d->lowpassed_f[d->lp_len++] = iq[i];
+			if (d->lp_len >= c->chunk) {
+				channel_demod(c);}
+		}
+		return;
+	}
+	for (i = 0; i < 2 * len; i++) {
+		v = iq[i] * c->lp_scale;
+		if (v > 32767.0f) {
+			v = 32767.0f;}
+		if (v < -32767.0f) {
+			v = -32767.0f;}
+		d->lowpassed[d->lp_len++] = (int16_t)lrintf(v);
+		if (d->lp_len >= c->chunk) {
+			channel_demod(c);}
+	}
+}
+
+/* freq,filename[,modulation[,squelch_level]] */
+static int channel_parse(struct channel_state *c, struct demod_state *d)
+{
+	char *freq, *mode, *squelch;
+	freq = c->spec;
+	c->filename = strchr(freq, ',');
+	if (!c->filename) {
+		return -1;}
+	*c->filename++ = '\0';
+	mode = strchr(c->filename, ',');
+	if (mode) {
+		*mode++ = '\0';
+		squelch = strchr(mode, ',');
+		if (squelch) {
+			*squelch++ = '\0';
+			d->squelch_level = (int)atof(squelch);
+		}
+		if (demod_mode(d, mode) < 0) {
+			return -1;}
+	}
+	c->freq = (uint32_t)atofs(freq);
+	return c->freq && c->filename[0] ? 0 : -1;
+}
+
+static void input_rates(struct demod_state *d, int decim)
+/* the recording's rate rarely divides, the resampler brings the rest back */
+{
+	int wanted = d->rate_out;
+	d->rate_in = (int)(input.rate / (uint32_t)decim);
+	d->rate_out = d->rate_in / d->post_downsample;
+	if (d->rate_out != wanted && d->rate_out2 <= 0) {
+		d->rate_out2 = wanted;
+		output.rate = wanted;
+	}
+}
+
+static int channel_alloc(struct channel_state *c)
+/* everything set on the command line, the state starts fresh */
+{
+	struct demod_state *d = malloc(sizeof(struct demod_state));
+	c->demod = d;
+	if (!d) {
+		return -1;}
+	memcpy(d, &demod, sizeof(struct demod_state));
+	d->lowpassed = NULL;
+	d->result = NULL;
+	d->lowpassed_f = NULL;
+	d->result_f = NULL;
+	d->resampler = NULL;
+	return 0;
+}
+
+static int channel_setup(struct channel_state *c, int decim)
+/* the same levels as low_pass summing decim samples of 1/128 of full scale */
+{
+	struct demod_state *d = c->demod;
+	int scale = decim < 127 ? decim : 127;
+	d->downsample = 1;
+	d->downsample_passes = 0;
+	d->output_scale = (1<<15) / (128 * scale);
+	if (d->output_scale < 1 || d->mode_demod == &fm_demod) {
+		d->output_scale = 1;}
+	d->lp_len = 0;
+	d->squelch_hits = d->conseq_squelch + 1;
+	if (input.filename) {
+		input_rates(d, decim);}
+	c->lp_scale = 256 * scale;
+	d->level_f = c->lp_scale;
+	/* the buffers hold one chunk, sized once the rates are known */
+	c->chunk = 1024 * d->post_downsample;
+	d->result_size = resample_size(d, c->chunk);
+	d->lowpassed = buf_alloc((size_t)c->chunk * sizeof(int16_t));
+	d->result = buf_alloc((size_t)d->result_size * sizeof(int16_t));
+	if (!d->lowpassed || !d->result) {
+		return -1;}
+	if (d->use_float) {
+		d->lowpassed_f = buf_alloc((size_t)c->chunk * sizeof(float));
+		d->result_f = buf_alloc((size_t)d->result_size * sizeof(float));
+		if (!d->lowpassed_f || !d->result_f) {
+			return -1;}
+	}
+	if (resampler_init(d) < 0) {
+		return -1;}
+	return 0;
+}
+
+static void channel_free(struct channel_state *c)
+{
+	if (c->ddc) {
+		mirisdr_channel_destroy(c->ddc);}
+	c->ddc = NULL;
+	if (c->demod) {
+		buf_free(c->demod->lowpassed);
+		buf_free(c->demod->result);
+		buf_free(c->demod->lowpassed_f);
+		buf_free(c->demod->result_f);
+		resampler_free(c->demod->resampler);
+	}
+	free(c->demod);
+	c->demod = NULL;
+}
+
+/* one wide capture, every channel gets its own down converter and demodulator */
+static int channels_init(void)
+{
+	struct channel_state *c;
+	struct demod_state *d;
+	uint32_t lo = UINT32_MAX, hi = 0, center;
+	uint64_t need;
+	int64_t reach;
+	int i, decim;
+
+	for (i = 0; i < channel_count; i++) {
+		c = &channels[i];
+		if (channel_alloc(c) < 0) {
+			return -1;}
+		d = c->demod;
+		if (channel_parse(c, d) < 0) {
+			fprintf(stderr, "Bad channel, use -c freq,filename[,modulation[,squelch_level]]\n");
+			return -1;
+		}
+		if (c->freq < lo) {
+			lo = c->freq;}
+		if (c->freq > hi) {
+			hi = c->freq;}
+	}
+
+	center = controller.freq_len ? controller.freqs[0] : lo + (hi - lo) / 2;
+	if (input.filename) {
+		/* the recording is what it is */
+		dongle.freq = center;
+		dongle.rate = input.rate;
+		decim = (int)(input.rate / (uint32_t)demod.rate_in);
+		if (decim < 1) {
+			fprintf(stderr, "The channels can't be faster than the recording.\n");
+			return -1;
+		}
+		goto rate_set;
+	}
+	reach = llabs((int64_t)hi - center) > llabs((int64_t)lo - center) ?
+		llabs((int64_t)hi - center) : llabs((int64_t)lo - center);
+	/* room for the transition band of the outermost channels */
+	need = (uint64_t)reach * 2 + 2 * (uint64_t)demod.rate_in;
+	if (need < MINIMUM_CAPTURE_RATE) {
+		need = MINIMUM_CAPTURE_RATE;}
+	decim = (int)((need + demod.rate_in - 1) / demod.rate_in);
+	if ((uint64_t)decim * demod.rate_in > MAXIMUM_CAPTURE_RATE) {
+		fprintf(stderr, "Channels span too wide, the capture would need %u Hz.\n", (uint32_t)need);
+		return -1;
+	}
+	dongle.freq = center;
+	dongle.rate = (uint32_t)decim * demod.rate_in;
+
+rate_set:
+	for (i = 0; i < channel_count; i++) {
+		c = &channels[i];
+		d = c->demod;
+		if (channel_setup(c, decim) < 0) {
+			return -1;}
+
+		if (strcmp(c->filename, "-") == 0) {
+			c->file = stdout;
+#if defined (_WIN32) && !defined(__MINGW32__)
+			_setmode(_fileno(c->file), _O_BINARY);
+#endif
+		} else {
+			c->file = fopen(c->filename, "wb");
+			if (!c->file) {
+				fprintf(stderr, "Failed to open %s\n", c->filename);
+				return -1;
+			}
+		}
+
+		if (mirisdr_channel_create(&c->ddc, dongle.rate, (int32_t)((int64_t)c->freq - center),
+			0, (uint32_t)d->rate_in, channel_callback, c) < 0 ||
+		    (dongle.dev && mirisdr_add_channel(dongle.dev, c->ddc) < 0)) {
+			fprintf(stderr, "Failed to set up the channel at %u Hz.\n", c->freq);
+			return -1;
+		}
+		fprintf(stderr, "Channel %u Hz, offset %i Hz -> %s\n",
+			c->freq, (int32_t)((int64_t)c->freq - center), c->filename);
+	}
+
+	if (dongle.dev) {
+		mirisdr_set_channel_threads(dongle.dev, channel_threads);}
+	return 0;
+}
+
+static void channels_cleanup(void)
+{
+	int i;
+	for (i = 0; i < channel_count; i++) {
+		if (channels[i].file && channels[i].file != stdout) {
+			fclose(channels[i].file);}
+		channel_free(&channels[i]);
+	}
+}
+
+static int freq_compare(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+/* runs on the scan thread inside mirisdr_channelizer_process */
+static void scan_power(int channel, const float *iq, uint32_t len, void *ctx)
+{
+	struct scan_state *s = ctx;
+	uint32_t i;
+	float p = 0.0f;
+	for (i = 0; i < 2 * len; i++) {
+		p += iq[i] * iq[i];}
+	s->power[channel] += p;
+	s->count[channel] += len;
+}
+
+static int scan_init(void)
+/* windows as wide as -W over the sorted frequencies, a bin per frequency */
+{
+	struct scan_state *s = &scan;
+	uint32_t *f = controller.freqs;
+	uint32_t step = UINT32_MAX, span, lo;
+	int n = controller.freq_len;
+	int i, w, decim;
+
+	qsort(f, (size_t)n, sizeof(uint32_t), freq_compare);
+	for (i = 1; i < n; i++) {
+		if (f[i] > f[i-1] && f[i] - f[i-1] < step) {
+			step = f[i] - f[i-1];}
+	}
+	decim = (int)((s->rate + demod.rate_in - 1) / demod.rate_in);
+	s->rate = (uint32_t)decim * demod.rate_in;
+	if (s->rate < MINIMUM_CAPTURE_RATE || s->rate > MAXIMUM_CAPTURE_RATE) {
+		fprintf(stderr, "The scan window must be between %i and %i Hz.\n",
+			MINIMUM_CAPTURE_RATE, MAXIMUM_CAPTURE_RATE);
+		return -1;
+	}
+	if (step > s->rate / 4) {
+		fprintf(stderr, "The frequencies are too far apart for a window of %u Hz.\n", s->rate);
+		return -1;
+	}
+	if (s->rate <= 2 * (uint64_t)demod.rate_in + step) {
+		fprintf(stderr, "A window of %u Hz has no room for channels of %i Hz.\n",
+			s->rate, demod.rate_in);
+		return -1;
+	}
+	/* room for the outermost channels, DC half a step off a channel */
+	span = s->rate - 2 * (uint32_t)demod.rate_in - step;
+
+	s->windows = 0;
+	for (i = 0; i < n; ) {
+		lo = f[i];
+		s->first[s->windows] = i;
+		while (i < n && f[i] - lo <= span) {
+			i++;}
+		s->center[s->windows] = lo + (f[i-1] - lo) / 2 + step / 2;
+		s->windows++;
+	}
+	s->first[s->windows] = n;
+
+	/* bins no wider than the channels */
+	s->m = 2;
+	while ((uint32_t)s->m < s->rate / step && s->m < 4096) {
+		s->m *= 2;}
+	for (w = 0; w < s->windows; w++) {
+		for (i = s->first[w]; i < s->first[w+1]; i++) {
+			s->bin[i] = (int)lround(((double)f[i] - s->center[w]) * s->m / s->rate) & (s->m - 1);}
+	}
+	s->power = calloc((size_t)s->m, sizeof(double));
+	s->count = calloc((size_t)s->m, sizeof(uint32_t));
+	if (!s->power || !s->count ||
+	    mirisdr_channelizer_create(&s->z, (uint32_t)s->m, 0, scan_power, s) < 0) {
+		return -1;}
+	for (i = s->first[0]; i < s->first[1]; i++) {
+		mirisdr_channelizer_select(s->z, s->bin[i], 1);}
+
+	/* one demodulator, moved to whatever is open */
+	if (channel_alloc(&s->chan) < 0 || channel_setup(&s->chan, decim) < 0) {
+		return -1;}
+	s->chan.demod->squelch_level = 0;
+	s->scale = decim < 127 ? decim : 127;
+	s->locked = -1;
+	s->window = 0;
+	dongle.full_scale = 1;
+	fprintf(stderr, "Scanning %i frequencies in %i windows of %u Hz, %i bins of %u Hz.\n",
+		n, s->windows, s->rate, s->m, s->rate / (uint32_t)s->m);
+	return 0;
+}
+
+static void scan_cleanup(void)
+{
+	if (scan.z) {
+		mirisdr_channelizer_destroy(scan.z);}
+	channel_free(&scan.chan);
+	free(scan.power);
+	free(scan.count);
+}
+
+static int scan_level(struct scan_state *s, int i)
+/* what rms() would give on the lowpassed samples */
+{
+	int k = s->bin[i];
+	if (!s->count[k]) {
+		return 0;}
+	return (int)(sqrt(s->power[k] / s->count[k] / 2.0) * 256.0 * s->scale);
+}
+
+static void scan_look(struct scan_state *s)
+/* stay on an open channel, else take the loudest one, else move on */
+{
+	struct channel_state *c = &s->chan;
+	int i, level, best = -1, best_level = 0;
+	if (s->locked >= 0) {
+		s->quiet = scan_level(s, s->locked) < demod.squelch_level ? s->quiet + 1 : 0;
+		if (s->quiet > demod.conseq_squelch) {
+			mirisdr_channel_destroy(c->ddc);
+			c->ddc = NULL;
+			s->locked = -1;
+		}
+	}
+	if (s->locked < 0) {
+		for (i = s->first[s->window]; i < s->first[s->window + 1]; i++) {
+			level = scan_level(s, i);
+			if (level >= demod.squelch_level && level > best_level) {
+				best = i;
+				best_level = level;
+			}
+		}
+		if (best >= 0 && mirisdr_channel_create(&c->ddc, s->rate,
+			(int32_t)((int64_t)controller.freqs[best] - s->center[s->window]),
+			0, (uint32_t)c->demod->rate_in, channel_callback, c) == 0) {
+			c->freq = controller.freqs[best];
+			c->file = output.file;
+			c->demod->lp_len = 0;
+			s->locked = best;
+			s->quiet = 0;
+		}
+	}
+	memset(s->power, 0, (size_t)s->m * sizeof(double));
+	memset(s->count, 0, (size_t)s->m * sizeof(uint32_t));
+	if (s->locked < 0 && s->windows > 1) {
+		s->pending = 1;
+		s->settle = 2;
+		s->moves++;
+		safe_cond_signal(&controller.hop, &controller.hop_m);
+	}
+}
+
+static void *scan_thread_fn(void *arg)
+/* instead of demod_thread_fn, the same pipe of full scale S16 */
+{
+	struct demod_state *d = arg;
+	struct scan_state *s = &scan;
+	struct pipe_buffer *in;
+	int i;
+	s->start = now();
+	while ((in = queue_pop_wait(&d->in.full)) != NULL) {
+		if (s->pending) {
+			/* signals get lost while the controller is busy */
+			safe_cond_signal(&controller.hop, &controller.hop_m);
+			queue_push(&d->in.empty, in);
+			continue;
+		}
+		if (s->settle == 2) {
+			/* queued before the retune */
+			do {
+				queue_push(&d->in.empty, in);
+			} while ((in = queue_pop(&d->in.full)) != NULL);
+			for (i = 0; i < s->m; i++) {
+				mirisdr_channelizer_select(s->z, i, 0);}
+			for (i = s->first[s->window]; i < s->first[s->window + 1]; i++) {
+				mirisdr_channelizer_select(s->z, s->bin[i], 1);}
+			s->settle = 1;
+			continue;
+		}
+		mirisdr_channelizer_process(s->z, in->data, (uint32_t)in->len / 2);
+		if (s->chan.ddc) {
+			mirisdr_channel_process(s->chan.ddc, in->data, (uint32_t)in->len / 2);}
+		queue_push(&d->in.empty, in);
+		if (s->settle) {
+			memset(s->power, 0, (size_t)s->m * sizeof(double));
+			memset(s->count, 0, (size_t)s->m * sizeof(uint32_t));
+			s->settle = 0;
+			continue;
+		}
+		scan_look(s);
 	}
 	return 0;
 }
@@ -925,7 +3177,7 @@ static void optimal_settings(int freq, int rate)
 	// giant ball of hacks
 	// seems unable to do a single pass, 2:1
 (void) rate;
-	int capture_freq, capture_rate;
+	int capture_freq, capture_rate, passes;
 	struct dongle_state *d = &dongle;
 	struct demod_state *dm = &demod;
 	struct controller_state *cs = &controller;
@@ -934,20 +3186,70 @@ static void optimal_settings(int freq, int rate)
 		dm->downsample_passes = (int)log2(dm->downsample) + 1;
 		dm->downsample = 1 << dm->downsample_passes;
 	}
+	if (dm->channel_taps) {
+		passes = (int)log2(dm->downsample) + 1;
+		dm->downsample = 1 << passes;
+		/* the rate never changes, only the first call designs */
+		if (dm->stage_count != passes && decimator_init(dm, passes) < 0) {
+			fprintf(stderr, "Failed to set up the decimator.\n");
+			exit(1);
+		}
+	}
+	d->fe_decim = 0;
+	if (d->frontend && !dm->downsample_passes && !dm->channel_taps) {
+		/* the library takes the largest power of two, the rest stays here */
+		d->fe_decim = 1;
+		while (d->fe_decim * 2 <= dm->downsample && d->fe_decim < 64) {
+			d->fe_decim *= 2;}
+		dm->downsample = (dm->downsample + d->fe_decim - 1) / d->fe_decim * d->fe_decim;
+	}
 	capture_freq = freq;
 	capture_rate = dm->downsample * dm->rate_in;
 	if (!d->offset_tuning) {
 		capture_freq = freq + capture_rate/4;}
 	capture_freq += cs->edge * dm->rate_in / 2;
+	dm->level_f = 256.0f * dm->downsample;
 	dm->output_scale = (1<<15) / (128 * dm->downsample);
 	if (dm->output_scale < 1) {
 		dm->output_scale = 1;}
 	if (dm->mode_demod == &fm_demod) {
 		dm->output_scale = 1;}
+	if (d->fe_decim) {
+		dm->downsample /= d->fe_decim;}
 	d->freq = (uint32_t)capture_freq;
 	d->rate = (uint32_t)capture_rate;
 }
 
+static void input_settings(void)
+/* optimal_settings for a recording, the rate is given and nothing is tuned */
+{
+	struct demod_state *dm = &demod;
+	int passes = 0;
+	dm->downsample = (int)(input.rate / (uint32_t)dm->rate_in);
+	if (dm->downsample < 1) {
+		dm->downsample = 1;}
+	if (dm->downsample_passes || dm->channel_taps) {
+		while (2 << passes <= dm->downsample) {
+			passes++;}
+		dm->downsample = 1 << passes;
+	}
+	if (dm->downsample_passes) {
+		dm->downsample_passes = passes;}
+	if (dm->channel_taps && passes && decimator_init(dm, passes) < 0) {
+		fprintf(stderr, "Failed to set up the decimator.\n");
+		exit(1);
+	}
+	if (dm->channel_taps && !passes) {
+		dm->channel_taps = 0;}
+	input_rates(dm, dm->downsample);
+	dm->level_f = 256.0f * dm->downsample;
+	dm->output_scale = (1<<15) / (128 * dm->downsample);
+	if (dm->output_scale < 1) {
+		dm->output_scale = 1;}
+	if (dm->mode_demod == &fm_demod) {
+		dm->output_scale = 1;}
+}
+
 static void *controller_thread_fn(void *arg)
 {
 	// thoughts for multiple dongles
@@ -955,13 +3257,24 @@ static void *controller_thread_fn(void *arg)
 	int i;
 	struct controller_state *s = arg;
 
-	if (s->wb_mode) {
+	if (s->wb_mode && !channel_count && !scan.rate) {
 		for (i=0; i < s->freq_len; i++) {
 			s->freqs[i] += 16000;}
 	}
 
-	/* set up primary channel */
-	optimal_settings(s->freqs[0], demod.rate_in);
+	/* set up primary channel, the channels already chose the capture */
+	if (scan.rate) {
+		dongle.freq = scan.center[0];
+		dongle.rate = scan.rate;
+	} else if (!channel_count) {
+		optimal_settings(s->freqs[0], demod.rate_in);}
+	if (dongle.fe_decim &&
+	    mirisdr_set_frontend(dongle.dev, !dongle.offset_tuning, (uint32_t)dongle.fe_decim) < 0) {
+		fprintf(stderr, "WARNING: Failed to set up the front end.\n");
+		dongle.frontend = 0;
+		optimal_settings(s->freqs[0], demod.rate_in);}
+	if (dongle.fe_decim) {
+		fprintf(stderr, "Front end decimation: %ix.\n", dongle.fe_decim);}
 	if (dongle.direct_sampling) {
 		verbose_direct_sampling(dongle.dev, 1);}
 	if (dongle.offset_tuning) {
@@ -969,7 +3282,11 @@ static void *controller_thread_fn(void *arg)
 
 	/* Set the frequency */
 	verbose_set_frequency(dongle.dev, dongle.freq);
-	fprintf(stderr, "Oversampling input by: %ix.\n", demod.downsample);
+	if (channel_count || scan.rate) {
+		fprintf(stderr, "Channels: %i, decimation %ix.\n",
+			channel_count ? channel_count : s->freq_len, dongle.rate / demod.rate_in);}
+	else {
+		fprintf(stderr, "Oversampling input by: %ix.\n", demod.downsample);}
 	fprintf(stderr, "Oversampling output by: %ix.\n", demod.post_downsample);
 	fprintf(stderr, "Buffer size: %0.2fms\n",
 		1000 * 0.5 * (float)ACTUAL_BUF_LENGTH / (float)dongle.rate);
@@ -1012,11 +3329,24 @@ static void *controller_thread_fn(void *arg)
 	/* Set the sample rate */
 	verbose_set_sample_rate(dongle.dev, dongle.rate);
 	fprintf(stderr, "Output at %u Hz.\n", demod.rate_in/demod.post_downsample);
+	if (demod.rate_out2 > 0) {
+		fprintf(stderr, "Resampled to %i Hz.\n", demod.rate_out2);}
 
 	while (!do_exit) {
 		safe_cond_wait(&s->hop, &s->hop_m);
 		if (s->freq_len <= 1) {
 			continue;}
+		if (scan.rate) {
+			/* a late signal, the window already moved */
+			if (!scan.pending) {
+				continue;}
+			scan.window = (scan.window + 1) % scan.windows;
+			dongle.freq = scan.center[scan.window];
+			mirisdr_set_center_freq(dongle.dev, dongle.freq);
+			dongle.mute = BUFFER_DUMP;
+			scan.pending = 0;
+			continue;
+		}
 		/* hacky hopping */
 		s->freq_now = (s->freq_now + 1) % s->freq_len;
 		optimal_settings(s->freqs[s->freq_now], demod.rate_in);
@@ -1053,6 +3383,8 @@ void dongle_init(struct dongle_state *s)
 	s->mute = 0;
 	s->direct_sampling = 0;
 	s->offset_tuning = 0;
+	s->frontend = 0;
+	s->fe_decim = 0;
 	s->demod_target = &demod;
 	s->format = 0;
 #if !defined (_WIN32) || defined(__MINGW32__)
@@ -1064,6 +3396,57 @@ void dongle_init(struct dongle_state *s)
 	s->if_mode = 0;
 }
 
+int pipe_init(struct pipe *p)
+{
+	int i;
+	p->size = 0;
+	p->overruns = 0;
+	p->wait = 0;
+	if (queue_init(&p->full, PIPE_BUFFERS) < 0 || queue_init(&p->empty, PIPE_BUFFERS) < 0) {
+		return -1;}
+	for (i = 0; i < PIPE_BUFFERS; i++) {
+		p->pool[i] = malloc(sizeof(struct pipe_buffer));
+		if (!p->pool[i]) {
+			return -1;}
+		p->pool[i]->data = NULL;
+		p->pool[i]->f = NULL;
+		queue_push(&p->empty, p->pool[i]);
+	}
+	return 0;
+}
+
+int pipe_alloc(struct pipe *p, int size, int use_float)
+/* once the rates are known, the float path gets its float half too */
+{
+	int i;
+	p->size = size;
+	for (i = 0; i < PIPE_BUFFERS; i++) {
+		p->pool[i]->data = buf_alloc((size_t)size * sizeof(int16_t));
+		if (!p->pool[i]->data) {
+			return -1;}
+		if (!use_float) {
+			continue;}
+		p->pool[i]->f = buf_alloc((size_t)size * sizeof(float));
+		if (!p->pool[i]->f) {
+			return -1;}
+	}
+	return 0;
+}
+
+void pipe_cleanup(struct pipe *p)
+{
+	int i;
+	queue_free(&p->full);
+	queue_free(&p->empty);
+	for (i = 0; i < PIPE_BUFFERS; i++) {
+		if (p->pool[i]) {
+			buf_free(p->pool[i]->data);
+			buf_free(p->pool[i]->f);
+		}
+		free(p->pool[i]);
+	}
+}
+
 void demod_init(struct demod_state *s)
 {
 	s->rate_in = DEFAULT_SAMPLE_RATE;
@@ -1072,46 +3455,73 @@ void demod_init(struct demod_state *s)
 	s->conseq_squelch = 10;
 	s->terminate_on_squelch = 0;
 	s->squelch_hits = 11;
+	s->sq_n = 0;
+	s->sq_sum = s->sq_power = 0.0;
+	s->noise_squelch = 0;
+	s->noise_level = 0.0f;
+	s->noise_hist[0] = s->noise_hist[1] = 0.0f;
 	s->downsample_passes = 0;
 	s->comp_fir_size = 0;
+	s->channel_taps = 0;
+	s->stage_count = 0;
+	memset(s->stages, 0, sizeof(s->stages));
 	s->prev_index = 0;
 	s->post_downsample = 1;  // once this works, default = 4
 	s->custom_atan = 0;
 	s->deemph = 0;
 	s->rate_out2 = -1;  // flag for disabled
+	s->resample_mode = RESAMPLE_POLY;
+	s->resampler = NULL;
+	s->stereo = 0;
+	s->rds_filename = NULL;
+	s->mpx = NULL;
+	s->use_float = 0;
+	s->lowpassed_f = NULL;
+	s->result_f = NULL;
+	s->now_rf = s->now_jf = 0.0f;
+	s->pre_rf = s->pre_jf = 0.0f;
+	s->dc_avg_f = 0.0f;
+	s->deemph_alpha = s->deemph_avg = 0.0f;
+	s->level_f = 1.0f;
 	s->mode_demod = &fm_demod;
 	s->pre_j = s->pre_r = s->now_r = s->now_j = 0;
 	s->prev_lpr_index = 0;
-	s->deemph_a = 0;
 	s->now_lpr = 0;
 	s->dc_block = 0;
 	s->dc_avg = 0;
-	pthread_rwlock_init(&s->rw, NULL);
-	pthread_cond_init(&s->ready, NULL);
-	pthread_mutex_init(&s->ready_m, NULL);
+	s->lowpassed = NULL;
+	s->result = NULL;
+	if (pipe_init(&s->in) < 0) {
+		fprintf(stderr, "Failed to allocate the demod buffers.\n");
+		exit(1);
+	}
 	s->output_target = &output;
 }
 
 void demod_cleanup(struct demod_state *s)
 {
-	pthread_rwlock_destroy(&s->rw);
-	pthread_cond_destroy(&s->ready);
-	pthread_mutex_destroy(&s->ready_m);
+	int i;
+	pipe_cleanup(&s->in);
+	for (i = 0; i < DECIMATOR_STAGES; i++) {
+		free(s->stages[i]);}
+	resampler_free(s->resampler);
+	stereo_free(s);
 }
 
 void output_init(struct output_state *s)
 {
 	s->rate = DEFAULT_SAMPLE_RATE;
-	pthread_rwlock_init(&s->rw, NULL);
-	pthread_cond_init(&s->ready, NULL);
-	pthread_mutex_init(&s->ready_m, NULL);
+	s->file = NULL;
+	s->f32 = 0;
+	if (pipe_init(&s->in) < 0) {
+		fprintf(stderr, "Failed to allocate the output buffers.\n");
+		exit(1);
+	}
 }
 
 void output_cleanup(struct output_state *s)
 {
-	pthread_rwlock_destroy(&s->rw);
-	pthread_cond_destroy(&s->ready);
-	pthread_mutex_destroy(&s->ready_m);
+	pipe_cleanup(&s->in);
 }
 
 void controller_init(struct controller_state *s)
@@ -1132,7 +3542,26 @@ void controller_cleanup(struct controller_state *s)
 
 void sanity_checks(void)
 {
-	if (controller.freq_len == 0) {
+	if (input.filename) {
+		if (!input.rate) {
+			fprintf(stderr, "Please give the sample rate of the recording, -I filename,rate.\n");
+			exit(1);
+		}
+		if (channel_count && controller.freq_len != 1) {
+			fprintf(stderr, "Please give the center of the recording with -f.\n");
+			exit(1);
+		}
+		if (controller.freq_len > 1) {
+			fprintf(stderr, "A recording can't be scanned, give at most one -f.\n");
+			exit(1);
+		}
+		if (dongle.frontend) {
+			fprintf(stderr, "-E frontend needs the device, not used.\n");
+			dongle.frontend = 0;
+		}
+	}
+
+	if (controller.freq_len == 0 && !channel_count && !input.filename) {
 		fprintf(stderr, "Please specify a frequency.\n");
 		exit(1);
 	}
@@ -1142,13 +3571,634 @@ void sanity_checks(void)
 		exit(1);
 	}
 
-	if (controller.freq_len > 1 && demod.squelch_level == 0) {
+	if (channel_count && controller.freq_len > 1) {
+		fprintf(stderr, "Channels can't be scanned, give at most one -f as the center.\n");
+		exit(1);
+	}
+
+	if (channel_count && (dongle.frontend || demod.downsample_passes || demod.channel_taps)) {
+		fprintf(stderr, "The channels have their own filters, -E frontend, -F and -H are not used.\n");
+		dongle.frontend = 0;
+		demod.downsample_passes = 0;
+		demod.channel_taps = 0;
+	}
+
+	if (demod.channel_taps && demod.downsample_passes) {
+		fprintf(stderr, "-F and -H are two different decimators, using -H.\n");
+		demod.downsample_passes = 0;
+	}
+
+	if (demod.stereo || demod.rds_filename) {
+		if (demod.mode_demod != &fm_demod || demod.rate_out < STEREO_MIN_RATE) {
+			fprintf(stderr, "Stereo and RDS need -M wbfm, or fm at -s %i or more.\n", STEREO_MIN_RATE);
+			exit(1);
+		}
+		if (channel_count || scan.rate) {
+			fprintf(stderr, "Stereo and RDS are not available for -c and -W.\n");
+			exit(1);
+		}
+		if (demod.stereo && demod.rate_out2 <= 0) {
+			fprintf(stderr, "Stereo needs an audio rate, e.g. -r 48k.\n");
+			exit(1);
+		}
+		if (!demod.use_float) {
+			fprintf(stderr, "Stereo and RDS run on the float path, using -P float.\n");
+			demod.use_float = 1;
+		}
+	}
+
+	if (output.f32 && !demod.use_float) {
+		fprintf(stderr, "-O f32 needs the float path, using -P float.\n");
+		demod.use_float = 1;
+	}
+
+	if (demod.use_float && demod.downsample_passes) {
+		fprintf(stderr, "-F is int16 only, the float path uses -H %i.\n", DECIMATOR_DEFAULT_TAPS);
+		demod.downsample_passes = 0;
+		demod.channel_taps = DECIMATOR_DEFAULT_TAPS;
+	}
+
+	if (demod.use_float && demod.resample_mode == RESAMPLE_BOXCAR) {
+		demod.resample_mode = RESAMPLE_POLY;}
+
+	if (demod.rate_out2 > (int)demod.rate_out && demod.resample_mode == RESAMPLE_BOXCAR) {
+		fprintf(stderr, "The boxcar can't upsample, using -r %i,poly.\n", demod.rate_out2);
+		demod.resample_mode = RESAMPLE_POLY;
+	}
+
+	if (scan.rate && (controller.freq_len < 2 || channel_count || input.filename)) {
+		fprintf(stderr, "-W scans the frequencies of -f, not -c or a recording.\n");
+		exit(1);
+	}
+
+	if (scan.rate && !demod.squelch_level) {
+		fprintf(stderr, "-W needs a squelch level, -l.\n");
+		exit(1);
+	}
+
+	if (scan.rate && (dongle.frontend || demod.downsample_passes || demod.channel_taps)) {
+		fprintf(stderr, "The scan has its own filters, -E frontend, -F and -H are not used.\n");
+		dongle.frontend = 0;
+		demod.downsample_passes = 0;
+		demod.channel_taps = 0;
+	}
+
+	if (controller.freq_len > 1 && demod.squelch_level == 0 && !demod.noise_squelch) {
 		fprintf(stderr, "Please specify a squelch level.  Required for scanning multiple frequencies.\n");
 		exit(1);
 	}
 
 }
 
+/* miri_fm -B, a table of groups: every row sets up a demod_state,
+   measures what comes out once, then times the call the chain makes */
+
+struct bench
+{
+	const char *title;
+	int      rows;
+	const char *names[8];
+	void   (*setup)(struct demod_state *d, int row);
+	double (*quality)(struct demod_state *d, int row);  /* in dB, NULL for none */
+	int    (*run)(struct demod_state *d);               /* returns the samples done */
+};
+
+/* shared by all rows, the generated capture and the chain's buffers */
+static struct
+{
+	int16_t *cap;           /* BENCH_CHUNKS of BENCH_LEN */
+	float   *cap_f;
+	float   *audio;         /* what a pass over the capture gives */
+	int16_t *lp, *res;      /* BENCH_LEN */
+	float   *lp_f, *res_f;  /* and 2 more, L and R for stereo */
+	int      chunks, pos;   /* in the capture, runs go round it */
+	int      scalar;        /* de-emphasis, the loops the lanes replaced */
+} bench;
+
+static double bench_time(struct demod_state *d, int (*run)(struct demod_state *))
+/* ns per sample, the fastest of a few rounds, the others were disturbed */
+{
+	double t0, t, best = 1e9;
+	uint64_t n;
+	int r;
+	for (r = 0; r < BENCH_ROUNDS; r++) {
+		n = 0;
+		t0 = now();
+		do {
+			n += run(d);
+			t = now() - t0;
+		} while (t < 0.02);
+		if (n && t / n < best) {
+			best = t / n;}
+	}
+	return best * 1e9;
+}
+
+static double disc_dphi(int i)
+/* a 1 kHz tone at 75 kHz deviation and 680 kHz, what -M wbfm demodulates */
+{
+	return 2.0 * M_PI * 75000.0 / 680000.0 * sin(2.0 * M_PI * 1000.0 * i / 680000.0);
+}
+
+static void disc_setup(struct demod_state *d, int row)
+{
+	/* small enough for the integer products of fast and lut */
+	int i, amp = 500;
+	double phase = 0.0;
+	if (!atan_lut) {
+		atan_lut_init();}
+	for (i = 0; i < BENCH_LEN / 2; i++) {
+		phase += disc_dphi(i);
+		bench.lp[2*i]   = (int16_t)lrint(amp * cos(phase));
+		bench.lp[2*i+1] = (int16_t)lrint(amp * sin(phase));
+	}
+	d->custom_atan = row;
+	d->lowpassed = bench.lp;
+	d->result = bench.res;
+	d->lp_len = BENCH_LEN;
+	d->pre_r = amp;
+}
+
+static double disc_quality(struct demod_state *d, int row)
+/* the SNR against the exact phase steps */
+{
+	double ideal, e, sig = 0.0, err = 0.0;
+	int i;
+	fm_demod(d);
+	for (i = 0; i < BENCH_LEN / 2; i++) {
+		ideal = disc_dphi(i) * (1<<14) / M_PI;
+		e = bench.res[i] - ideal;
+		sig += ideal * ideal;
+		err += e * e;
+	}
+	return 10.0 * log10(sig / err);
+}
+
+static int disc_run(struct demod_state *d)
+{
+	fm_demod(d);
+	return BENCH_LEN / 2;
+}
+
+static void decimator_setup(struct demod_state *d, int row)
+/* 48 kHz out of 1.536 MHz, what -s 48k captures */
+{
+	d->downsample = 32;
+	if (row == 1) {
+		d->downsample_passes = 5;
+		d->comp_fir_size = 9;
+	}
+	if (row == 2) {
+		d->channel_taps = 31;
+		if (decimator_init(d, 5) < 0) {
+			exit(1);}
+	}
+}
+
+static int decimator_run_bench(struct demod_state *d)
+{
+	d->lowpassed = bench.lp;
+	d->lp_len = BENCH_LEN;
+	decimate(d);
+	return d->lp_len / 2;
+}
+
+static double decimator_power(struct demod_state *d, double f)
+/* a tone at f (relative to the capture rate), the power of the 4 kHz bin once settled */
+{
+	int16_t *lp = bench.lp;
+	int i, n;
+	double re = 0.0, im = 0.0, w = 2.0 * M_PI * 4000.0 / 48000.0;
+	for (i = 0; i < BENCH_LEN / 2; i++) {
+		lp[2*i]   = (int16_t)lrint(1000.0 * cos(2.0 * M_PI * f * i));
+		lp[2*i+1] = (int16_t)lrint(1000.0 * sin(2.0 * M_PI * f * i));
+	}
+	n = decimator_run_bench(d);
+	for (i = n / 2; i < n; i++) {
+		re += lp[2*i] * cos(w * i) + lp[2*i+1] * sin(w * i);
+		im += lp[2*i+1] * cos(w * i) - lp[2*i] * sin(w * i);
+	}
+	return (re * re + im * im) / ((double)(n - n / 2) * (n - n / 2));
+}
+
+static double decimator_quality(struct demod_state *d, int row)
+/* tones landing at 4 kHz, the wanted one against the worst of its images */
+{
+	double pass, alias, worst = 0.0;
+	int m;
+	pass = decimator_power(d, 4000.0 / 1536000.0);
+	for (m = -15; m <= 15; m++) {
+		if (!m) {
+			continue;}
+		alias = decimator_power(d, (4000.0 + m * 48000.0) / 1536000.0);
+		if (alias > worst) {
+			worst = alias;}
+	}
+	return 10.0 * log10(pass / (worst + 1e-9));
+}
+
+static void resampler_setup(struct demod_state *d, int row)
+/* wbfm audio to a sound card, 170 kHz -> 48 kHz */
+{
+	d->rate_out = 170000;
+	d->rate_out2 = 48000;
+	d->resample_mode = row;
+	d->result_size = BENCH_LEN / 2;
+	if (resampler_init(d) < 0) {
+		exit(1);}
+}
+
+static int resampler_run_bench(struct demod_state *d)
+{
+	d->result = bench.res;
+	d->result_len = BENCH_LEN / 2;
+	if (d->resampler) {
+		resample(d);
+	} else {
+		low_pass_real(d);}
+	return d->result_len;
+}
+
+static double resampler_power(struct demod_state *d, double f)
+/* a real tone at f Hz, the power of its (folded) output bin once settled */
+{
+	int16_t *buf = bench.res;
+	int i, n;
+	double re = 0.0, im = 0.0, w;
+	for (i = 0; i < BENCH_LEN / 2; i++) {
+		buf[i] = (int16_t)lrint(10000.0 * cos(2.0 * M_PI * f * i / d->rate_out));}
+	n = resampler_run_bench(d);
+	f = fmod(f, d->rate_out2);
+	if (f > d->rate_out2 / 2) {
+		f = d->rate_out2 - f;}
+	w = 2.0 * M_PI * f / d->rate_out2;
+	for (i = n / 2; i < n; i++) {
+		re += buf[i] * cos(w * i);
+		im += buf[i] * sin(w * i);
+	}
+	return (re * re + im * im) / ((double)(n - n / 2) * (n - n / 2));
+}
+
+static double resampler_quality(struct demod_state *d, int row)
+/* the worst alias of a tone above 24 kHz */
+{
+	double pass, alias, worst = 0.0, f;
+	pass = resampler_power(d, 1000.0);
+	for (f = 26500.0; f < 85000.0; f += 3500.0) {
+		alias = resampler_power(d, f);
+		if (alias > worst) {
+			worst = alias;}
+	}
+	return 10.0 * log10(pass / (worst + 1e-9));
+}
+
+static double tone_snr(const float *y, int n, double f)
+/* a tone at f cycles per sample against everything else */
+{
+	int i;
+	double re = 0.0, im = 0.0, p = 0.0, e, a, b;
+	for (i = 0; i < n; i++) {
+		re += y[i] * cos(2.0 * M_PI * f * i);
+		im += y[i] * sin(2.0 * M_PI * f * i);
+	}
+	a = 2.0 * re / n;
+	b = 2.0 * im / n;
+	for (i = 0; i < n; i++) {
+		e = y[i] - a * cos(2.0 * M_PI * f * i) - b * sin(2.0 * M_PI * f * i);
+		p += e * e;
+	}
+	return 10.0 * log10((a * a + b * b) / 2.0 / (p / n + 1e-30));
+}
+
+static void pipeline_setup(struct demod_state *d, int row)
+/* one generated FM capture through both chains, 1.536 MHz to 48 kHz,
+   the rows are int and float of boxcar and -H 31 at -20 and -60 dBFS */
+{
+	double amp = 32767.0 * pow(10.0, (row & 1 ? -60.0 : -20.0) / 20.0), ph;
+	int i;
+	/* 5 kHz deviation */
+	for (i = 0; i < BENCH_CHUNKS * BENCH_LEN / 2; i++) {
+		ph = 5.0 * sin(2.0 * M_PI * 1000.0 * i / 1536000.0);
+		bench.cap[2*i]   = (int16_t)lrint(amp * cos(ph));
+		bench.cap[2*i+1] = (int16_t)lrint(amp * sin(ph));
+	}
+	bench.chunks = BENCH_CHUNKS;
+	d->downsample = 32;
+	d->custom_atan = 3;
+	d->mode_demod = &fm_demod;
+	d->lowpassed = bench.lp;
+	d->result = bench.res;
+	d->lowpassed_f = bench.lp_f;
+	d->result_f = bench.res_f;
+	d->use_float = (row / 2) & 1;
+	if (row >= 4) {
+		d->channel_taps = 31;
+		if (decimator_init(d, 5) < 0) {
+			exit(1);}
+	}
+}
+
+static int pipeline_run(struct demod_state *d)
+/* what the callback does to every transfer */
+{
+	const int16_t *x = bench.cap + (size_t)bench.pos * BENCH_LEN;
+	int i;
+	if (d->use_float) {
+		for (i = 0; i < BENCH_LEN; i++) {
+			bench.lp_f[i] = x[i] * (1.0f / 32768.0f);}
+		d->lp_len = BENCH_LEN;
+		full_demod_f(d);
+	} else {
+		for (i = 0; i < BENCH_LEN; i++) {
+			bench.lp[i] = x[i] / 128;}
+		d->lp_len = BENCH_LEN;
+		full_demod(d);
+	}
+	bench.pos = (bench.pos + 1) % bench.chunks;
+	return BENCH_LEN / 2;
+}
+
+static double pipeline_quality(struct demod_state *d, int row)
+/* the SNR of the 1 kHz tone */
+{
+	int c, i, n = 0;
+	for (c = 0; c < bench.chunks; c++) {
+		pipeline_run(d);
+		for (i = 0; i < d->result_len; i++) {
+			bench.audio[n + i] = d->use_float ? bench.res_f[i] : bench.res[i];}
+		n += d->result_len;
+	}
+	/* skip the start, the filters settle */
+	return tone_snr(bench.audio + n / 4, n - n / 4, 1000.0 / 48000.0);
+}
+
+static void squelch_setup(struct demod_state *d, int row)
+/* what a closed squelch saves, the sums come with the boxcar */
+{
+	uint32_t seed = 1;
+	int i;
+	for (i = 0; i < BENCH_LEN; i++) {
+		seed = seed * 1103515245 + 12345;
+		bench.cap[i] = (int16_t)((seed >> 16) & 0x3ff) - 0x200;
+	}
+	d->downsample = 1;
+	d->mode_demod = &fm_demod;
+	d->lowpassed = bench.lp;
+	d->result = bench.res;
+	d->conseq_squelch = 10;
+	d->squelch_level = row ? 100000 : 1;
+}
+
+static int squelch_run(struct demod_state *d)
+{
+	memcpy(bench.lp, bench.cap, BENCH_LEN * sizeof(int16_t));
+	d->lp_len = BENCH_LEN;
+	full_demod(d);
+	return BENCH_LEN / 2;
+}
+
+static void noise_setup(struct demod_state *d, int row)
+/* the discriminator on noise, what -n sees with no signal, in int and in float */
+{
+	uint32_t seed = 1;
+	int i;
+	for (i = 0; i < BENCH_LEN; i++) {
+		seed = seed * 1103515245 + 12345;
+		bench.lp[i] = (int16_t)((seed >> 16) & 0x3ff) - 0x200;
+	}
+	d->lowpassed = bench.lp;
+	d->result = bench.res;
+	d->lp_len = BENCH_LEN;
+	fm_demod(d);
+	for (i = 0; i < d->result_len; i++) {
+		bench.res_f[i] = bench.res[i] * (1.0f / (1<<14));}
+	d->result_f = bench.res_f;
+	d->use_float = row;
+}
+
+static int noise_run(struct demod_state *d)
+{
+	if (d->use_float) {
+		noise_power_f(d);
+	} else {
+		noise_power(d);}
+	return d->result_len;
+}
+
+static double noise_quality(struct demod_state *d, int row)
+/* relative to no signal at all, both should give about 0 dB */
+{
+	return noise_db(d->use_float ? noise_power_f(d) : noise_power(d));
+}
+
+static void deemph_scalar(struct demod_state *fm)
+/* what deemph_filter replaced, 1/alpha rounded and a branch per sample */
+{
+	int i, d, a = (int)lround(1.0 / fm->deemph_alpha), avg = (int)fm->deemph_avg;
+	for (i = 0; i < fm->result_len; i++) {
+		d = fm->result[i] - avg;
+		if (d > 0) {
+			avg += (d + a/2) / a;
+		} else {
+			avg += (d - a/2) / a;
+		}
+		fm->result[i] = (int16_t)avg;
+	}
+	fm->deemph_avg = (float)avg;
+}
+
+static void deemph_scalar_f(struct demod_state *fm)
+/* what deemph_filter_f replaced */
+{
+	float avg = fm->deemph_avg;
+	int i;
+	for (i = 0; i < fm->result_len; i++) {
+		avg += fm->deemph_alpha * (fm->result_f[i] - avg);
+		fm->result_f[i] = avg;
+	}
+	fm->deemph_avg = avg;
+}
+
+static void deemph_setup(struct demod_state *d, int row)
+/* -E deemp at 24 kHz on noise, the old loops and the lanes, in int and in float */
+{
+	uint32_t seed = 1;
+	int i;
+	for (i = 0; i < BENCH_LEN; i++) {
+		seed = seed * 1103515245 + 12345;
+		bench.cap[i] = (int16_t)((seed >> 16) & 0x3fff) - 0x2000;
+		bench.cap_f[i] = bench.cap[i];
+	}
+	d->deemph = 1;
+	deemph_init(d, 1.0 - exp(-1.0 / (24000 * 75e-6)));
+	d->result = bench.res;
+	d->result_f = bench.res_f;
+	d->result_len = BENCH_LEN;
+	d->use_float = row >= 2;
+	bench.scalar = !(row & 1);
+}
+
+static int deemph_run_bench(struct demod_state *d)
+/* in place, so the input is copied in first on every row */
+{
+	if (d->use_float) {
+		memcpy(bench.res_f, bench.cap_f, BENCH_LEN * sizeof(float));
+		if (bench.scalar) {
+			deemph_scalar_f(d);
+		} else {
+			deemph_filter_f(d);}
+	} else {
+		memcpy(bench.res, bench.cap, BENCH_LEN * sizeof(int16_t));
+		if (bench.scalar) {
+			deemph_scalar(d);
+		} else {
+			deemph_filter(d);}
+	}
+	return BENCH_LEN;
+}
+
+static double deemph_quality(struct demod_state *d, int row)
+/* the SNR against the same filter in double, from rest */
+{
+	double y, e, ref = 0.0, sig = 0.0, err = 0.0;
+	int i;
+	deemph_run_bench(d);
+	for (i = 0; i < BENCH_LEN; i++) {
+		ref += d->deemph_alpha * (bench.cap[i] - ref);
+		y = d->use_float ? bench.res_f[i] : bench.res[i];
+		e = y - ref;
+		sig += ref * ref;
+		err += e * e;
+	}
+	return 10.0 * log10(sig / err);
+}
+
+static void stereo_setup(struct demod_state *d, int row)
+/* -M wbfm -E stereo with 1 kHz on L only, what main sets up for wbfm
+   out of 1.36 MHz, the boxcar of 4 to 170 kHz and its droop included */
+{
+	double t, p, m, phase = 0.0;
+	int i;
+	d->rate_in = 680000;
+	d->rate_out = 170000;
+	d->rate_out2 = 48000;
+	d->post_downsample = 4;
+	d->downsample = 2;
+	d->mode_demod = &fm_demod;
+	d->custom_atan = 1;
+	d->deemph = 1;
+	d->resample_mode = RESAMPLE_POLY;
+	d->stereo = 1;
+	d->result_size = resample_size(d, BENCH_LEN / 2 / d->downsample);
+	deemph_init(d, 1.0 - exp(-1.0 / (d->rate_out * 75e-6)));
+	if (stereo_init(d) < 0) {
+		exit(1);}
+	d->lowpassed_f = bench.lp_f;
+	d->result_f = bench.res_f;
+	bench.chunks = 20;
+	for (i = 0; i < bench.chunks * BENCH_LEN / 2; i++) {
+		t = (double)i / (d->rate_in * d->downsample);
+		p = 2.0 * M_PI * PILOT_HZ * t;
+		m = 0.45 * sin(2.0 * M_PI * 1000.0 * t) * (1.0 + sin(2.0 * p)) + 0.09 * sin(p);
+		/* 75 kHz deviation */
+		phase += 2.0 * M_PI * 75000.0 / (d->rate_in * d->downsample) * m;
+		bench.cap_f[2*i]   = (float)(0.5 * cos(phase));
+		bench.cap_f[2*i+1] = (float)(0.5 * sin(phase));
+	}
+}
+
+static int stereo_run(struct demod_state *d)
+{
+	memcpy(bench.lp_f, bench.cap_f + (size_t)bench.pos * BENCH_LEN, BENCH_LEN * sizeof(float));
+	d->lp_len = BENCH_LEN;
+	full_demod_f(d);
+	bench.pos = (bench.pos + 1) % bench.chunks;
+	return BENCH_LEN / 2;
+}
+
+static double stereo_quality(struct demod_state *d, int row)
+/* the level of L's tone in R, over the second half once the PLL has settled */
+{
+	const float *x = bench.res_f;
+	double p, l[2] = {0.0, 0.0}, r[2] = {0.0, 0.0};
+	int c, i, n = 0;
+	for (c = 0; c < bench.chunks; c++) {
+		stereo_run(d);
+		for (i = 0; i < d->result_len / 2; i++, n++) {
+			if (c < bench.chunks / 2) {
+				continue;}
+			p = 2.0 * M_PI * 1000.0 * n / d->rate_out2;
+			l[0] += x[2*i] * sin(p);
+			l[1] += x[2*i] * cos(p);
+			r[0] += x[2*i+1] * sin(p);
+			r[1] += x[2*i+1] * cos(p);
+		}
+	}
+	if (!d->mpx->locked) {
+		fprintf(stderr, "Stereo pilot not locked.\n");}
+	return 10.0 * log10((r[0] * r[0] + r[1] * r[1]) / (l[0] * l[0] + l[1] * l[1]));
+}
+
+static const struct bench benches[] = {
+	{"FM discriminator, SNR of a demodulated tone and cost per sample:", 4,
+	 {"std", "fast", "lut", "simd"}, disc_setup, disc_quality, disc_run},
+	{"Decimation by 32, worst alias of the 48 kHz band and cost per output sample:", 3,
+	 {"boxcar", "-F 9", "-H 31"}, decimator_setup, decimator_quality, decimator_run_bench},
+	{"Resampling 170 kHz to 48 kHz, worst alias of a tone above 24 kHz and cost per output sample:", 3,
+	 {"poly", "farrow", "boxcar"}, resampler_setup, resampler_quality, resampler_run_bench},
+	{"FM at 1.536 MHz to 48 kHz, SNR of a 1 kHz tone and cost per input sample:", 8,
+	 {"int   boxcar -20 dBFS", "int   boxcar -60 dBFS", "float boxcar -20 dBFS", "float boxcar -60 dBFS",
+	  "int   -H 31  -20 dBFS", "int   -H 31  -60 dBFS", "float -H 31  -20 dBFS", "float -H 31  -60 dBFS"},
+	 pipeline_setup, pipeline_quality, pipeline_run},
+	{"Power squelch on noise through the default chain, cost per input sample:", 2,
+	 {"open", "closed"}, squelch_setup, NULL, squelch_run},
+	{"Noise squelch on the discriminator of noise, its level and cost per sample:", 2,
+	 {"int", "float"}, noise_setup, noise_quality, noise_run},
+	{"De-emphasis at 24 kHz on noise, SNR against an exact filter and cost per sample:", 4,
+	 {"int   scalar", "int   8 lanes", "float scalar", "float 8 lanes"},
+	 deemph_setup, deemph_quality, deemph_run_bench},
+	{"Stereo from 1.36 MHz, 1 kHz on L only, its level in R and cost per input sample:", 1,
+	 {"-E stereo"}, stereo_setup, stereo_quality, stereo_run},
+};
+
+void benchmark(void)
+{
+	struct demod_state d;
+	size_t size = (size_t)BENCH_CHUNKS * BENCH_LEN;
+	double q, t;
+	int g, k, i;
+	/* in one block, the float ones first so they stay aligned */
+	bench.cap_f = buf_alloc((size * 3 / 2 + 2 * BENCH_LEN + 2) * sizeof(float) + (size + 2 * BENCH_LEN) * sizeof(int16_t));
+	if (!bench.cap_f) {
+		exit(1);}
+	bench.audio = bench.cap_f + size;
+	bench.lp_f = bench.audio + size / 2;
+	bench.res_f = bench.lp_f + BENCH_LEN;
+	bench.cap = (int16_t *)(bench.res_f + BENCH_LEN + 2);
+	bench.lp = bench.cap + size;
+	bench.res = bench.lp + BENCH_LEN;
+	for (g = 0; g < (int)(sizeof(benches) / sizeof(benches[0])); g++) {
+		fprintf(stderr, "%s\n", benches[g].title);
+		for (k = 0; k < benches[g].rows; k++) {
+			memset(&d, 0, sizeof(d));
+			bench.pos = 0;
+			bench.chunks = 1;
+			benches[g].setup(&d, k);
+			q = benches[g].quality ? benches[g].quality(&d, k) : 0.0;
+			t = bench_time(&d, benches[g].run);
+			if (benches[g].quality) {
+				fprintf(stderr, "\t%-21s %6.1f dB %8.1f ns\n", benches[g].names[k], q, t);
+			} else {
+				fprintf(stderr, "\t%-21s           %8.1f ns\n", benches[g].names[k], t);}
+			for (i = 0; i < DECIMATOR_STAGES; i++) {
+				free(d.stages[i]);}
+			resampler_free(d.resampler);
+			stereo_free(&d);
+		}
+	}
+	buf_free(bench.cap_f);
+}
+
 int main(int argc, char **argv)
 {
 #if !defined (_WIN32) || defined(__MINGW32__)
@@ -1158,6 +4208,13 @@ int main(int argc, char **argv)
 	int dev_given = 0;
 	int custom_ppm = 0;
 	int enable_biastee = 0;
+	char *realtime = NULL;
+	char *cpu_list = NULL;
+	char *mlock_mode = NULL;
+	char *resample = NULL;
+	char *in_rate, *in_format;
+	int in_len;
+	double elapsed;
 	dongle_init(&dongle);
 	demod_init(&demod);
 	output_init(&output);
@@ -1165,7 +4222,7 @@ int main(int argc, char **argv)
     mirisdr_hw_flavour_t hw_flavour = MIRISDR_HW_DEFAULT;
     int intval;
 
-	while ((opt = getopt(argc, argv, "b:d:D:T:e:f:g:i:l:m:o:p:r:s:t:w:E:F:A:M:h")) != -1) {
+	while ((opt = getopt(argc, argv, "b:c:d:D:T:e:f:g:i:j:l:m:n:o:p:r:s:t:w:E:F:H:A:BI:M:O:P:R:W:X:C:L:h")) != -1) {
 		switch (opt) {
 		case 'd':
 			dongle.dev_index = verbose_device_search(optarg);
@@ -1197,6 +4254,17 @@ int main(int argc, char **argv)
 				controller.freq_len++;
 			}
 			break;
+		case 'c':
+			if (channel_count >= CHANNELS_LIMIT) {
+				fprintf(stderr, "Too many channels, maximum %i.\n", CHANNELS_LIMIT);
+				exit(1);
+			}
+			channels[channel_count].spec = optarg;
+			channel_count++;
+			break;
+		case 'j':
+			channel_threads = atoi(optarg);
+			break;
 		case 'g':
 			dongle.gain = (int)(atof(optarg) * 10);
 			break;
@@ -1206,6 +4274,10 @@ int main(int argc, char **argv)
 		case 'l':
 			demod.squelch_level = (int)atof(optarg);
 			break;
+		case 'n':
+			demod.noise_squelch = 1;
+			demod.noise_level = (float)atof(optarg);
+			break;
 		case 'm':
 			if (strcmp("504", optarg) == 0) {
 				dongle.format = 1;}
@@ -1221,6 +4293,18 @@ int main(int argc, char **argv)
 			demod.rate_out = (uint32_t)atofs(optarg);
 			break;
 		case 'r':
+			resample = strchr(optarg, ',');
+			if (resample) {
+				*resample++ = '\0';
+				if (strcmp("poly", resample) == 0) {
+					demod.resample_mode = RESAMPLE_POLY;}
+				else if (strcmp("farrow", resample) == 0) {
+					demod.resample_mode = RESAMPLE_FARROW;}
+				else if (strcmp("boxcar", resample) == 0) {
+					demod.resample_mode = RESAMPLE_BOXCAR;}
+				else {
+					usage();}
+			}
 			output.rate = (int)atofs(optarg);
 			demod.rate_out2 = (int)atofs(optarg);
 			break;
@@ -1254,11 +4338,20 @@ int main(int argc, char **argv)
 				dongle.direct_sampling = 1;}
 			if (strcmp("offset",  optarg) == 0) {
 				dongle.offset_tuning = 1;}
+			if (strcmp("frontend",  optarg) == 0) {
+				dongle.frontend = 1;}
+			if (strcmp("stereo",  optarg) == 0) {
+				demod.stereo = 1;}
 			break;
 		case 'F':
 			demod.downsample_passes = 1;  /* truthy placeholder */
 			demod.comp_fir_size = atoi(optarg);
 			break;
+		case 'H':
+			demod.channel_taps = atoi(optarg);
+			if (demod.channel_taps < 5 || demod.channel_taps > DECIMATOR_MAX_TAPS) {
+				demod.channel_taps = DECIMATOR_DEFAULT_TAPS;}
+			break;
 		case 'A':
 			if (strcmp("std",  optarg) == 0) {
 				demod.custom_atan = 0;}
@@ -1267,18 +4360,46 @@ int main(int argc, char **argv)
 			if (strcmp("lut",  optarg) == 0) {
 				atan_lut_init();
 				demod.custom_atan = 2;}
+			if (strcmp("simd", optarg) == 0) {
+				demod.custom_atan = 3;}
+			break;
+		case 'R':
+			demod.rds_filename = optarg;
+			break;
+		case 'I':
+			/* filename,rate[,format] */
+			input.filename = optarg;
+			in_rate = strchr(optarg, ',');
+			if (!in_rate) {
+				usage();}
+			*in_rate++ = '\0';
+			in_format = strchr(in_rate, ',');
+			if (in_format) {
+				*in_format++ = '\0';}
+			input.rate = (uint32_t)atofs(in_rate);
+			if (!in_format || strcmp("cs16", in_format) == 0) {
+				input.format = INPUT_CS16;}
+			else if (strcmp("cu8", in_format) == 0) {
+				input.format = INPUT_CU8;}
+			else if (strcmp("cf32", in_format) == 0) {
+				input.format = INPUT_CF32;}
+			else {
+				usage();}
+			break;
+		case 'W':
+			scan.rate = (uint32_t)atofs(optarg);
 			break;
+		case 'P':
+			demod.use_float = strcmp("float", optarg) == 0;
+			break;
+		case 'O':
+			output.f32 = strcmp("f32", optarg) == 0;
+			break;
+		case 'B':
+			benchmark();
+			exit(0);
 		case 'M':
-			if (strcmp("fm",  optarg) == 0) {
-				demod.mode_demod = &fm_demod;}
-			if (strcmp("raw",  optarg) == 0) {
-				demod.mode_demod = &raw_demod;}
-			if (strcmp("am",  optarg) == 0) {
-				demod.mode_demod = &am_demod;}
-			if (strcmp("usb", optarg) == 0) {
-				demod.mode_demod = &usb_demod;}
-			if (strcmp("lsb", optarg) == 0) {
-				demod.mode_demod = &lsb_demod;}
+			demod_mode(&demod, optarg);
 			if (strcmp("wbfm",  optarg) == 0) {
 				controller.wb_mode = 1;
 				demod.mode_demod = &fm_demod;
@@ -1293,6 +4414,15 @@ int main(int argc, char **argv)
 		case 'T':
 			enable_biastee = 1;
 			break;
+		case 'X':
+			realtime = optarg;
+			break;
+		case 'C':
+			cpu_list = optarg;
+			break;
+		case 'L':
+			mlock_mode = optarg;
+			break;
 		case 'h':
 		default:
 			usage();
@@ -1319,6 +4449,17 @@ int main(int argc, char **argv)
 
 	ACTUAL_BUF_LENGTH = lcm_post[demod.post_downsample] * DEFAULT_BUF_LENGTH;
 
+	r = 0;
+	if (input.filename) {
+		if (input_open(&input) < 0) {
+			exit(1);}
+		if (!channel_count) {
+			input_settings();}
+		/* demod and output wait for each other, nothing is dropped */
+		output.in.wait = 1;
+		goto device_done;
+	}
+
 	if (!dev_given) {
 		dongle.dev_index = verbose_device_search("0");
 	}
@@ -1335,6 +4476,8 @@ int main(int argc, char **argv)
 
 	mirisdr_set_hw_flavour(dongle.dev, hw_flavour);
 
+device_done:
+
 #if !defined (_WIN32) || defined(__MINGW32__)
 	sigact.sa_handler = sighandler;
 	sigemptyset(&sigact.sa_mask);
@@ -1348,9 +4491,34 @@ int main(int argc, char **argv)
 #endif
 
 	if (demod.deemph) {
-		demod.deemph_a = (int)round(1.0/((1.0-exp(-1.0/(demod.rate_out * 75e-6)))));
+		deemph_init(&demod, 1.0 - exp(-1.0/(demod.rate_out * 75e-6)));
 	}
 
+	/* a read of the recording or the largest transfer, the result can only grow by resampling */
+	if (input.filename) {
+		in_len = ACTUAL_BUF_LENGTH;
+	} else {
+		in_len = dongle.format == 1 ? TRANSFER_MAX_BYTES : TRANSFER_MAX_BYTES / 2;}
+	demod.result_size = resample_size(&demod, in_len);
+	if (!channel_count && (pipe_alloc(&demod.in, in_len, demod.use_float) < 0 ||
+	    pipe_alloc(&output.in, demod.result_size, demod.use_float) < 0)) {
+		fprintf(stderr, "Failed to allocate the buffers.\n");
+		exit(1);
+	}
+
+	if (!channel_count && resampler_init(&demod) < 0) {
+		fprintf(stderr, "Failed to set up the resampler.\n");
+		exit(1);
+	}
+
+	if ((demod.stereo || demod.rds_filename) && stereo_init(&demod) < 0) {
+		fprintf(stderr, "Failed to set up the stereo decoder.\n");
+		exit(1);
+	}
+
+	if (input.filename) {
+		goto tuner_done;}
+
 	/* Set the tuner gain */
 	if (dongle.gain == AUTO_GAIN) {
 		verbose_auto_gain(dongle.dev);
@@ -1364,11 +4532,25 @@ int main(int argc, char **argv)
 	}
 	verbose_ppm_set(dongle.dev, dongle.ppm_error);
 
+	if (realtime) {
+		verbose_set_realtime(dongle.dev, realtime);}
+	if (cpu_list) {
+		verbose_set_affinity(dongle.dev, cpu_list);}
+	if (mlock_mode) {
+		verbose_set_mlock(dongle.dev, mlock_mode);}
+
 	mirisdr_set_bias(dongle.dev, enable_biastee);
 	if (enable_biastee)
 		fprintf(stderr, "activated bias-T\n");
 
-	if (strcmp(output.filename, "-") == 0) { /* Write samples to stdout */
+tuner_done:
+	if (channel_count) {
+		if (channels_init() < 0) {
+			channels_cleanup();
+			mirisdr_close(dongle.dev);
+			exit(1);
+		}
+	} else if (strcmp(output.filename, "-") == 0) { /* Write samples to stdout */
 		output.file = stdout;
 #if defined (_WIN32) && !defined(__MINGW32__)
 		_setmode(_fileno(output.file), _O_BINARY);
@@ -1381,43 +4563,95 @@ int main(int argc, char **argv)
 		}
 	}
 
+	if (scan.rate && scan_init() < 0) {
+		fprintf(stderr, "Failed to set up the scan.\n");
+		exit(1);
+	}
+
 	//r = mirisdr_set_testmode(dongle.dev, 1);
 
-	/* Reset endpoint before we start reading from it (mandatory) */
-	verbose_reset_buffer(dongle.dev);
+	if (input.filename) {
+		fprintf(stderr, "Reading %s at %u Hz.\n", input.filename, input.rate);
+		if (!channel_count) {
+			fprintf(stderr, "Decimating by %ix to %i Hz.\n", demod.downsample, demod.rate_in);
+			if (demod.rate_out2 > 0) {
+				fprintf(stderr, "Resampled to %i Hz.\n", demod.rate_out2);}
+		}
+	} else {
+		/* Reset endpoint before we start reading from it (mandatory) */
+		verbose_reset_buffer(dongle.dev);
 
-	pthread_create(&controller.thread, NULL, controller_thread_fn, (void *)(&controller));
-	usleep(100000);
-	pthread_create(&output.thread, NULL, output_thread_fn, (void *)(&output));
-	pthread_create(&demod.thread, NULL, demod_thread_fn, (void *)(&demod));
-	pthread_create(&dongle.thread, NULL, dongle_thread_fn, (void *)(&dongle));
+		pthread_create(&controller.thread, NULL, controller_thread_fn, (void *)(&controller));
+		usleep(100000);
+	}
+	if (!channel_count) {
+		pthread_create(&output.thread, NULL, output_thread_fn, (void *)(&output));
+		pthread_create(&demod.thread, NULL, scan.rate ? scan_thread_fn : demod_thread_fn,
+			(void *)(&demod));
+	}
+	if (input.filename) {
+		pthread_create(&input.thread, NULL, input_thread_fn, (void *)(&input));
+	} else {
+		pthread_create(&dongle.thread, NULL, dongle_thread_fn, (void *)(&dongle));}
 
+	if (input.filename) {
+		/* until the end or a signal, no polling delay in the timing */
+		pthread_join(input.thread, NULL);}
 	while (!do_exit) {
 		usleep(100000);
 	}
 
-	if (do_exit) {
+	if (input.eof) {
+		fprintf(stderr, "\nEnd of input, exiting...\n");}
+	else if (do_exit) {
 		fprintf(stderr, "\nUser cancel, exiting...\n");}
 	else {
 		fprintf(stderr, "\nLibrary error %d, exiting...\n", r);}
 
-	mirisdr_cancel_async(dongle.dev);
-	pthread_join(dongle.thread, NULL);
-	safe_cond_signal(&demod.ready, &demod.ready_m);
-	pthread_join(demod.thread, NULL);
-	safe_cond_signal(&output.ready, &output.ready_m);
-	pthread_join(output.thread, NULL);
-	safe_cond_signal(&controller.hop, &controller.hop_m);
-	pthread_join(controller.thread, NULL);
+	if (!input.filename) {
+		mirisdr_cancel_async(dongle.dev);
+		pthread_join(dongle.thread, NULL);
+	}
+	if (!channel_count) {
+		/* both drain what is queued and stop */
+		queue_close(&demod.in.full);
+		pthread_join(demod.thread, NULL);
+		queue_close(&output.in.full);
+		pthread_join(output.thread, NULL);
+		if (demod.in.overruns || output.in.overruns) {
+			fprintf(stderr, "Overruns: %u buffers dropped before demod, %u before output.\n",
+				demod.in.overruns, output.in.overruns);}
+	}
+	if (input.filename) {
+		elapsed = now() - input.start;
+		fprintf(stderr, "%.1f M samples in %.2f s, %.2f Msps, %.1fx real time.\n",
+			input.samples / 1e6, elapsed, input.samples / elapsed / 1e6,
+			input.samples / elapsed / input.rate);
+		input_close(&input);
+	} else {
+		safe_cond_signal(&controller.hop, &controller.hop_m);
+		pthread_join(controller.thread, NULL);
+	}
+	if (demod.mpx && demod.mpx->rds) {
+		fprintf(stderr, "%llu RDS groups.\n", (unsigned long long)demod.mpx->groups);}
+	if (scan.rate) {
+		elapsed = now() - scan.start;
+		fprintf(stderr, "%llu windows moved in %.2f s, %.1f windows per second.\n",
+			(unsigned long long)scan.moves, elapsed, scan.moves / elapsed);
+		scan_cleanup();
+	}
 
 	//dongle_cleanup(&dongle);
 	demod_cleanup(&demod);
 	output_cleanup(&output);
 	controller_cleanup(&controller);
 
-	if (output.file != stdout) {
+	if (output.file && output.file != stdout) {
 		fclose(output.file);}
 
+	/* the workers are gone once the stream ended */
+	channels_cleanup();
+
 	mirisdr_close(dongle.dev);
 	return r >= 0 ? r : -r;
 }
@@ -0,0 +1,412 @@
+/*
+ * MiriSDR
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * decoder for the compressed recordings of miri_sdr -z
+ * and a throughput benchmark of the codec
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#else
+#include <windows.h>
+#include <io.h>
+#include <fcntl.h>
+#include "getopt/getopt.h"
+#endif
+
+#include <pthread.h>
+
+#include "convenience/iqz.h"
+
+#define DEFAULT_THREADS           4
+#define MAXIMAL_THREADS           64
+
+struct decode_job
+{
+    pthread_t thread;
+    struct iqz_header header;
+    uint8_t *payload;
+    uint8_t *samples;
+    int     result;
+    int     threaded;       /* else decoded in the calling thread */
+};
+
+void usage(void)
+{
+    fprintf(stderr,
+        "miri_iqz, decoder for compressed miri_sdr recordings\n\n"
+        "Usage:\t miri_iqz [-options] infile outfile\n"
+        "\t[-j threads (default: 4)]\n"
+        "\t[-s first sample index to output (default: 0, from the start)]\n"
+        "\t[-n number of samples to output (default: 0, all)]\n"
+        "\t[-l list the chunks and exit]\n"
+        "\t[-c compress a raw file instead (S16 I/Q unless -w 1)]\n"
+        "\t[-w sample width in bytes for -c and -B (default: 2)]\n"
+        "\t[-E disable the entropy stage for -c and -B]\n"
+        "\t[-B benchmark the codec on a raw file, no outfile needed]\n"
+        "\tfilenames ('-' means stdin/stdout)\n\n");
+    exit(1);
+}
+
+static double now(void)
+{
+#if !defined (_WIN32) || defined(__MINGW32__)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#else
+    return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+static FILE *open_file(const char *name, const char *mode)
+{
+    FILE *f;
+
+    if (strcmp(name, "-") == 0) {
+        f = (mode[0] == 'r') ? stdin : stdout;
+#ifdef _WIN32
+        _setmode(_fileno(f), _O_BINARY);
+#endif
+        return f;
+    }
+    f = fopen(name, mode);
+    if (!f)
+        fprintf(stderr, "Failed to open %s\n", name);
+    return f;
+}
+
+static void *decode_thread_fn(void *arg)
+{
+    struct decode_job *j = arg;
+
+    j->result = iqz_decode_chunk(&j->header, j->payload, j->samples);
+    return 0;
+}
+
+/* read one chunk, the payload is padded for the bit reader */
+static int read_chunk(FILE *in, struct decode_job *j)
+{
+    uint8_t header[IQZ_HEADER_SIZE];
+    size_t n;
+
+    n = fread(header, 1, IQZ_HEADER_SIZE, in);
+    if (n == 0)
+        return 0;
+    if (n != IQZ_HEADER_SIZE || iqz_read_header(header, &j->header) < 0) {
+        fprintf(stderr, "Corrupted chunk header\n");
+        return -1;
+    }
+    if (fread(j->payload, 1, j->header.payload, in) != j->header.payload) {
+        fprintf(stderr, "Truncated chunk\n");
+        return -1;
+    }
+    memset(j->payload + j->header.payload, 0, 8);
+    return 1;
+}
+
+static int write_range(FILE *out, struct decode_job *j, uint64_t first, uint64_t *left)
+{
+    uint64_t start = 0, count = j->header.samples;
+    size_t pair = 2 * j->header.width;
+
+    /* cut the chunk down to the requested window */
+    if (j->header.index + count <= first)
+        return 0;
+    if (j->header.index < first)
+        start = first - j->header.index;
+    count -= start;
+    if (*left && count > *left)
+        count = *left;
+
+    if (fwrite(j->samples + start * pair, pair, count, out) != count) {
+        fprintf(stderr, "Short write, exiting!\n");
+        return -1;
+    }
+    if (*left) {
+        *left -= count;
+        if (!*left)
+            return 1;
+    }
+    return 0;
+}
+
+static int decode_file(FILE *in, FILE *out, int threads, uint64_t first, uint64_t count, int list)
+{
+    struct decode_job jobs[MAXIMAL_THREADS];
+    uint64_t left = count;
+    int i, n, r = 0, done = 0;
+
+    for (i = 0; i < threads; i++) {
+        jobs[i].payload = malloc(iqz_chunk_bound(IQZ_CHUNK_SAMPLES) + 8);
+        jobs[i].samples = malloc(IQZ_CHUNK_SAMPLES * 4);
+    }
+
+    while (!done) {
+        /* read a batch of chunks, skipping those before the window */
+        for (n = 0; n < threads; ) {
+            r = read_chunk(in, &jobs[n]);
+            if (r <= 0)
+                break;
+            if (list) {
+                printf("index %llu, samples %u, width %d, shift %d, flags %d, %u bytes\n",
+                    (unsigned long long)jobs[n].header.index, jobs[n].header.samples,
+                    jobs[n].header.width, jobs[n].header.shift, jobs[n].header.flags,
+                    jobs[n].header.payload + IQZ_HEADER_SIZE);
+                continue;
+            }
+            if (jobs[n].header.index + jobs[n].header.samples <= first)
+                continue;
+            n++;
+        }
+        if (r <= 0)
+            done = 1;
+
+        /* a thread that can't be started costs only time */
+        for (i = 0; i < n; i++) {
+            jobs[i].threaded = !pthread_create(&jobs[i].thread, NULL, decode_thread_fn, &jobs[i]);
+            if (!jobs[i].threaded)
+                decode_thread_fn(&jobs[i]);
+        }
+        for (i = 0; i < n; i++) {
+            if (jobs[i].threaded)
+                pthread_join(jobs[i].thread, NULL);
+        }
+
+        for (i = 0; i < n; i++) {
+            if (jobs[i].result < 0) {
+                fprintf(stderr, "Corrupted chunk at index %llu\n",
+                    (unsigned long long)jobs[i].header.index);
+                r = -1;
+                done = 1;
+                break;
+            }
+            if ((r = write_range(out, &jobs[i], first, &left)) != 0) {
+                done = 1;
+                break;
+            }
+        }
+    }
+
+    for (i = 0; i < threads; i++) {
+        free(jobs[i].payload);
+        free(jobs[i].samples);
+    }
+    return r < 0 ? r : 0;
+}
+
+static int compress_file(FILE *in, FILE *out, int threads, int width, int flags)
+{
+    iqz_encoder_t *e;
+    uint8_t *buf;
+    size_t n;
+    uint64_t index = 0;
+    int r = 0;
+
+    buf = malloc(IQZ_CHUNK_SAMPLES * 2 * width);
+    e = iqz_encoder_open(out, threads, width, flags);
+    if (!buf || !e) {
+        fprintf(stderr, "Failed to start the compressor\n");
+        free(buf);
+        return -1;
+    }
+    while ((n = fread(buf, 1, IQZ_CHUNK_SAMPLES * 2 * width, in)) > 0) {
+        if (iqz_encoder_write(e, buf, n, index) < 0) {
+            r = -1;
+            break;
+        }
+        index += n / (2 * width);
+    }
+    if (iqz_encoder_close(e) < 0)
+        r = -1;
+    free(buf);
+    return r;
+}
+
+static int benchmark(FILE *in, int threads, int width, int flags)
+{
+    uint8_t *raw, *packed, *decoded, *p;
+    size_t len = 0, alloc = 1 << 24, n, packed_len = 0;
+    uint32_t chunk = IQZ_CHUNK_SAMPLES * 2 * width, samples;
+    struct iqz_header h;
+    uint64_t total;
+    double t0, t1, t2;
+    int i;
+
+    raw = malloc(alloc);
+    while ((n = fread(raw + len, 1, alloc - len, in)) > 0) {
+        len += n;
+        if (len == alloc) {
+            alloc *= 2;
+            raw = realloc(raw, alloc);
+        }
+    }
+    len -= len % (2 * width);
+    total = len / (2 * width);
+    if (!total) {
+        fprintf(stderr, "No input samples\n");
+        return -1;
+    }
+
+    packed = malloc((len / chunk + 1) * iqz_chunk_bound(IQZ_CHUNK_SAMPLES) + 8);
+    decoded = malloc(len);
+
+    /* single thread encode, the pool scales this by the number of workers */
+    t0 = now();
+    for (n = 0; n < len; n += chunk) {
+        samples = (len - n < chunk ? len - n : chunk) / (2 * width);
+        packed_len += iqz_encode_chunk(raw + n, samples, width, n / (2 * width),
+            flags, packed + packed_len);
+    }
+    t1 = now();
+    for (p = packed, n = 0; p < packed + packed_len; n += h.samples * 2 * width) {
+        iqz_read_header(p, &h);
+        if (iqz_decode_chunk(&h, p + IQZ_HEADER_SIZE, decoded + n) < 0) {
+            fprintf(stderr, "Decode failed\n");
+            return -1;
+        }
+        p += IQZ_HEADER_SIZE + h.payload;
+    }
+    t2 = now();
+
+    if (memcmp(raw, decoded, len)) {
+        fprintf(stderr, "Round trip mismatch!\n");
+        return -1;
+    }
+
+    fprintf(stderr, "%llu samples, %d bit containers, entropy stage %s\n",
+        (unsigned long long)total, 8 * width, (flags & IQZ_FLAG_ENTROPY) ? "on" : "off");
+    fprintf(stderr, "ratio:  %.3f (%.2f bits per I/Q value)\n",
+        (double)packed_len / len, 4.0 * packed_len / total);
+    fprintf(stderr, "encode: %.1f Msps per thread, %.1f MB/s\n",
+        total / (t1 - t0) / 1e6, len / (t1 - t0) / 1e6);
+    fprintf(stderr, "decode: %.1f Msps per thread, %.1f MB/s\n",
+        total / (t2 - t1) / 1e6, len / (t2 - t1) / 1e6);
+
+    /* the same through the worker pool, to a null sink */
+    for (i = 1; i <= threads; i *= 2) {
+        FILE *null = fopen(
+#ifdef _WIN32
+            "NUL",
+#else
+            "/dev/null",
+#endif
+            "wb");
+        iqz_encoder_t *e = iqz_encoder_open(null, i, width, flags);
+        if (!e) {
+            fprintf(stderr, "Failed to start the compressor\n");
+            fclose(null);
+            break;
+        }
+        t0 = now();
+        for (n = 0; n < len; n += chunk)
+            iqz_encoder_write(e, raw + n, len - n < chunk ? len - n : chunk, n / (2 * width));
+        iqz_encoder_close(e);
+        t1 = now();
+        fclose(null);
+        fprintf(stderr, "pool:   %2d threads, %.1f Msps\n", i, total / (t1 - t0) / 1e6);
+    }
+
+    free(raw);
+    free(packed);
+    free(decoded);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int opt, r;
+    int threads = DEFAULT_THREADS;
+    int width = 2;
+    int flags = IQZ_FLAG_ENTROPY;
+    int compress = 0, bench = 0, list = 0;
+    uint64_t first = 0, count = 0;
+    FILE *in, *out = NULL;
+
+    while ((opt = getopt(argc, argv, "j:s:n:w:lcEBh")) != -1) {
+        switch (opt) {
+        case 'j':
+            threads = atoi(optarg);
+            break;
+        case 's':
+            first = strtoull(optarg, NULL, 10);
+            break;
+        case 'n':
+            count = strtoull(optarg, NULL, 10);
+            break;
+        case 'w':
+            width = atoi(optarg);
+            break;
+        case 'l':
+            list = 1;
+            break;
+        case 'c':
+            compress = 1;
+            break;
+        case 'E':
+            flags &= ~IQZ_FLAG_ENTROPY;
+            break;
+        case 'B':
+            bench = 1;
+            break;
+        case 'h':
+        default:
+            usage();
+            break;
+        }
+    }
+
+    if (threads < 1 || threads > MAXIMAL_THREADS) {
+        fprintf(stderr, "Threads must be between 1 and %d\n", MAXIMAL_THREADS);
+        exit(1);
+    }
+    if (width != 1 && width != 2) {
+        fprintf(stderr, "Sample width must be 1 or 2\n");
+        exit(1);
+    }
+    if (argc <= optind || (!bench && !list && argc <= optind + 1))
+        usage();
+
+    if (!(in = open_file(argv[optind], "rb")))
+        exit(1);
+
+    if (bench) {
+        r = benchmark(in, threads, width, flags);
+    } else if (list) {
+        r = decode_file(in, NULL, 1, 0, 0, 1);
+    } else {
+        if (!(out = open_file(argv[optind + 1], "wb")))
+            exit(1);
+        if (compress)
+            r = compress_file(in, out, threads, width, flags);
+        else
+            r = decode_file(in, out, threads, first, count, 0);
+    }
+
+    if (in != stdin)
+        fclose(in);
+    if (out && out != stdout)
+        fclose(out);
+    return r < 0 ? 1 : 0;
+}
@@ -134,6 +134,9 @@ void usage(void)
 		"\t[-g tuner_gain (default: automatic)]\n"
 		"\t[-p ppm_error (default: 0)]\n"
 		"\t[-T enable bias-T on GPIO PIN 0 (works for rtl-sdr.com v3 dongles)]\n"
+		"\t[-X fifo[:prio]|rr[:prio] realtime scheduling of the streaming thread]\n"
+		"\t[-C cpu_list pin the streaming thread, e.g. 2 or 0,2-3]\n"
+		"\t[-L buffers|all lock the sample buffers or the whole process in RAM]\n"
 		"\tfilename (a '-' dumps samples to stdout)\n"
 		"\t (omitting the filename also uses stdout)\n"
 		"\n"
@@ -782,6 +785,9 @@ int main(int argc, char **argv)
 	int direct_sampling = 0;
 	int offset_tuning = 0;
 	int enable_biastee = 0;
+	char *realtime = NULL;
+	char *cpu_list = NULL;
+	char *mlock_mode = NULL;
 	double crop = 0.0;
 	char *freq_optarg;
 	time_t next_tick;
@@ -792,7 +798,7 @@ int main(int argc, char **argv)
 	double (*window_fn)(int, int) = rectangle;
 	freq_optarg = "";
 
-	while ((opt = getopt(argc, argv, "f:i:s:t:d:g:p:e:w:c:F:1PDOhT")) != -1) {
+	while ((opt = getopt(argc, argv, "f:i:s:t:d:g:p:e:w:c:F:X:C:L:1PDOhT")) != -1) {
 		switch (opt) {
 		case 'f': // lower:upper:bin_size
 			freq_optarg = strdup(optarg);
@@ -863,6 +869,15 @@ int main(int argc, char **argv)
 		case 'T':
 			enable_biastee = 1;
 			break;
+		case 'X':
+			realtime = optarg;
+			break;
+		case 'C':
+			cpu_list = optarg;
+			break;
+		case 'L':
+			mlock_mode = optarg;
+			break;
 		case 'h':
 		default:
 			usage();
@@ -939,6 +954,13 @@ int main(int argc, char **argv)
 
 	verbose_ppm_set(dev, ppm_error);
 
+	if (realtime) {
+		verbose_set_realtime(dev, realtime);}
+	if (cpu_list) {
+		verbose_set_affinity(dev, cpu_list);}
+	if (mlock_mode) {
+		verbose_set_mlock(dev, mlock_mode);}
+
 	mirisdr_set_bias(dev, enable_biastee);
 	if (enable_biastee)
 		fprintf(stderr, "activated bias-T on GPIO PIN 0\n");
@@ -32,17 +32,74 @@
 #include "getopt/getopt.h"
 #endif
 
+#if !defined (_WIN32) || defined(__MINGW32__)
+#include <sys/time.h>
+#endif
+
+#include <time.h>
+#include <pthread.h>
+
 #include "mirisdr.h"
 #include "convenience/convenience.h"
+#include "convenience/iqz.h"
 
 #define DEFAULT_SAMPLE_RATE       2048000
 #define DEFAULT_BUF_LENGTH        (16 * 16384)
 #define MINIMAL_BUF_LENGTH        512
 #define MAXIMAL_BUF_LENGTH        (256 * 16384)
+#define SEGMENT_QUEUE_LENGTH      64
+#define SEGMENT_QUEUE_MAX_BYTES   (1024ULL * 1024 * 1024)
 
 static int do_exit = 0;
 static uint32_t bytes_to_read = 0;
 static mirisdr_dev_t *dev = NULL;
+static unsigned char *sink_reserved = NULL;
+
+struct segment_block
+{
+    uint8_t  *buf;
+    uint32_t len;
+    uint64_t index;
+};
+
+struct segment_capture
+{
+    uint64_t sample_start;
+    uint64_t global_index;
+};
+
+struct segment_state
+{
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    struct segment_block *blocks;
+    int      size, head, tail, count;
+    uint32_t block_size;
+    int      exit_flag;
+    int      failed;
+    int      lost;          /* the writer fell behind, nothing after lost_index */
+    uint64_t lost_index;
+
+    char     *basename;
+    int      number;
+    FILE     *file;
+    FILE     *next_file;
+    uint64_t max_bytes;
+    uint64_t written;
+    int      sample_bytes;
+    const char *datatype;
+    uint32_t rate;
+    uint32_t freq;
+
+    /* wall clock of the first received sample, for core:datetime */
+    int      started;
+    uint64_t start_index;
+    double   start_time;
+    uint64_t expected_index;
+    struct segment_capture *captures;
+    int      capture_count, capture_alloc;
+};
 
 void usage(void)
 {
@@ -84,6 +141,21 @@ void usage(void)
         "\t[-b output_block_size (default: 16 * 16384)]\n"
         "\t[-n number of samples to read (default: 0, infinite)]\n"
         "\t[-S force sync output (default: async)]\n"
+        "\t[-R segment_size, roll output files at this size [bytes] (default: off)]\n"
+        "\t[-t segment_duration, roll output files after this time [s] (default: off)]\n"
+        "\t    segments are written as filename-NNNNN.sigmf-data\n"
+        "\t    with a SigMF .sigmf-meta sidecar each\n"
+        "\t[-M write through a memory mapped file, zero copy (default: off)]\n"
+        "\t[-z compress the output losslessly (default: off)]\n"
+        "\t    1:      bit packing only\n"
+        "\t    2:      bit packing and Rice coding\n"
+        "\t    decode with miri_iqz\n"
+        "\t[-j number of compressing threads (default: 2)]\n"
+        "\t[-X fifo[:prio]|rr[:prio] realtime scheduling of the streaming thread]\n"
+        "\t[-C cpu_list pin the streaming thread, e.g. 2 or 0,2-3]\n"
+        "\t[-L buffers|all lock the sample buffers or the whole process in RAM]\n"
+        "\t[-T trace.json, dump a latency trace of the last transfers at exit]\n"
+        "\t    needs a library built with -DTRACE=ON, open in Perfetto\n"
         "\tfilename (a '-' dumps samples to stdout)\n\n");
     exit(1);
 }
@@ -133,6 +205,423 @@ static void mirisdr_callback(unsigned char *buf, uint32_t len, void *ctx)
     }
 }
 
+static unsigned char *sink_buffer(uint32_t len, void *ctx)
+{
+    sink_reserved = mirisdr_mmap_sink_reserve((mirisdr_mmap_sink_t*)ctx, len);
+    return sink_reserved;
+}
+
+static void sink_callback(unsigned char *buf, uint32_t len, void *ctx)
+{
+    mirisdr_mmap_sink_t *sink = ctx;
+    int r;
+
+    if (do_exit)
+        return;
+
+    if ((bytes_to_read > 0) && (bytes_to_read < len)) {
+        len = bytes_to_read;
+        do_exit = 1;
+        mirisdr_cancel_async(dev);
+    }
+
+    /* the library unpacked straight into the mapping unless reserving failed */
+    if (buf == sink_reserved)
+        r = mirisdr_mmap_sink_commit(sink, len);
+    else
+        r = mirisdr_mmap_sink_write(sink, buf, len);
+    sink_reserved = NULL;
+
+    if (r < 0) {
+        fprintf(stderr, "Short write, samples lost, exiting!\n");
+        mirisdr_cancel_async(dev);
+    }
+
+    if (bytes_to_read > 0)
+        bytes_to_read -= len;
+}
+
+static double wall_time(void)
+{
+#if !defined (_WIN32) || defined(__MINGW32__)
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (double)tv.tv_sec + (double)tv.tv_usec * 1e-6;
+#else
+    return (double)time(NULL);
+#endif
+}
+
+/* of one I/Q sample in the -m format, AUTO always picks one of the 16 bit formats */
+static int sample_bytes(uint32_t format)
+{
+    return (format == 1) ? 2 : 4;
+}
+
+static void segment_filename(struct segment_state *s, int number, const char *ext, char *out, size_t len)
+{
+    snprintf(out, len, "%s-%05d.%s", s->basename, number, ext);
+}
+
+static FILE *segment_open(struct segment_state *s, int number)
+{
+    char name[1024];
+    FILE *f;
+
+    segment_filename(s, number, "sigmf-data", name, sizeof(name));
+    f = fopen(name, "wb");
+    if (!f)
+        fprintf(stderr, "Failed to open %s\n", name);
+    return f;
+}
+
+static int segment_write_meta(struct segment_state *s)
+{
+    char name[1024];
+    char date[64];
+    FILE *f;
+    int i;
+    double t;
+    time_t sec;
+    struct tm *tm;
+
+    segment_filename(s, s->number, "sigmf-meta", name, sizeof(name));
+    f = fopen(name, "w");
+    if (!f) {
+        fprintf(stderr, "Failed to open %s\n", name);
+        return -1;
+    }
+
+    fprintf(f, "{\n"
+        "    \"global\": {\n"
+        "        \"core:datatype\": \"%s\",\n"
+        "        \"core:sample_rate\": %u,\n"
+        "        \"core:version\": \"1.0.0\",\n"
+        "        \"core:recorder\": \"miri_sdr\"\n"
+        "    },\n"
+        "    \"captures\": [",
+        s->datatype, s->rate);
+
+    for (i = 0; i < s->capture_count; i++) {
+        /* time of the capture derived from the sample counter */
+        t = s->start_time + (double)(s->captures[i].global_index - s->start_index) / s->rate;
+        sec = (time_t)t;
+        tm = gmtime(&sec);
+        strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", tm);
+        fprintf(f, "%s\n"
+            "        {\n"
+            "            \"core:sample_start\": %llu,\n"
+            "            \"core:global_index\": %llu,\n"
+            "            \"core:frequency\": %u,\n"
+            "            \"core:datetime\": \"%s.%06dZ\"\n"
+            "        }",
+            i ? "," : "",
+            (unsigned long long)s->captures[i].sample_start,
+            (unsigned long long)s->captures[i].global_index,
+            s->freq, date, (int)((t - (double)sec) * 1e6));
+    }
+
+    fprintf(f, "\n    ],\n"
+        "    \"annotations\": []\n"
+        "}\n");
+
+    return fclose(f);
+}
+
+static int segment_capture_add(struct segment_state *s, uint64_t index)
+{
+    struct segment_capture *c;
+
+    if (s->capture_count == s->capture_alloc) {
+        s->capture_alloc = s->capture_alloc ? 2 * s->capture_alloc : 8;
+        c = realloc(s->captures, s->capture_alloc * sizeof(*c));
+        if (!c)
+            return -1;
+        s->captures = c;
+    }
+
+    c = &s->captures[s->capture_count++];
+    c->sample_start = s->written / s->sample_bytes;
+    c->global_index = index;
+    return 0;
+}
+
+/* close the current segment and switch to the pre-opened next one */
+static int segment_roll(struct segment_state *s)
+{
+    if (fclose(s->file) != 0) {
+        fprintf(stderr, "Failed to close segment %d\n", s->number);
+        return -1;
+    }
+    if (segment_write_meta(s) < 0)
+        return -1;
+
+    s->number++;
+    s->file = s->next_file;
+    s->written = 0;
+    s->capture_count = 0;
+
+    /* open the following one now, so the next roll does not wait on the filesystem */
+    s->next_file = segment_open(s, s->number + 1);
+    if (!s->file || !s->next_file)
+        return -1;
+    return 0;
+}
+
+static int segment_write(struct segment_state *s, uint8_t *buf, uint32_t len, uint64_t index)
+{
+    uint64_t n;
+
+    if (!s->started) {
+        s->start_index = index;
+        s->started = 1;
+    }
+
+    while (len > 0) {
+        if (s->capture_count == 0 || index != s->expected_index) {
+            if (segment_capture_add(s, index) < 0)
+                return -1;
+        }
+
+        n = s->max_bytes - s->written;
+        if (n > len)
+            n = len;
+
+        if (fwrite(buf, 1, n, s->file) != n) {
+            fprintf(stderr, "Short write, samples lost, exiting!\n");
+            return -1;
+        }
+
+        s->written += n;
+        buf += n;
+        len -= n;
+        index += n / s->sample_bytes;
+        s->expected_index = index;
+
+        if (s->written == s->max_bytes && segment_roll(s) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+static void *segment_thread_fn(void *arg)
+{
+    struct segment_state *s = arg;
+    struct segment_block b;
+
+    while (1) {
+        pthread_mutex_lock(&s->lock);
+        while (s->count == 0 && !s->exit_flag)
+            pthread_cond_wait(&s->ready, &s->lock);
+        if (s->count == 0) {
+            pthread_mutex_unlock(&s->lock);
+            break;
+        }
+        /* a copy, the queue may grow meanwhile, the buffer stays */
+        b = s->blocks[s->tail];
+        pthread_mutex_unlock(&s->lock);
+
+        if (!s->failed && segment_write(s, b.buf, b.len, b.index) < 0) {
+            s->failed = 1;
+            do_exit = 1;
+            mirisdr_cancel_async(dev);
+        }
+
+        pthread_mutex_lock(&s->lock);
+        s->tail = (s->tail + 1) % s->size;
+        s->count--;
+        pthread_mutex_unlock(&s->lock);
+    }
+
+    return 0;
+}
+
+static void iqz_callback(unsigned char *buf, uint32_t len, void *ctx)
+{
+    if (do_exit)
+        return;
+
+    if ((bytes_to_read > 0) && (bytes_to_read < len)) {
+        len = bytes_to_read;
+        do_exit = 1;
+        mirisdr_cancel_async(dev);
+    }
+
+    if (iqz_encoder_write((iqz_encoder_t*)ctx, buf, len, mirisdr_get_sample_index(dev)) < 0) {
+        fprintf(stderr, "Short write, samples lost, exiting!\n");
+        mirisdr_cancel_async(dev);
+    }
+
+    if (bytes_to_read > 0)
+        bytes_to_read -= len;
+}
+
+/* without the writer thread, also what a failed segment_init left behind */
+static void segment_free(struct segment_state *s)
+{
+    char name[1024];
+    int i;
+
+    if (s->file) {
+        fclose(s->file);
+        if (s->written)
+            segment_write_meta(s);
+        else {
+            segment_filename(s, s->number, "sigmf-data", name, sizeof(name));
+            remove(name);
+        }
+    }
+    /* the pre-opened segment never received data */
+    if (s->next_file) {
+        fclose(s->next_file);
+        segment_filename(s, s->number + 1, "sigmf-data", name, sizeof(name));
+        remove(name);
+    }
+
+    if (s->lost)
+        fprintf(stderr, "The writer fell behind, the recording ends before sample index %llu\n",
+            (unsigned long long)s->lost_index);
+
+    for (i = 0; s->blocks && i < s->size; i++)
+        free(s->blocks[i].buf);
+    free(s->blocks);
+    free(s->captures);
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->ready);
+}
+
+static void segment_cleanup(struct segment_state *s)
+{
+    pthread_mutex_lock(&s->lock);
+    s->exit_flag = 1;
+    pthread_cond_signal(&s->ready);
+    pthread_mutex_unlock(&s->lock);
+    pthread_join(s->thread, NULL);
+
+    segment_free(s);
+}
+
+static int segment_init(struct segment_state *s, char *basename, uint32_t block_size)
+{
+    int i;
+
+    memset(s, 0, sizeof(*s));
+    s->basename = basename;
+    s->block_size = block_size;
+    s->size = SEGMENT_QUEUE_LENGTH;
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->ready, NULL);
+
+    s->blocks = calloc(s->size, sizeof(*s->blocks));
+    if (!s->blocks)
+        goto fail;
+    for (i = 0; i < s->size; i++) {
+        s->blocks[i].buf = malloc(block_size);
+        if (!s->blocks[i].buf)
+            goto fail;
+    }
+
+    s->file = segment_open(s, 0);
+    s->next_file = segment_open(s, 1);
+    if (!s->file || !s->next_file)
+        goto fail;
+
+    if (pthread_create(&s->thread, NULL, segment_thread_fn, s) == 0)
+        return 0;
+fail:
+    segment_free(s);
+    return -1;
+}
+
+/* twice the blocks, the queued ones first, allocated before taking the lock */
+static int segment_grow(struct segment_state *s)
+{
+    struct segment_block *blocks;
+    int i, size = 2 * s->size;
+
+    if ((uint64_t)size * s->block_size > SEGMENT_QUEUE_MAX_BYTES)
+        return -1;
+    blocks = calloc(size, sizeof(*blocks));
+    if (!blocks)
+        return -1;
+    for (i = s->size; i < size; i++) {
+        blocks[i].buf = malloc(s->block_size);
+        if (!blocks[i].buf) {
+            while (--i >= s->size)
+                free(blocks[i].buf);
+            free(blocks);
+            return -1;
+        }
+    }
+
+    pthread_mutex_lock(&s->lock);
+    for (i = 0; i < s->size; i++)
+        blocks[i] = s->blocks[(s->tail + i) % s->size];
+    free(s->blocks);
+    s->blocks = blocks;
+    s->tail = 0;
+    s->head = s->count;
+    s->size = size;
+    pthread_mutex_unlock(&s->lock);
+
+    fprintf(stderr, "The writer falls behind, %d blocks queued\n", s->count);
+    return 0;
+}
+
+/* nothing is dropped: the queue grows, and when it can't, the recording ends */
+static void segment_callback(unsigned char *buf, uint32_t len, void *ctx)
+{
+    struct segment_state *s = ctx;
+    struct segment_block *b;
+    int full;
+
+    if (do_exit)
+        return;
+
+    if ((bytes_to_read > 0) && (bytes_to_read < len)) {
+        len = bytes_to_read;
+        do_exit = 1;
+        mirisdr_cancel_async(dev);
+    }
+
+    if (!s->start_time)
+        s->start_time = wall_time() - (double)len / s->sample_bytes / s->rate;
+
+    /* only this thread fills the queue, it can't become full meanwhile */
+    pthread_mutex_lock(&s->lock);
+    full = (s->count == s->size);
+    pthread_mutex_unlock(&s->lock);
+
+    if (full && segment_grow(s) < 0) {
+        s->lost = 1;
+        s->lost_index = mirisdr_get_sample_index(dev);
+        fprintf(stderr, "The writer fell behind by %d blocks, stopping before sample index %llu!\n",
+            s->size, (unsigned long long)s->lost_index);
+        do_exit = 1;
+        mirisdr_cancel_async(dev);
+        return;
+    }
+
+    pthread_mutex_lock(&s->lock);
+    b = &s->blocks[s->head];
+    pthread_mutex_unlock(&s->lock);
+
+    /* only the writer thread touches the tail, the head slot is ours */
+    memcpy(b->buf, buf, len);
+    b->len = len;
+    b->index = mirisdr_get_sample_index(dev);
+
+    pthread_mutex_lock(&s->lock);
+    s->head = (s->head + 1) % s->size;
+    s->count++;
+    pthread_cond_signal(&s->ready);
+    pthread_mutex_unlock(&s->lock);
+
+    if (bytes_to_read > 0)
+        bytes_to_read -= len;
+}
+
 int main(int argc, char **argv)
 {
 #ifndef _WIN32
@@ -166,8 +655,20 @@ int main(int argc, char **argv)
     uint32_t rates[100];
     mirisdr_hw_flavour_t hw_flavour = MIRISDR_HW_DEFAULT;
     int intval;
+    uint64_t segment_size = 0;
+    double segment_time = 0.0;
+    struct segment_state segment;
+    int mmap_mode = 0;
+    mirisdr_mmap_sink_t *sink = NULL;
+    int compress = 0;
+    int compress_threads = 2;
+    iqz_encoder_t *encoder = NULL;
+    char *trace_filename = NULL;
+    char *realtime = NULL;
+    char *cpu_list = NULL;
+    char *mlock_mode = NULL;
 
-    while ((opt = getopt(argc, argv, "b:d:D:e:f:g:p:i:m:s:w:n:S::")) != -1) {
+    while ((opt = getopt(argc, argv, "b:d:D:e:f:g:p:i:m:s:w:n:R:t:z:j:T:X:C:L:MS::")) != -1) {
         switch (opt) {
         case 'b':
             out_block_size = (uint32_t)atof(optarg);
@@ -226,6 +727,33 @@ int main(int argc, char **argv)
         case 'S':
             sync_mode = 1;
             break;
+        case 'R':
+            segment_size = (uint64_t)atofs(optarg);
+            break;
+        case 't':
+            segment_time = atoft(optarg);
+            break;
+        case 'M':
+            mmap_mode = 1;
+            break;
+        case 'z':
+            compress = atoi(optarg);
+            break;
+        case 'j':
+            compress_threads = atoi(optarg);
+            break;
+        case 'T':
+            trace_filename = optarg;
+            break;
+        case 'X':
+            realtime = optarg;
+            break;
+        case 'C':
+            cpu_list = optarg;
+            break;
+        case 'L':
+            mlock_mode = optarg;
+            break;
         default:
             usage();
             break;
@@ -238,6 +766,27 @@ int main(int argc, char **argv)
         filename = argv[optind];
     }
 
+    if ((segment_size || segment_time > 0) &&
+        (sync_mode || mmap_mode || strcmp(filename, "-") == 0)) {
+        fprintf(stderr, "Segmented output needs async mode and a filename.\n");
+        exit(1);
+    }
+
+    if (mmap_mode && (sync_mode || strcmp(filename, "-") == 0)) {
+        fprintf(stderr, "Memory mapped output needs async mode and a filename.\n");
+        exit(1);
+    }
+
+    if (compress && (sync_mode || mmap_mode || segment_size || segment_time > 0)) {
+        fprintf(stderr, "Compressed output needs async mode and a plain file.\n");
+        exit(1);
+    }
+
+    if (compress < 0 || compress > 2 || compress_threads < 1) {
+        fprintf(stderr, "Invalid compression settings.\n");
+        exit(1);
+    }
+
     if(out_block_size < MINIMAL_BUF_LENGTH ||
        out_block_size > MAXIMAL_BUF_LENGTH ){
         fprintf(stderr,
@@ -342,7 +891,44 @@ int main(int argc, char **argv)
 	}
     verbose_ppm_set(dev, ppm_error);
 
-    if(strcmp(filename, "-") == 0) { /* Write samples to stdout */
+    if (realtime)
+        verbose_set_realtime(dev, realtime);
+    if (cpu_list)
+        verbose_set_affinity(dev, cpu_list);
+    if (mlock_mode)
+        verbose_set_mlock(dev, mlock_mode);
+
+    if (segment_size || segment_time > 0) {
+        file = NULL;
+        if (segment_init(&segment, filename, out_block_size) < 0) {
+            fprintf(stderr, "Failed to set up segmented output\n");
+            r = -1;
+            goto close;
+        }
+        segment.rate = samp_rate;
+        segment.freq = mirisdr_get_center_freq(dev);
+        segment.sample_bytes = sample_bytes(format);
+        segment.datatype = (segment.sample_bytes == 2) ? "ci8" : "ci16_le";
+        if (segment_time > 0) {
+            segment.max_bytes = (uint64_t)(segment_time * samp_rate) * segment.sample_bytes;
+        }
+        if (segment_size && (!segment.max_bytes || segment_size < segment.max_bytes)) {
+            segment.max_bytes = segment_size;
+        }
+        /* segments always end on a whole I/Q sample */
+        segment.max_bytes -= segment.max_bytes % segment.sample_bytes;
+        if (!segment.max_bytes) {
+            segment.max_bytes = segment.sample_bytes;
+        }
+    } else if (mmap_mode) {
+        file = NULL;
+        if (mirisdr_mmap_sink_open(&sink, filename, 0) < 0) {
+            fprintf(stderr, "Failed to open %s\n", filename);
+            r = -1;
+            goto close;
+        }
+        mirisdr_set_async_buffer(dev, sink_buffer, sink);
+    } else if(strcmp(filename, "-") == 0) { /* Write samples to stdout */
         file = stdout;
 #ifdef _WIN32
         _setmode(_fileno(stdin), _O_BINARY);
@@ -351,10 +937,26 @@ int main(int argc, char **argv)
         file = fopen(filename, "wb");
         if (!file) {
             fprintf(stderr, "Failed to open %s\n", filename);
-            goto out;
+            r = -1;
+            goto close;
+        }
+    }
+
+    if (compress && file) {
+        encoder = iqz_encoder_open(file, compress_threads, sample_bytes(format) / 2,
+                                   (compress == 2) ? IQZ_FLAG_ENTROPY : 0);
+        if (!encoder) {
+            fprintf(stderr, "Failed to start the compressor\n");
+            r = -1;
+            goto stop;
         }
     }
 
+    if (trace_filename && mirisdr_trace_start(dev, 0) < 0) {
+        fprintf(stderr, "WARNING: Failed to start tracing, library built without -DTRACE=ON?\n");
+        trace_filename = NULL;
+    }
+
     /* Reset endpoint before we start reading from it (mandatory) */
     verbose_reset_buffer(dev);
 
@@ -385,22 +987,54 @@ int main(int argc, char **argv)
             if (bytes_to_read > 0)
                 bytes_to_read -= n_read;
         }
+    } else if (sink) {
+        fprintf(stderr, "Reading samples in async mode into a memory mapped file...\n");
+        /* unpacked sizes vary, so the bytes of -b are not enforced here */
+        r = mirisdr_read_async(dev, sink_callback, (void *)sink, 0, 0);
+    } else if (encoder) {
+        fprintf(stderr, "Reading samples in async mode, compressing with %d threads...\n",
+                compress_threads);
+        r = mirisdr_read_async(dev, iqz_callback, (void *)encoder,
+                      0, out_block_size);
+    } else if (!file) {
+        fprintf(stderr, "Reading samples in async mode, segments of %llu bytes...\n",
+                (unsigned long long)segment.max_bytes);
+        r = mirisdr_read_async(dev, segment_callback, (void *)&segment,
+                      0, out_block_size);
     } else {
         fprintf(stderr, "Reading samples in async mode...\n");
         r = mirisdr_read_async(dev, mirisdr_callback, (void *)file,
                       0, out_block_size);
     }
 
-    if (do_exit)
+    if (!file && !sink && segment.lost) {
+        fprintf(stderr, "\nWriter too slow, exiting...\n");
+        r = -1;
+    } else if (do_exit)
         fprintf(stderr, "\nUser cancel, exiting...\n");
     else
         fprintf(stderr, "\nLibrary error %d, exiting...\n", r);
 
-    if (file != stdout)
+    if (trace_filename) {
+        if (mirisdr_trace_dump(dev, trace_filename) < 0)
+            fprintf(stderr, "Failed to write the trace to %s\n", trace_filename);
+        else
+            fprintf(stderr, "Trace written to %s\n", trace_filename);
+    }
+
+    if (encoder && iqz_encoder_close(encoder) < 0)
+        fprintf(stderr, "Short write, samples lost!\n");
+
+stop:
+    if (sink)
+        mirisdr_mmap_sink_close(sink);
+    else if (!file)
+        segment_cleanup(&segment);
+    else if (file != stdout)
         fclose(file);
 
+close:
     mirisdr_close(dev);
     free (buffer);
-out:
     return r >= 0 ? r : -r;
 }
@@ -0,0 +1,298 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Output into a memory mapped file
+ *
+ * The file is mapped in windows of a fixed size.  Data is written through
+ * mirisdr_mmap_sink_reserve() / mirisdr_mmap_sink_commit(), which hands out
+ * a pointer into the mapping, so the async unpackers can write samples
+ * directly to the page cache (see mirisdr_set_async_buffer).  Windows which
+ * are no longer written are flushed and unmapped by a background thread.
+ */
+
+#include "mirisdr_private.h"
+
+#ifndef _WIN32
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define DEFAULT_SINK_WINDOW     (64 * 1024 * 1024)
+#define SINK_QUEUE_LENGTH       16
+
+struct mirisdr_mmap_sink_window {
+    unsigned char       *addr;
+    size_t              len;
+};
+
+struct mirisdr_mmap_sink {
+    int                 fd;
+    size_t              page;
+    size_t              window;
+
+    /* aktuální okno */
+    unsigned char       *addr;
+    off_t               addr_off;
+    off_t               file_len;
+    off_t               pos;
+
+    /* okna čekající na uvolnění */
+    pthread_t           thread;
+    pthread_mutex_t     lock;
+    pthread_cond_t      ready;
+    pthread_cond_t      done;
+    struct mirisdr_mmap_sink_window queue[SINK_QUEUE_LENGTH];
+    int                 head, count;
+    int                 exit_flag;
+};
+
+static void *mirisdr_mmap_sink_thread (void *arg) {
+    mirisdr_mmap_sink_t *s = arg;
+    struct mirisdr_mmap_sink_window w;
+
+    pthread_mutex_lock(&s->lock);
+    while (1) {
+        while ((s->count == 0) && (!s->exit_flag))
+            pthread_cond_wait(&s->ready, &s->lock);
+        if (s->count == 0) break;
+
+        w = s->queue[s->head];
+        pthread_mutex_unlock(&s->lock);
+
+        /* write back and drop the pages, they are not read again */
+        msync(w.addr, w.len, MS_ASYNC);
+#ifdef MADV_DONTNEED
+        madvise(w.addr, w.len, MADV_DONTNEED);
+#endif
+        munmap(w.addr, w.len);
+
+        pthread_mutex_lock(&s->lock);
+        s->head = (s->head + 1) % SINK_QUEUE_LENGTH;
+        s->count--;
+        pthread_cond_signal(&s->done);
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    return NULL;
+}
+
+/* hand the current window to the background thread */
+static void mirisdr_mmap_sink_retire (mirisdr_mmap_sink_t *s) {
+    if (!s->addr) return;
+
+    pthread_mutex_lock(&s->lock);
+    while (s->count == SINK_QUEUE_LENGTH)
+        pthread_cond_wait(&s->done, &s->lock);
+    s->queue[(s->head + s->count) % SINK_QUEUE_LENGTH].addr = s->addr;
+    s->queue[(s->head + s->count) % SINK_QUEUE_LENGTH].len = s->window;
+    s->count++;
+    pthread_cond_signal(&s->ready);
+    pthread_mutex_unlock(&s->lock);
+
+    s->addr = NULL;
+}
+
+/* map a new window starting at the page containing the write position */
+static int mirisdr_mmap_sink_map (mirisdr_mmap_sink_t *s) {
+    off_t off = s->pos - (s->pos % s->page);
+    int r;
+
+    mirisdr_mmap_sink_retire(s);
+
+    if (s->file_len < off + (off_t) s->window) {
+#if defined(__linux__)
+        /* reserve the blocks now, a full disk must not turn into SIGBUS */
+        if ((r = posix_fallocate(s->fd, s->file_len, off + s->window - s->file_len)) != 0) {
+            fprintf(stderr, "mmap sink: failed to extend file: %s\n", strerror(r));
+            goto failed;
+        }
+#else
+        if (ftruncate(s->fd, off + s->window) < 0) {
+            fprintf(stderr, "mmap sink: failed to extend file: %s\n", strerror(errno));
+            goto failed;
+        }
+#endif
+        s->file_len = off + s->window;
+    }
+
+    s->addr = mmap(NULL, s->window, PROT_READ | PROT_WRITE, MAP_SHARED, s->fd, off);
+    if (s->addr == MAP_FAILED) {
+        s->addr = NULL;
+        fprintf(stderr, "mmap sink: mmap failed: %s\n", strerror(errno));
+        goto failed;
+    }
+    s->addr_off = off;
+
+#ifdef MADV_SEQUENTIAL
+    madvise(s->addr, s->window, MADV_SEQUENTIAL);
+#endif
+
+    return 0;
+
+failed:
+    return -1;
+}
+
+int mirisdr_mmap_sink_open (mirisdr_mmap_sink_t **out, const char *path, size_t window) {
+    mirisdr_mmap_sink_t *s;
+
+    *out = NULL;
+
+    if (!(s = malloc(sizeof(*s)))) return -ENOMEM;
+    memset(s, 0, sizeof(*s));
+
+    s->page = (size_t) sysconf(_SC_PAGESIZE);
+    s->window = (window) ? window : DEFAULT_SINK_WINDOW;
+    s->window = (s->window + s->page - 1) / s->page * s->page;
+
+    /* a reservation may start anywhere in the first page */
+    if (s->window < 2 * s->page) {
+        fprintf(stderr, "mmap sink: window of %lu bytes is smaller than two pages\n", (unsigned long) s->window);
+        free(s);
+        return -1;
+    }
+
+    if ((s->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) {
+        fprintf(stderr, "mmap sink: failed to open %s: %s\n", path, strerror(errno));
+        free(s);
+        return -1;
+    }
+
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->ready, NULL);
+    pthread_cond_init(&s->done, NULL);
+
+    if (pthread_create(&s->thread, NULL, mirisdr_mmap_sink_thread, s) != 0) {
+        close(s->fd);
+        free(s);
+        return -1;
+    }
+
+    *out = s;
+
+    return 0;
+}
+
+unsigned char *mirisdr_mmap_sink_reserve (mirisdr_mmap_sink_t *s, size_t len) {
+    if (!s) return NULL;
+
+    /* a single reservation has to fit into one window */
+    if (len + s->page > s->window) return NULL;
+
+    if ((!s->addr) ||
+        (s->pos + (off_t) len > s->addr_off + (off_t) s->window)) {
+        if (mirisdr_mmap_sink_map(s) < 0) return NULL;
+    }
+
+    return s->addr + (s->pos - s->addr_off);
+}
+
+int mirisdr_mmap_sink_commit (mirisdr_mmap_sink_t *s, size_t len) {
+    if (!s) goto failed;
+    if (!s->addr) goto failed;
+    if (s->pos + (off_t) len > s->addr_off + (off_t) s->window) goto failed;
+
+    s->pos += len;
+
+    return 0;
+
+failed:
+    return -1;
+}
+
+int mirisdr_mmap_sink_write (mirisdr_mmap_sink_t *s, const void *buf, size_t len) {
+    unsigned char *dst;
+    size_t n;
+
+    while (len > 0) {
+        n = min(len, s->window - s->page);
+        if (!(dst = mirisdr_mmap_sink_reserve(s, n))) goto failed;
+
+        memcpy(dst, buf, n);
+        mirisdr_mmap_sink_commit(s, n);
+
+        buf = (const unsigned char *) buf + n;
+        len -= n;
+    }
+
+    return 0;
+
+failed:
+    return -1;
+}
+
+int mirisdr_mmap_sink_close (mirisdr_mmap_sink_t *s) {
+    int r = 0;
+
+    if (!s) return -1;
+
+    mirisdr_mmap_sink_retire(s);
+
+    pthread_mutex_lock(&s->lock);
+    s->exit_flag = 1;
+    pthread_cond_signal(&s->ready);
+    pthread_mutex_unlock(&s->lock);
+    pthread_join(s->thread, NULL);
+
+    /* cut the preallocated tail */
+    if (ftruncate(s->fd, s->pos) < 0) r = -1;
+    if (close(s->fd) < 0) r = -1;
+
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->ready);
+    pthread_cond_destroy(&s->done);
+    free(s);
+
+    return r;
+}
+
+#else
+
+/* not available on Windows */
+int mirisdr_mmap_sink_open (mirisdr_mmap_sink_t **out, const char *path, size_t window) {
+    (void) path;
+    (void) window;
+    *out = NULL;
+    return -1;
+}
+
+unsigned char *mirisdr_mmap_sink_reserve (mirisdr_mmap_sink_t *s, size_t len) {
+    (void) s;
+    (void) len;
+    return NULL;
+}
+
+int mirisdr_mmap_sink_commit (mirisdr_mmap_sink_t *s, size_t len) {
+    (void) s;
+    (void) len;
+    return -1;
+}
+
+int mirisdr_mmap_sink_write (mirisdr_mmap_sink_t *s, const void *buf, size_t len) {
+    (void) s;
+    (void) buf;
+    (void) len;
+    return -1;
+}
+
+int mirisdr_mmap_sink_close (mirisdr_mmap_sink_t *s) {
+    (void) s;
+    return -1;
+}
+
+#endif
@@ -65,7 +65,7 @@ void update_reg_8(mirisdr_dev_t *p)
     mirisdr_write_reg(p, 0x08, p->reg8|(p->bias?(1<<(BIAS_GPIO+8)):0));
 }
 
-int mirisdr_set_soft(mirisdr_dev_t *p)
+static int mirisdr_set_soft_locked(mirisdr_dev_t *p)
 {
     uint32_t reg0 = 0, reg2 = 2, reg5 = 5, reg3 = 3, regd = 0x0d;
     uint64_t n, thresh, frac, lo_div = 0, fvco = 0, rfvco = 0, offset = 0, afc = 0, a, b, c;
@@ -360,11 +360,24 @@ int mirisdr_set_soft(mirisdr_dev_t *p)
     return 0;
 }
 
+int mirisdr_set_soft(mirisdr_dev_t *p)
+{
+    int r;
+
+    pthread_mutex_lock(&p->ctrl_lock);
+    r = mirisdr_set_soft_locked(p);
+    pthread_mutex_unlock(&p->ctrl_lock);
+
+    return r;
+}
+
 int mirisdr_set_center_freq(mirisdr_dev_t *p, uint32_t freq)
 {
+    pthread_mutex_lock(&p->ctrl_lock);
     p->freq = freq;
     int r = mirisdr_set_soft(p);
     r += mirisdr_set_gain(p); // restore gain
+    pthread_mutex_unlock(&p->ctrl_lock);
     return r;
 }
 
@@ -376,7 +389,9 @@ uint32_t mirisdr_get_center_freq(mirisdr_dev_t *p)
 int mirisdr_set_if_freq(mirisdr_dev_t *p, uint32_t freq)
 {
     if (!p)
-        goto failed;
+        return -1;
+
+    pthread_mutex_lock(&p->ctrl_lock);
 
     switch (freq)
     {
@@ -399,9 +414,12 @@ int mirisdr_set_if_freq(mirisdr_dev_t *p, uint32_t freq)
 
     int r = mirisdr_set_soft(p);
     r += mirisdr_set_gain(p); // restore gain
+    pthread_mutex_unlock(&p->ctrl_lock);
     return r;
 
-    failed: return -1;
+    failed:
+    pthread_mutex_unlock(&p->ctrl_lock);
+    return -1;
 }
 
 uint32_t mirisdr_get_if_freq(mirisdr_dev_t *p)
@@ -461,6 +479,8 @@ int mirisdr_set_bandwidth(mirisdr_dev_t *p, uint32_t bw)
     if (!p)
         return -1;
 
+    pthread_mutex_lock(&p->ctrl_lock);
+
     p->bandwidth = MIRISDR_BW_MAX;
 
     if(bw <= 8000000)
@@ -494,6 +514,7 @@ int mirisdr_set_bandwidth(mirisdr_dev_t *p, uint32_t bw)
     }
     int r = mirisdr_set_soft(p);
     r += mirisdr_set_gain(p); // restore gain
+    pthread_mutex_unlock(&p->ctrl_lock);
     return r;
 }
 
@@ -545,9 +566,13 @@ int mirisdr_set_direct_sampling(mirisdr_dev_t *p, int on)
 
 int mirisdr_set_offset_tuning(mirisdr_dev_t *p, int on)
 {
+    int r;
+
     if (!p)
         goto failed;
 
+    pthread_mutex_lock(&p->ctrl_lock);
+
     if (on)
     {
         p->if_freq = MIRISDR_IF_450KHZ;
@@ -557,7 +582,9 @@ int mirisdr_set_offset_tuning(mirisdr_dev_t *p, int on)
         p->if_freq = MIRISDR_IF_ZERO;
     }
 
-    return mirisdr_set_soft(p);
+    r = mirisdr_set_soft(p);
+    pthread_mutex_unlock(&p->ctrl_lock);
+    return r;
 
     failed: return -1;
 }
@@ -606,8 +633,10 @@ mirisdr_band_t mirisdr_get_band (mirisdr_dev_t *p)
 
 int mirisdr_set_bias (mirisdr_dev_t *p, int bias)
 {
+	pthread_mutex_lock(&p->ctrl_lock);
 	p->bias=bias;
 	update_reg_8(p);
+	pthread_mutex_unlock(&p->ctrl_lock);
 	return 0;
 }
 
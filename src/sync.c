@@ -21,6 +21,9 @@
 int mirisdr_read_sync (mirisdr_dev_t *p, void *buf, int len, int *n_read) {
     if (!p) goto failed;
 
+    /* nastavení vlákna zůstává, čte se opakovaně ze stejného vlákna */
+    if (p->sched_pending) free(mirisdr_thread_enter(p));
+
     return libusb_bulk_transfer(p->dh, 0x81, buf, len, n_read, DEFAULT_BULK_TIMEOUT);
 
 failed:
@@ -0,0 +1,277 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Scheduling of the streaming thread
+ *
+ * The settings are only stored by the setters.  They are applied to the
+ * thread which runs the libusb events, i.e. the caller of mirisdr_read_async
+ * (restored when it returns) or of mirisdr_read_sync (kept).  The worker
+ * threads the library creates for the channels are CPU bound, they keep the
+ * default policy and each runs on one cpu of the list in turn.
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include "mirisdr_private.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+
+/* původní nastavení vlákna */
+struct mirisdr_thread_saved {
+#ifdef _WIN32
+    HANDLE              thread;
+    int                 priority;
+    DWORD_PTR           mask;
+#else
+    pthread_t           thread;
+    int                 policy;
+    struct sched_param  param;
+#if defined(__linux__)
+    cpu_set_t           cpus;
+    int                 cpus_valid;
+#endif
+#endif
+};
+
+int mirisdr_set_realtime (mirisdr_dev_t *p, mirisdr_sched_t policy, int priority) {
+    if (!p) goto failed;
+
+    switch (policy) {
+    case MIRISDR_SCHED_DEFAULT:
+        priority = 0;
+        break;
+    case MIRISDR_SCHED_FIFO:
+    case MIRISDR_SCHED_RR:
+#ifndef _WIN32
+        if ((priority < sched_get_priority_min(SCHED_FIFO)) ||
+            (priority > sched_get_priority_max(SCHED_FIFO))) {
+            fprintf(stderr, "realtime priority %d out of range %d - %d\n", priority,
+                    sched_get_priority_min(SCHED_FIFO), sched_get_priority_max(SCHED_FIFO));
+            goto failed;
+        }
+#endif
+        break;
+    default:
+        goto failed;
+    }
+
+    p->sched_policy = policy;
+    p->sched_priority = priority;
+    p->sched_pending = 1;
+
+    return 0;
+
+failed:
+    return -1;
+}
+
+int mirisdr_set_cpu_affinity (mirisdr_dev_t *p, const int *cpus, int count) {
+    int i, *copy = NULL;
+
+    if (!p) goto failed;
+    if (count < 0) goto failed;
+
+    for (i = 0; i < count; i++) {
+        if (cpus[i] < 0) goto failed;
+    }
+
+    if (count > 0) {
+        if (!(copy = malloc(count * sizeof(*copy)))) goto failed;
+        memcpy(copy, cpus, count * sizeof(*copy));
+    }
+
+    free(p->cpus);
+    p->cpus = copy;
+    p->cpu_count = count;
+    p->sched_pending = 1;
+
+    return 0;
+
+failed:
+    return -1;
+}
+
+int mirisdr_set_mlock (mirisdr_dev_t *p, mirisdr_mlock_t mode) {
+    if (!p) goto failed;
+
+    /* buffery se zamykají při alokaci */
+    if (mirisdr_async_get(p) != MIRISDR_ASYNC_INACTIVE) goto failed;
+
+    switch (mode) {
+    case MIRISDR_MLOCK_OFF:
+    case MIRISDR_MLOCK_BUFFERS:
+    case MIRISDR_MLOCK_ALL:
+        break;
+    default:
+        goto failed;
+    }
+
+    p->mlock = mode;
+    p->sched_pending = 1;
+
+    return 0;
+
+failed:
+    return -1;
+}
+
+/* apply the settings to the calling thread, returns what to restore or NULL */
+void *mirisdr_thread_enter (mirisdr_dev_t *p) {
+    struct mirisdr_thread_saved *s;
+    int i;
+#ifndef _WIN32
+    struct sched_param param;
+#else
+    DWORD_PTR mask = 0;
+#endif
+
+    p->sched_pending = 0;
+
+    if ((p->sched_policy == MIRISDR_SCHED_DEFAULT) &&
+        (p->cpu_count == 0) &&
+        (p->mlock != MIRISDR_MLOCK_ALL)) return NULL;
+
+    if (!(s = malloc(sizeof(*s)))) return NULL;
+    memset(s, 0, sizeof(*s));
+
+#ifdef _WIN32
+    s->thread = GetCurrentThread();
+    s->priority = GetThreadPriority(s->thread);
+
+    if (p->sched_policy != MIRISDR_SCHED_DEFAULT) {
+        if (!SetThreadPriority(s->thread, THREAD_PRIORITY_TIME_CRITICAL))
+            fprintf(stderr, "failed to raise the priority of the streaming thread\n");
+    }
+
+    if (p->cpu_count > 0) {
+        for (i = 0; i < p->cpu_count; i++) {
+            if (p->cpus[i] < (int) (8 * sizeof(mask))) mask |= (DWORD_PTR) 1 << p->cpus[i];
+        }
+        if (!(s->mask = SetThreadAffinityMask(s->thread, mask)))
+            fprintf(stderr, "failed to set the cpu affinity of the streaming thread\n");
+    }
+#else
+    s->thread = pthread_self();
+    pthread_getschedparam(s->thread, &s->policy, &s->param);
+
+    if (p->sched_policy != MIRISDR_SCHED_DEFAULT) {
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = p->sched_priority;
+        if ((i = pthread_setschedparam(s->thread,
+                 (p->sched_policy == MIRISDR_SCHED_RR) ? SCHED_RR : SCHED_FIFO, &param)) != 0)
+            fprintf(stderr, "failed to set realtime priority of the streaming thread: %s\n", strerror(i));
+    }
+
+#if defined(__linux__)
+    if (p->cpu_count > 0) {
+        cpu_set_t cpus;
+
+        s->cpus_valid = (pthread_getaffinity_np(s->thread, sizeof(s->cpus), &s->cpus) == 0);
+
+        CPU_ZERO(&cpus);
+        for (i = 0; i < p->cpu_count; i++) {
+            if (p->cpus[i] < CPU_SETSIZE) CPU_SET(p->cpus[i], &cpus);
+        }
+        if ((i = pthread_setaffinity_np(s->thread, sizeof(cpus), &cpus)) != 0)
+            fprintf(stderr, "failed to set the cpu affinity of the streaming thread: %s\n", strerror(i));
+    }
+#else
+    if (p->cpu_count > 0)
+        fprintf(stderr, "cpu affinity is not supported on this platform\n");
+#endif
+
+    /* celý proces, zůstává i po ukončení čtení */
+    if (p->mlock == MIRISDR_MLOCK_ALL) {
+        if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+            fprintf(stderr, "mlockall failed: %s\n", strerror(errno));
+    }
+#endif
+
+    return s;
+}
+
+void mirisdr_thread_leave (void *saved) {
+    struct mirisdr_thread_saved *s = saved;
+
+    if (!s) return;
+
+#ifdef _WIN32
+    SetThreadPriority(s->thread, s->priority);
+    if (s->mask) SetThreadAffinityMask(s->thread, s->mask);
+#else
+    pthread_setschedparam(s->thread, s->policy, &s->param);
+#if defined(__linux__)
+    if (s->cpus_valid) pthread_setaffinity_np(s->thread, sizeof(s->cpus), &s->cpus);
+#endif
+#endif
+
+    free(s);
+}
+
+/* a worker thread of the library, the policy comes with its attributes */
+void mirisdr_thread_worker (int cpu) {
+#if defined(_WIN32)
+    if ((cpu >= 0) && (cpu < (int) (8 * sizeof(DWORD_PTR))) &&
+        (!SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR) 1 << cpu)))
+        fprintf(stderr, "failed to set the cpu affinity of a worker thread\n");
+#elif defined(__linux__)
+    cpu_set_t cpus;
+    int r;
+
+    if ((cpu < 0) || (cpu >= CPU_SETSIZE)) return;
+
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    if ((r = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus)) != 0)
+        fprintf(stderr, "failed to set the cpu affinity of a worker thread: %s\n", strerror(r));
+#else
+    (void) cpu;
+#endif
+}
+
+/* keep a buffer of the pool in RAM */
+void mirisdr_buffer_lock (mirisdr_dev_t *p, void *buf, size_t len) {
+    if ((!buf) || (p->mlock != MIRISDR_MLOCK_BUFFERS)) return;
+
+#ifdef _WIN32
+    VirtualLock(buf, len);
+#else
+    if (mlock(buf, len) < 0) {
+        fprintf(stderr, "mlock of %lu bytes failed: %s\n", (unsigned long) len, strerror(errno));
+    }
+#endif
+}
+
+/* the mode may have changed since locking, unlocking is harmless anyway */
+void mirisdr_buffer_unlock (mirisdr_dev_t *p, void *buf, size_t len) {
+    (void) p;
+
+    if (!buf) return;
+
+#ifdef _WIN32
+    VirtualUnlock(buf, len);
+#else
+    munlock(buf, len);
+#endif
+}
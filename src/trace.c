@@ -0,0 +1,209 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Latency tracing of the async path
+ *
+ * Every device owns a ring of timestamped begin/end events written by the
+ * libusb event thread.  The writer never blocks and never takes a lock, the
+ * oldest events are simply overwritten.  mirisdr_trace_dump() may run from
+ * any thread, events overwritten while it copies the ring are dropped.  The
+ * output is the Chrome trace event JSON format, open it in Perfetto or
+ * chrome://tracing.
+ */
+
+#include "mirisdr_private.h"
+
+#ifdef MIRISDR_TRACE
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#define DEFAULT_TRACE_ENTRIES   65536
+
+#if defined(__GNUC__)
+#define trace_load(x)           __atomic_load_n((x), __ATOMIC_ACQUIRE)
+#define trace_store(x, v)       __atomic_store_n((x), (v), __ATOMIC_RELEASE)
+#else
+/* MSVC gives volatile accesses acquire/release semantics */
+#define trace_load(x)           (*(volatile uint64_t *) (x))
+#define trace_store(x, v)       (*(volatile uint64_t *) (x) = (v))
+#endif
+
+struct mirisdr_trace_entry {
+    uint64_t            ts;     /* ns */
+    uint32_t            arg;
+    uint8_t             id;
+    char                phase;
+};
+
+struct mirisdr_trace {
+    struct mirisdr_trace_entry *ring;
+    uint64_t            mask;
+    uint64_t            head;   /* počet zapsaných událostí */
+    uint64_t            origin;
+};
+
+static const char *mirisdr_trace_names[MIRISDR_TRACE_MAX] = {
+    "urb",
+    "unpack",
+    "feed",
+    "callback"
+};
+
+static const char *mirisdr_trace_args[MIRISDR_TRACE_MAX] = {
+    "usb_bytes",
+    "bytes",
+    "bytes",
+    "bytes"
+};
+
+static uint64_t mirisdr_trace_now (void) {
+#ifdef _WIN32
+    LARGE_INTEGER c, f;
+    QueryPerformanceCounter(&c);
+    QueryPerformanceFrequency(&f);
+    return (uint64_t) ((double) c.QuadPart * 1e9 / f.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/* only the libusb event thread writes, a single producer */
+void mirisdr_trace_event (mirisdr_dev_t *p, int id, char phase, uint32_t arg) {
+    struct mirisdr_trace *t = p->trace;
+    uint64_t head = t->head;
+    struct mirisdr_trace_entry *e = &t->ring[head & t->mask];
+
+    e->ts = mirisdr_trace_now();
+    e->arg = arg;
+    e->id = (uint8_t) id;
+    e->phase = phase;
+
+    trace_store(&t->head, head + 1);
+}
+
+void mirisdr_trace_free (mirisdr_dev_t *p) {
+    if (!p->trace) return;
+
+    free(p->trace->ring);
+    free(p->trace);
+    p->trace = NULL;
+}
+
+int mirisdr_trace_start (mirisdr_dev_t *p, uint32_t entries) {
+    struct mirisdr_trace *t;
+    uint64_t size = 1;
+
+    if (!p) goto failed;
+
+    /* nelze měnit za běhu */
+    if (mirisdr_async_get(p) != MIRISDR_ASYNC_INACTIVE) goto failed;
+
+    if (!entries) entries = DEFAULT_TRACE_ENTRIES;
+    while (size < entries) size <<= 1;
+
+    mirisdr_trace_free(p);
+
+    if (!(t = malloc(sizeof(*t)))) goto failed;
+    if (!(t->ring = malloc(size * sizeof(*t->ring)))) {
+        free(t);
+        goto failed;
+    }
+    t->mask = size - 1;
+    t->head = 0;
+    t->origin = mirisdr_trace_now();
+
+    p->trace = t;
+
+    return 0;
+
+failed:
+    return -1;
+}
+
+int mirisdr_trace_dump (mirisdr_dev_t *p, const char *path) {
+    struct mirisdr_trace *t;
+    struct mirisdr_trace_entry *copy = NULL, *e;
+    uint64_t first, last, i;
+    FILE *f = NULL;
+
+    if (!p) goto failed;
+    if (!(t = p->trace)) goto failed;
+
+    if (!(copy = malloc((t->mask + 1) * sizeof(*copy)))) goto failed;
+
+    last = trace_load(&t->head);
+    first = (last > t->mask) ? last - t->mask - 1 : 0;
+    for (i = first; i < last; i++)
+        copy[i & t->mask] = t->ring[i & t->mask];
+
+    /* zahodíme události přepsané během kopírování, včetně rozepsané */
+    i = trace_load(&t->head);
+    if ((i > t->mask) && (i - t->mask > first)) first = i - t->mask;
+
+    if (!(f = fopen(path, "w"))) {
+        fprintf(stderr, "failed to open trace file %s\n", path);
+        goto failed;
+    }
+
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":0,"
+               "\"args\":{\"name\":\"mirisdr #%u\"}}",
+            p->index, p->index);
+
+    for (i = first; i < last; i++) {
+        e = &copy[i & t->mask];
+        if (e->id >= MIRISDR_TRACE_MAX) continue;
+
+        fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%u,\"tid\":0,"
+                   "\"args\":{\"%s\":%u}}",
+                mirisdr_trace_names[e->id], e->phase,
+                (double) (int64_t) (e->ts - t->origin) / 1000.0,
+                p->index, mirisdr_trace_args[e->id], e->arg);
+    }
+
+    fprintf(f, "\n]}\n");
+
+    if (fclose(f) != 0) goto failed;
+    free(copy);
+
+    return 0;
+
+failed:
+    free(copy);
+    return -1;
+}
+
+#else
+
+int mirisdr_trace_start (mirisdr_dev_t *p, uint32_t entries) {
+    (void) p;
+    (void) entries;
+    return -1;
+}
+
+int mirisdr_trace_dump (mirisdr_dev_t *p, const char *path) {
+    (void) p;
+    (void) path;
+    return -1;
+}
+
+#endif